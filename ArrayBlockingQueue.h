@@ -1,8 +1,14 @@
 # pragma once
-#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
+#include <optional>
+#include <utility>
+#include "AsyncWaiter.h"
+#include "Locks.h"
+#include "QueueStats.h"
+#include "RawArray.h"
+#include "SelectWaiter.h"
 
 
 /**
@@ -20,78 +26,256 @@
  * changed.  Attempts to {@code put} an element into a full queue
  * will result in the operation blocking; attempts to {@code take} an
  * element from an empty queue will similarly block.
+ *
+ * <p>Elements live in uninitialized slots: they are constructed in
+ * place on insertion and destroyed on removal, so T need not be
+ * default constructible and may be move-only. Together with emplace
+ * and take(T&), a queue of Task (see Task.h) hands closures from
+ * producers to workers without allocating.
+ *
+ * <p>Large elements can be written and read in place, without a copy
+ * or a move, in the manner of the LMAX Disruptor:
+ *
+ * <pre>
+ *   auto slot = q.claim();    // reserves the slot at the tail
+ *   fill(*slot);              // outside the lock
+ *   q.publish(slot);          // makes it visible to takes
+ *
+ *   auto slot = q.peekSlot(); // reserves the slot at the head
+ *   consume(*slot);           // outside the lock
+ *   q.release(slot);          // destroys it and frees the space
+ * </pre>
+ *
+ * The lock is held only to move the cursors. Elements become visible
+ * in claim order and space is reused in peek order, so a slow producer
+ * or consumer holds back the ones behind it but FIFO order is kept.
+ * Every claimed slot must be published and every peeked slot released
+ * exactly once.
+ *
+ * <p>With C++20, asyncTake() and asyncPut() return awaitables for
+ * coroutines: a coroutine that would block is suspended and queued,
+ * and resumed on its executor once its element has been taken or put
+ * for it (see AsyncWaiter.h).
+ *
+ * <p>{@code Lock} is the type of the main lock, std::mutex by default.
+ * Locks.h provides spin, ticket and MCS locks for short critical
+ * sections.
  */
 
 
-template<typename T>
+template<typename T, typename Lock = std::mutex>
 class ArrayBlockingQueue
 {
     public:
         explicit ArrayBlockingQueue(int capacity);
-        ~ArrayBlockingQueue() = default;
+        ~ArrayBlockingQueue();
         ArrayBlockingQueue(const ArrayBlockingQueue& other) = delete;
         ArrayBlockingQueue& operator=(const ArrayBlockingQueue& other) = delete;
         std::shared_ptr<T> take();
         std::shared_ptr<T> poll();
+
+        /**
+         * As take(), but moves the head element into out rather than
+         * into a new shared_ptr, so it allocates nothing. T's move
+         * assignment should not throw.
+         */
+        void take(T &out);
+
+        /** As poll(); returns false, leaving out alone, if the queue is empty. */
+        bool poll(T &out);
+
         void put(const T &value);
+        void put(T &&value);
         bool offer(const T &value);
+        bool offer(T &&value);
+
+        /** Constructs an element in place, waiting for space like put. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
+        /** A slot of the ring reserved by claim() or peekSlot(). */
+        class Slot
+        {
+            public:
+                Slot(): item_(nullptr), index_(-1) {}
+                T& operator*() const { return *item_; }
+                T* operator->() const { return item_; }
+                /** False for the empty slot returned by a failed try */
+                explicit operator bool() const { return item_ != nullptr; }
+            private:
+                friend class ArrayBlockingQueue;
+                Slot(T *item, int index): item_(item), index_(index) {}
+                T *item_;
+                int index_;
+        };
+
+        /**
+         * Reserves the next slot at the tail, waiting if necessary for
+         * space. The element is default-initialized, so a trivial T is
+         * left for the caller to fill.
+         */
+        Slot claim();
+
+        /** As claim(), returning an empty slot if the queue is full. */
+        Slot tryClaim();
+
+        /** Makes a claimed slot available to takes. */
+        void publish(Slot slot);
+
+        /** Reserves the head slot, waiting for an element if necessary. */
+        Slot peekSlot();
+
+        /** As peekSlot(), returning an empty slot if the queue is empty. */
+        Slot tryPeekSlot();
+
+        /** Destroys the element of a peeked slot and frees the space. */
+        void release(Slot slot);
+
         bool empty() const;
         bool full() const;
         int size() const;
         int capacity() const;
+        QueueStatsSnapshot stats() const;
+
+        /** Select support, see Select.h */
+        void addSelectWaiter(SelectWaiter *waiter);
+        void removeSelectWaiter(SelectWaiter *waiter);
+
+#ifdef JAVATHREAD_COROUTINES
+        /** {@code co_await q.asyncTake(executor)} takes without blocking a thread. */
+        AsyncTake<T, ArrayBlockingQueue> asyncTake(Executor &executor);
+
+        /** {@code co_await q.asyncPut(value, executor)} puts without blocking a thread. */
+        AsyncPut<std::optional<T>, ArrayBlockingQueue> asyncPut(T value, Executor &executor);
+
+        /** Coroutine support, see AsyncWaiter.h; false if done without waiting */
+        bool suspendTake(AsyncWaiter<std::shared_ptr<T>> &waiter);
+        bool suspendPut(AsyncWaiter<std::optional<T>> &waiter);
+#endif
 
     private:
-        void enqueue(const T &value);
+        template<typename... Args>
+        bool tryEmplace(Args&&... args);
+        template<typename... Args>
+        void enqueue(Args&&... args);
         std::shared_ptr<T> dequeue();
+        Slot claimSlot();
+        void publishIndex(int index);
+        int acquireHead();
+        void releaseIndex(int index);
+        void serveAsync();
+        void resumeReady();
 
     private:
     
         /** Capacity of the queue */
         const int capacity_;
 
-        /** Number of elements in the queue */
+        /**
+         * Number of elements in the queue: the published slots from
+         * takeIndex_ on, up to the first one still being filled
+         */
         int count_; 
 
+        /** Number of slots from takeIndex_ to putIndex_ */
+        int pending_;
+
+        /** Number of slots from releaseIndex_ to putIndex_, all in use */
+        int used_;
+
         /** items index for next take*/
         int takeIndex_;
         
         /** items index for next put, offer*/
         int putIndex_;
 
-        /** The queued items */
-        std::vector<T> items_;
+        /** items index of the oldest slot not yet released */
+        int releaseIndex_;
+
+        /** The queued items, live in every slot that is not kEmpty */
+        RawArray<T> items_;
+
+        enum SlotState : unsigned char { kEmpty, kClaimed, kPublished, kPeeked };
+
+        /** State of every slot of items_ */
+        std::unique_ptr<SlotState[]> states_;
         
         /** Main lock guarding all access */
-        mutable std::mutex mutex_;
+        mutable Lock mutex_;
 
         /** Condition for waiting takes */
-        std::condition_variable notEmpty_;
+        ConditionVariableFor<Lock> notEmpty_;
 
         /** Condition for waiting puts */
-        std::condition_variable notFull_;
+        ConditionVariableFor<Lock> notFull_;
 
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
 
+        /** Threads selecting on this queue among others */
+        WaiterList selectWaiters_;
+
+#ifdef JAVATHREAD_COROUTINES
+        /** Suspended coroutines, guarded by mutex_ */
+        AsyncWaitQueue<std::shared_ptr<T>> asyncTakes_;
+        AsyncWaitQueue<std::optional<T>> asyncPuts_;
+
+        /** Coroutines served under mutex_ and not resumed yet */
+        AsyncReadyList ready_;
+        std::atomic<bool> hasReady_{false};
+
+        /** Set while serveAsync runs, which re-enters through enqueue/dequeue */
+        bool serving_ = false;
+#endif
 };
-template<typename T>
-ArrayBlockingQueue<T>::ArrayBlockingQueue(int capacity):
+template<typename T, typename Lock>
+ArrayBlockingQueue<T, Lock>::ArrayBlockingQueue(int capacity):
     capacity_(capacity), 
     count_(0),
+    pending_(0),
+    used_(0),
     takeIndex_(0),
-    putIndex_(0)
+    putIndex_(0),
+    releaseIndex_(0),
+    items_(capacity),
+    states_(new SlotState[capacity]())
 {
-    items_.resize(capacity_);
+}
+
+template<typename T, typename Lock>
+ArrayBlockingQueue<T, Lock>::~ArrayBlockingQueue()
+{
+    for(int i = 0; i < capacity_; ++i)
+        if(states_[i] != kEmpty)
+            items_.destroy(i);
 }
 
 
 /* Inserts the specified element into this queue, 
  * waiting if necessary for space to become available. 
  */
-template<typename T>
-void ArrayBlockingQueue<T>::put(const T &value)
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::put(const T &value)
 {
-    std::unique_lock<std::mutex> lk(mutex_);
-    notFull_.wait(lk, [this]{ return count_ < capacity_; });
-    enqueue(value);
+    emplace(value);
+}
+
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::put(T &&value)
+{
+    emplace(std::move(value));
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void ArrayBlockingQueue<T, Lock>::emplace(Args&&... args)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitPut(notFull_, lk, [this]{ return used_ < capacity_; });
+    enqueue(std::forward<Args>(args)...);
+    lk.unlock();
+    resumeReady();
 }
 
 
@@ -100,99 +284,420 @@ void ArrayBlockingQueue<T>::put(const T &value)
  * returning true upon success and false if no space is currently available. 
  */
 
-template<typename T>
-bool ArrayBlockingQueue<T>::offer(const T &value)
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::offer(const T &value)
+{
+    return tryEmplace(value);
+}
+
+/* As above; value is moved from only if it was inserted. */
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::offer(T &&value)
+{
+    return tryEmplace(std::move(value));
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+bool ArrayBlockingQueue<T, Lock>::tryEmplace(Args&&... args)
 { 
-    std::lock_guard<std::mutex> lk(mutex_);
-    if(count_ = capacity_)
-        return false;
-    else
-    {   
-        enqueue(value);
-        return true;
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        if(used_ == capacity_)
+            return false;
+        enqueue(std::forward<Args>(args)...);
     }
+    resumeReady();
+    return true;
 }
 
 /* Retrieves and removes the head of this queue, 
  * waiting if necessary until an element becomes available. 
  */
-template<typename T>
-std::shared_ptr<T> ArrayBlockingQueue<T>::take()
+template<typename T, typename Lock>
+std::shared_ptr<T> ArrayBlockingQueue<T, Lock>::take()
 {
-    std::unique_lock<std::mutex> lk(mutex_);
-    notEmpty_.wait(lk, [this]{ return count_ > 0; });
-    return dequeue();
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(notEmpty_, lk, [this]{ return count_ > 0; });
+    std::shared_ptr<T> res = dequeue();
+    lk.unlock();
+    resumeReady();
+    return res;
 }
 
 /* Retrieves and removes the head of this queue,  
  * if it is possible to do  so immediately without violating capacity restrictions,  
  *  returning the element upon  success and nullpter if the queue is empty.
  */
-template<typename T>
-std::shared_ptr<T> ArrayBlockingQueue<T>::poll()
+template<typename T, typename Lock>
+std::shared_ptr<T> ArrayBlockingQueue<T, Lock>::poll()
 {
-    std::lock_guard<std::mutex> lk(mutex_);
-    if(count_ == 0)
-        return std::shared_ptr<T>();
-    return dequeue();
+    std::shared_ptr<T> res;
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        if(count_ == 0)
+            return res;
+        res = dequeue();
+    }
+    resumeReady();
+    return res;
 };
 
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::take(T &out)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(notEmpty_, lk, [this]{ return count_ > 0; });
+    int index = acquireHead();
+    out = std::move(items_[index]);
+    releaseIndex(index);
+    lk.unlock();
+    resumeReady();
+}
+
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::poll(T &out)
+{
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        if(count_ == 0)
+            return false;
+        int index = acquireHead();
+        out = std::move(items_[index]);
+        releaseIndex(index);
+    }
+    resumeReady();
+    return true;
+}
+
 
  /**
-   * Inserts element at current put position, advances, and signals.
-   * Call only when holding lock.
+   * Constructs element at current put position, advances, and signals.
+   * Call only when holding lock and used_ < capacity_.
    */
-template<typename T>
-void ArrayBlockingQueue<T>::enqueue(const T &value)
+template<typename T, typename Lock>
+template<typename... Args>
+void ArrayBlockingQueue<T, Lock>::enqueue(Args&&... args)
 {
-    items_[putIndex_] = value; 
-    if(++putIndex_ == capacity_)
-        putIndex_ = 0;
-    count_++;
-    notEmpty_.notify_one();
+    items_.construct(putIndex_, std::forward<Args>(args)...);
+    publishIndex(claimSlot().index_);
 }
 
 
 /**
  * Extracts element at current take position, advances, and signals.
- * Call only when holding lock.
+ * Call only when holding lock and count_ > 0.
  */
-template<typename T>
-std::shared_ptr<T> ArrayBlockingQueue<T>::dequeue()
+template<typename T, typename Lock>
+std::shared_ptr<T> ArrayBlockingQueue<T, Lock>::dequeue()
 {
+    int index = acquireHead();
     std::shared_ptr<T> const res(
-        std::make_shared<T>(std::move(items_[takeIndex_])));
+        std::make_shared<T>(std::move(items_[index])));
+    releaseIndex(index);
+    return res;
+}
+
+/**
+ * Reserves the slot at putIndex_, whose element the caller has just
+ * constructed. Call only when holding lock and used_ < capacity_.
+ */
+template<typename T, typename Lock>
+typename ArrayBlockingQueue<T, Lock>::Slot ArrayBlockingQueue<T, Lock>::claimSlot()
+{
+    int index = putIndex_;
+    states_[index] = kClaimed;
+    if(++putIndex_ == capacity_)
+        putIndex_ = 0;
+    pending_++;
+    used_++;
+    return Slot(&items_[index], index);
+}
+
+/**
+ * Marks a slot published and extends count_ over every published slot
+ * that directly follows the visible ones, signalling a take for each.
+ * Call only when holding lock.
+ */
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::publishIndex(int index)
+{
+    states_[index] = kPublished;
+    int next = takeIndex_ + count_;
+    bool signalled = false;
+    while(count_ < pending_ && states_[next < capacity_ ? next : next - capacity_] == kPublished)
+    {
+        ++next;
+        count_++;
+        stats_.recordPut(count_);
+        notEmpty_.notify_one();
+        signalled = true;
+    }
+    if(signalled)
+    {
+        selectWaiters_.signalAll();
+        serveAsync();
+    }
+}
+
+/**
+ * Reserves the slot at takeIndex_. Call only when holding lock and
+ * count_ > 0.
+ */
+template<typename T, typename Lock>
+int ArrayBlockingQueue<T, Lock>::acquireHead()
+{
+    int index = takeIndex_;
+    states_[index] = kPeeked;
     if(++takeIndex_ == capacity_)
         takeIndex_ = 0;
     count_--;
-    notFull_.notify_one();
-    return res;
+    pending_--;
+    stats_.recordTake();
+    return index;
 }
 
-template<typename T>
-bool ArrayBlockingQueue<T>::empty() const
+/**
+ * Destroys the element of a peeked slot, then frees every released
+ * slot from releaseIndex_ on, signalling a put for each. Call only
+ * when holding lock.
+ */
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::releaseIndex(int index)
+{
+    items_.destroy(index);
+    states_[index] = kEmpty;
+    while(used_ > pending_ && states_[releaseIndex_] == kEmpty)
+    {
+        if(++releaseIndex_ == capacity_)
+            releaseIndex_ = 0;
+        used_--;
+        notFull_.notify_one();
+    }
+    serveAsync();
+}
+
+template<typename T, typename Lock>
+typename ArrayBlockingQueue<T, Lock>::Slot ArrayBlockingQueue<T, Lock>::claim()
 {
-    std::lock_guard<std::mutex> lk(mutex_);
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitPut(notFull_, lk, [this]{ return used_ < capacity_; });
+    items_.constructDefault(putIndex_);
+    return claimSlot();
+}
+
+template<typename T, typename Lock>
+typename ArrayBlockingQueue<T, Lock>::Slot ArrayBlockingQueue<T, Lock>::tryClaim()
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(used_ == capacity_)
+        return Slot();
+    items_.constructDefault(putIndex_);
+    return claimSlot();
+}
+
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::publish(Slot slot)
+{
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        publishIndex(slot.index_);
+    }
+    resumeReady();
+}
+
+template<typename T, typename Lock>
+typename ArrayBlockingQueue<T, Lock>::Slot ArrayBlockingQueue<T, Lock>::peekSlot()
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(notEmpty_, lk, [this]{ return count_ > 0; });
+    int index = acquireHead();
+    return Slot(&items_[index], index);
+}
+
+template<typename T, typename Lock>
+typename ArrayBlockingQueue<T, Lock>::Slot ArrayBlockingQueue<T, Lock>::tryPeekSlot()
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(count_ == 0)
+        return Slot();
+    int index = acquireHead();
+    return Slot(&items_[index], index);
+}
+
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::release(Slot slot)
+{
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        releaseIndex(slot.index_);
+    }
+    resumeReady();
+}
+
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::empty() const
+{
+    std::lock_guard<Lock> lk(mutex_);
     return count_ == 0;
 }
 
-template<typename T>
-bool ArrayBlockingQueue<T>::full() const
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::full() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
-    return count_ == capacity_;
+    std::lock_guard<Lock> lk(mutex_);
+    return used_ == capacity_;
 }
 
-template<typename T>
-int ArrayBlockingQueue<T>::size() const
+template<typename T, typename Lock>
+int ArrayBlockingQueue<T, Lock>::size() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
+    std::lock_guard<Lock> lk(mutex_);
     return count_;
 }
 
-template<typename T>
-int ArrayBlockingQueue<T>::capacity() const
+template<typename T, typename Lock>
+int ArrayBlockingQueue<T, Lock>::capacity() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
+    std::lock_guard<Lock> lk(mutex_);
     return capacity_;
-}
\ No newline at end of file
+}
+
+/**
+ * Returns a snapshot of the runtime statistics. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot ArrayBlockingQueue<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
+
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::addSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.add(waiter);
+}
+
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::removeSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.remove(waiter);
+}
+
+/**
+ * Completes the takes and puts of suspended coroutines while there are
+ * elements or space for them, and queues them for resumption. Call
+ * only when holding lock; returns at once when re-entered through
+ * dequeue or enqueue.
+ */
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::serveAsync()
+{
+#ifdef JAVATHREAD_COROUTINES
+    if(serving_ || (asyncTakes_.empty() && asyncPuts_.empty()))
+        return;
+    serving_ = true;
+    bool served;
+    do
+    {
+        served = false;
+        while(count_ > 0 && !asyncTakes_.empty())
+        {
+            AsyncWaiter<std::shared_ptr<T>> *waiter = asyncTakes_.pop();
+            waiter->payload = dequeue();
+            ready_.push(waiter);
+            served = true;
+        }
+        while(used_ < capacity_ && !asyncPuts_.empty())
+        {
+            AsyncWaiter<std::optional<T>> *waiter = asyncPuts_.pop();
+            enqueue(std::move(*waiter->payload));
+            ready_.push(waiter);
+            served = true;
+        }
+    } while(served);
+    serving_ = false;
+    hasReady_.store(!ready_.empty(), std::memory_order_relaxed);
+#endif
+}
+
+/**
+ * Resumes the coroutines served by serveAsync. Called after releasing
+ * the lock by every operation that may have served some; a thread
+ * always sees the flag it set itself, so none is left behind.
+ */
+template<typename T, typename Lock>
+void ArrayBlockingQueue<T, Lock>::resumeReady()
+{
+#ifdef JAVATHREAD_COROUTINES
+    if(!hasReady_.load(std::memory_order_relaxed))
+        return;
+    AsyncReadyList ready;
+    {
+        std::lock_guard<Lock> lk(mutex_);
+        ready.splice(ready_);
+        hasReady_.store(false, std::memory_order_relaxed);
+    }
+    ready.resumeAll();
+#endif
+}
+
+#ifdef JAVATHREAD_COROUTINES
+template<typename T, typename Lock>
+AsyncTake<T, ArrayBlockingQueue<T, Lock>> ArrayBlockingQueue<T, Lock>::asyncTake(Executor &executor)
+{
+    return AsyncTake<T, ArrayBlockingQueue>(*this, executor);
+}
+
+template<typename T, typename Lock>
+AsyncPut<std::optional<T>, ArrayBlockingQueue<T, Lock>> ArrayBlockingQueue<T, Lock>::asyncPut(T value, Executor &executor)
+{
+    return AsyncPut<std::optional<T>, ArrayBlockingQueue>(*this, std::optional<T>(std::move(value)), executor);
+}
+
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::suspendTake(AsyncWaiter<std::shared_ptr<T>> &waiter)
+{
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        if(count_ == 0)
+        {
+            asyncTakes_.push(&waiter);
+            return true;
+        }
+        waiter.payload = dequeue();
+    }
+    resumeReady();
+    return false;
+}
+
+template<typename T, typename Lock>
+bool ArrayBlockingQueue<T, Lock>::suspendPut(AsyncWaiter<std::optional<T>> &waiter)
+{
+    {
+        stats_.lock(mutex_);
+        std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+        if(used_ == capacity_)
+        {
+            asyncPuts_.push(&waiter);
+            return true;
+        }
+        enqueue(std::move(*waiter.payload));
+    }
+    resumeReady();
+    return false;
+}
+#endif
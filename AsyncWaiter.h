@@ -0,0 +1,209 @@
+# pragma once
+
+/**
+ * C++20 coroutine support for the blocking queues.
+ *
+ * <p>{@code co_await q.asyncTake(executor)} and
+ * {@code co_await q.asyncPut(value, executor)} behave like take() and
+ * put(), but a coroutine that has to wait is suspended instead of
+ * blocking its thread. It is queued as an AsyncWaiter on the queue,
+ * under the same lock that guards the check, and the operation that
+ * makes room or brings an element completes the take or put on its
+ * behalf, FIFO among the suspended coroutines, then hands the
+ * coroutine to its executor to be resumed. No thread is blocked, so
+ * any number of coroutines can wait on a handful of threads.
+ *
+ * <p>Resumption always goes through the executor, after the queue's
+ * locks have been released, so an InlineExecutor is safe and a thread
+ * pool spreads the consumers over its threads. Each resumption costs
+ * one small allocation, the Runnable handed to the executor.
+ *
+ * <p>Everything here is compiled only when the compiler supports
+ * coroutines (C++20); JAVATHREAD_COROUTINES is defined then.
+ */
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include(<coroutine>)
+#define JAVATHREAD_COROUTINES 1
+#endif
+
+#ifdef JAVATHREAD_COROUTINES
+#include <coroutine>
+#include <memory>
+#include <utility>
+#include "CompletableFuture.h"
+
+/** A suspended coroutine, linked into one list at a time. */
+class AsyncWaiterBase
+{
+    public:
+        /** Hands the coroutine to its executor. */
+        void resume()
+        {
+            executor->execute(new ResumeTask(handle));
+        }
+
+        AsyncWaiterBase *next = nullptr;
+        std::coroutine_handle<> handle;
+        Executor *executor = nullptr;
+
+    private:
+        class ResumeTask : public Runnable
+        {
+            public:
+                explicit ResumeTask(std::coroutine_handle<> h): handle_(h) {}
+                void run() override { handle_.resume(); }
+            private:
+                std::coroutine_handle<> handle_;
+        };
+};
+
+/**
+ * A suspended take or put. The payload is the element handed to a
+ * take, or the element a put waits to insert.
+ */
+template<typename Payload>
+class AsyncWaiter : public AsyncWaiterBase
+{
+    public:
+        Payload payload;
+};
+
+/** FIFO of suspended coroutines; guarded by the lock of the queue. */
+template<typename Payload>
+class AsyncWaitQueue
+{
+    public:
+        bool empty() const { return head_ == nullptr; }
+
+        /** The oldest waiter; the queue must not be empty */
+        AsyncWaiter<Payload> *front() const { return head_; }
+
+        void push(AsyncWaiter<Payload> *waiter)
+        {
+            waiter->next = nullptr;
+            if(tail_ == nullptr)
+                head_ = waiter;
+            else
+                tail_->next = waiter;
+            tail_ = waiter;
+        }
+
+        AsyncWaiter<Payload> *pop()
+        {
+            AsyncWaiter<Payload> *waiter = head_;
+            head_ = static_cast<AsyncWaiter<Payload>*>(waiter->next);
+            if(head_ == nullptr)
+                tail_ = nullptr;
+            return waiter;
+        }
+
+    private:
+        AsyncWaiter<Payload> *head_ = nullptr;
+        AsyncWaiter<Payload> *tail_ = nullptr;
+};
+
+/**
+ * Coroutines whose operation has been completed, to be resumed once
+ * the queue's locks are released.
+ */
+class AsyncReadyList
+{
+    public:
+        bool empty() const { return head_ == nullptr; }
+
+        void push(AsyncWaiterBase *waiter)
+        {
+            waiter->next = nullptr;
+            if(tail_ == nullptr)
+                head_ = waiter;
+            else
+                tail_->next = waiter;
+            tail_ = waiter;
+        }
+
+        /** Takes over the contents of other */
+        void splice(AsyncReadyList &other)
+        {
+            if(other.head_ == nullptr)
+                return;
+            if(tail_ == nullptr)
+                head_ = other.head_;
+            else
+                tail_->next = other.head_;
+            tail_ = other.tail_;
+            other.head_ = other.tail_ = nullptr;
+        }
+
+        /** Resumes every coroutine on its executor and empties the list. */
+        void resumeAll()
+        {
+            AsyncWaiterBase *waiter = head_;
+            head_ = tail_ = nullptr;
+            while(waiter != nullptr)
+            {
+                /* the coroutine may finish, freeing the waiter, as soon as it is resumed */
+                AsyncWaiterBase *next = waiter->next;
+                waiter->resume();
+                waiter = next;
+            }
+        }
+
+    private:
+        AsyncWaiterBase *head_ = nullptr;
+        AsyncWaiterBase *tail_ = nullptr;
+};
+
+/** The awaitable of asyncTake(); yields the element as take() does. */
+template<typename T, typename Queue>
+class AsyncTake
+{
+    public:
+        AsyncTake(Queue &queue, Executor &executor): queue_(queue)
+        {
+            waiter_.executor = &executor;
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        /** Takes at once if it can, returning false; queues the coroutine otherwise. */
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter_.handle = handle;
+            return queue_.suspendTake(waiter_);
+        }
+
+        std::shared_ptr<T> await_resume() { return std::move(waiter_.payload); }
+
+    private:
+        Queue &queue_;
+        AsyncWaiter<std::shared_ptr<T>> waiter_;
+};
+
+/** The awaitable of asyncPut(); Payload is what the queue inserts. */
+template<typename Payload, typename Queue>
+class AsyncPut
+{
+    public:
+        AsyncPut(Queue &queue, Payload payload, Executor &executor): queue_(queue)
+        {
+            waiter_.payload = std::move(payload);
+            waiter_.executor = &executor;
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        /** Puts at once if there is room, returning false; queues the coroutine otherwise. */
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            waiter_.handle = handle;
+            return queue_.suspendPut(waiter_);
+        }
+
+        void await_resume() {}
+
+    private:
+        Queue &queue_;
+        AsyncWaiter<Payload> waiter_;
+};
+
+#endif
@@ -0,0 +1,631 @@
+# pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "Locks.h"
+#include "QueueStats.h"
+#include "RawArray.h"
+
+/**
+ * A blocking queue assembled from policies at compile time:
+ *
+ * <pre>
+ *   BlockingQueue<T, Storage, Sync, Bound>
+ * </pre>
+ *
+ * <p>{@code Storage} says where elements live and in which order they
+ * leave: RingStorage (a fixed array, FIFO), LinkedStorage (a node per
+ * element, FIFO), HeapStorage (a binary heap, least first) or
+ * ChunkedDequeStorage (a std::deque, FIFO). {@code Sync} says how
+ * threads are coordinated: SingleLock guards everything with one lock,
+ * as ArrayBlockingQueue does; TwoLock lets a put and a take proceed in
+ * parallel, as LinkedBlockingQueue does. {@code Bound} is Bounded, where
+ * put waits for space, or Unbounded. Each policy takes its lock type
+ * the way the queues do (see Locks.h).
+ *
+ * <p>The Sync policy holds the whole put/take algorithm, with the
+ * storage as a member of a concrete type, so every combination compiles
+ * to direct, inlinable calls. Combinations that cannot work fail to
+ * compile: TwoLock needs a storage whose two ends can be used by
+ * different threads at once (ring and linked), and a ring needs a
+ * bound.
+ *
+ * <p>The aliases at the end give the designs of the hand-written queues
+ * as policy combinations. The hand-written classes stay: their extra
+ * features (claim/publish slots, spilling, load shedding, batches,
+ * coroutine and select support) are not expressible as these policies.
+ * A lock-free Sync is not offered, because the lock-free queues
+ * (ConcurrentLinkedDeque, MpscQueue) interleave their synchronization
+ * with their node layout and have no separable storage.
+ */
+
+/** Bound policy: put waits while the queue holds capacity elements. */
+struct Bounded
+{
+    static constexpr bool kBounded = true;
+};
+
+/** Bound policy: put never waits; the capacity is ignored. */
+struct Unbounded
+{
+    static constexpr bool kBounded = false;
+};
+
+/*
+ * Storage policies. Each has a nested Store<T> that the Sync policy
+ * calls under its lock(s): push(args...) constructs at the back,
+ * front() is the next element out and pop() removes it. A store does
+ * not count its elements; the Sync policy does. kSplitEnds says that
+ * push may run concurrently with front()/pop() while the queue is
+ * neither empty nor full, which TwoLock relies on; kFixedCapacity that
+ * the store cannot hold more than the capacity it is built with.
+ */
+
+/** Storage policy: a ring of capacity uninitialized slots, FIFO. */
+struct RingStorage
+{
+    template<typename T>
+    class Store
+    {
+        public:
+            static constexpr bool kSplitEnds = true;
+            static constexpr bool kFixedCapacity = true;
+
+            explicit Store(int capacity): items_(capacity), capacity_(capacity) {}
+            ~Store();
+            Store(const Store&) = delete;
+            Store& operator=(const Store&) = delete;
+
+            template<typename... Args>
+            void push(Args&&... args)
+            {
+                items_.construct(putIndex_, std::forward<Args>(args)...);
+                if(++putIndex_ == capacity_)
+                    putIndex_ = 0;
+                ++pushed_;
+            }
+            T &front() { return items_[takeIndex_]; }
+            void pop()
+            {
+                items_.destroy(takeIndex_);
+                if(++takeIndex_ == capacity_)
+                    takeIndex_ = 0;
+                ++popped_;
+            }
+
+        private:
+            RawArray<T> items_;
+            const int capacity_;
+            /** Producer side */
+            int putIndex_ = 0;
+            unsigned long pushed_ = 0;
+            /** Consumer side, on a line of its own */
+            alignas(64) int takeIndex_ = 0;
+            unsigned long popped_ = 0;
+    };
+};
+
+template<typename T>
+RingStorage::Store<T>::~Store()
+{
+    for(; popped_ != pushed_; ++popped_)
+    {
+        items_.destroy(takeIndex_);
+        if(++takeIndex_ == capacity_)
+            takeIndex_ = 0;
+    }
+}
+
+/**
+ * Storage policy: a singly linked list with a dummy head node, FIFO.
+ * push touches only the last node and pop only the first two, so the
+ * ends can be used concurrently.
+ */
+struct LinkedStorage
+{
+    template<typename T>
+    class Store
+    {
+        public:
+            static constexpr bool kSplitEnds = true;
+            static constexpr bool kFixedCapacity = false;
+
+            explicit Store(int): head_(new Node()), tail_(head_) {}
+            ~Store();
+            Store(const Store&) = delete;
+            Store& operator=(const Store&) = delete;
+
+            template<typename... Args>
+            void push(Args&&... args)
+            {
+                Node *node = new Node();
+                node->item.emplace(std::forward<Args>(args)...);
+                tail_->next = node;
+                tail_ = node;
+            }
+            T &front() { return *head_->next->item; }
+            /* The first node becomes the new dummy, as in LinkedBlockingQueue */
+            void pop()
+            {
+                Node *first = head_->next;
+                first->item.reset();
+                delete head_;
+                head_ = first;
+            }
+
+        private:
+            struct Node
+            {
+                Node *next = nullptr;
+                std::optional<T> item;
+            };
+
+            /** Consumer side */
+            Node *head_;
+            /** Producer side, on a line of its own */
+            alignas(64) Node *tail_;
+    };
+};
+
+template<typename T>
+LinkedStorage::Store<T>::~Store()
+{
+    while(head_ != nullptr)
+    {
+        Node *next = head_->next;
+        delete head_;
+        head_ = next;
+    }
+}
+
+/**
+ * Storage policy: a binary heap in a vector; the least element by
+ * Compare leaves first, as in PriorityBlockingQueue.
+ */
+template<typename Compare = std::less<>>
+struct HeapStorage
+{
+    template<typename T>
+    class Store
+    {
+        public:
+            static constexpr bool kSplitEnds = false;
+            static constexpr bool kFixedCapacity = false;
+
+            explicit Store(int) {}
+
+            template<typename... Args>
+            void push(Args&&... args)
+            {
+                heap_.emplace_back(std::forward<Args>(args)...);
+                std::push_heap(heap_.begin(), heap_.end(), Greater());
+            }
+            T &front() { return heap_.front(); }
+            void pop()
+            {
+                std::pop_heap(heap_.begin(), heap_.end(), Greater());
+                heap_.pop_back();
+            }
+
+        private:
+            /* std heaps keep the greatest on top; invert for least first */
+            struct Greater
+            {
+                bool operator()(const T &a, const T &b) const { return Compare()(b, a); }
+            };
+
+            std::vector<T> heap_;
+    };
+};
+
+/** Storage policy: a std::deque, which allocates in chunks, FIFO. */
+struct ChunkedDequeStorage
+{
+    template<typename T>
+    class Store
+    {
+        public:
+            static constexpr bool kSplitEnds = false;
+            static constexpr bool kFixedCapacity = false;
+
+            explicit Store(int) {}
+
+            template<typename... Args>
+            void push(Args&&... args) { items_.emplace_back(std::forward<Args>(args)...); }
+            T &front() { return items_.front(); }
+            void pop() { items_.pop_front(); }
+
+        private:
+            std::deque<T> items_;
+    };
+};
+
+/*
+ * Sync policies. Each has a nested Core<Store, Bound> implementing the
+ * blocking algorithm over a store. Takes hand the head element to a
+ * sink, called as sink(T&&) under the take lock, so that the caller
+ * chooses between moving into a variable and wrapping in a shared_ptr.
+ */
+
+/**
+ * Sync policy: one lock and two conditions, as in ArrayBlockingQueue.
+ * Works with every storage.
+ */
+template<typename Lock = std::mutex>
+struct SingleLock
+{
+    template<typename Store, typename Bound>
+    class Core
+    {
+        public:
+            explicit Core(int capacity): capacity_(capacity), store_(capacity) {}
+
+            template<typename... Args>
+            void put(Args&&... args);
+            template<typename... Args>
+            bool offer(Args&&... args);
+            template<typename Sink>
+            void take(Sink sink);
+            template<typename Sink>
+            bool poll(Sink sink);
+
+            int size() const
+            {
+                std::lock_guard<Lock> lk(mutex_);
+                return count_;
+            }
+            QueueStatsSnapshot stats() const { return stats_.snapshot(); }
+
+        private:
+            bool full() const { return Bound::kBounded && count_ == capacity_; }
+            template<typename... Args>
+            void enqueue(Args&&... args);
+            template<typename Sink>
+            void dequeue(Sink &sink);
+
+            const int capacity_;
+            int count_ = 0;
+            Store store_;
+            mutable Lock mutex_;
+            ConditionVariableFor<Lock> notEmpty_;
+            ConditionVariableFor<Lock> notFull_;
+            QueueStats stats_;
+    };
+};
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+void SingleLock<Lock>::Core<Store, Bound>::put(Args&&... args)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    if constexpr(Bound::kBounded)
+        stats_.awaitPut(notFull_, lk, [this]{ return !full(); });
+    enqueue(std::forward<Args>(args)...);
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+bool SingleLock<Lock>::Core<Store, Bound>::offer(Args&&... args)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(full())
+        return false;
+    enqueue(std::forward<Args>(args)...);
+    return true;
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+void SingleLock<Lock>::Core<Store, Bound>::take(Sink sink)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(notEmpty_, lk, [this]{ return count_ > 0; });
+    dequeue(sink);
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+bool SingleLock<Lock>::Core<Store, Bound>::poll(Sink sink)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(count_ == 0)
+        return false;
+    dequeue(sink);
+    return true;
+}
+
+/* Call only when holding mutex_ and not full. */
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+void SingleLock<Lock>::Core<Store, Bound>::enqueue(Args&&... args)
+{
+    store_.push(std::forward<Args>(args)...);
+    stats_.recordPut(++count_);
+    notEmpty_.notify_one();
+}
+
+/* Call only when holding mutex_ and count_ > 0. */
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+void SingleLock<Lock>::Core<Store, Bound>::dequeue(Sink &sink)
+{
+    sink(std::move(store_.front()));
+    store_.pop();
+    --count_;
+    stats_.recordTake();
+    if constexpr(Bound::kBounded)
+        notFull_.notify_one();
+}
+
+/**
+ * Sync policy: separate put and take locks with an atomic count, as in
+ * LinkedBlockingQueue. A put signals takers only when it made the queue
+ * non-empty and a take signals putters only when it made it non-full;
+ * waiters of the same side wake each other in cascade.
+ */
+template<typename Lock = std::mutex>
+struct TwoLock
+{
+    template<typename Store, typename Bound>
+    class Core
+    {
+        static_assert(Store::kSplitEnds, "TwoLock needs a storage with independent ends");
+
+        public:
+            explicit Core(int capacity): capacity_(capacity), store_(capacity) {}
+
+            template<typename... Args>
+            void put(Args&&... args);
+            template<typename... Args>
+            bool offer(Args&&... args);
+            template<typename Sink>
+            void take(Sink sink);
+            template<typename Sink>
+            bool poll(Sink sink);
+
+            int size() const { return count_.load(); }
+            QueueStatsSnapshot stats() const { return stats_.snapshot(); }
+
+        private:
+            template<typename... Args>
+            int enqueue(Args&&... args);
+            template<typename Sink>
+            int dequeue(Sink &sink);
+            void signalNotEmpty();
+            void signalNotFull();
+
+            const int capacity_;
+            std::atomic<int> count_{0};
+            Store store_;
+            mutable Lock putLock_;
+            ConditionVariableFor<Lock> notFull_;
+            mutable Lock takeLock_;
+            ConditionVariableFor<Lock> notEmpty_;
+            QueueStats stats_;
+    };
+};
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+void TwoLock<Lock>::Core<Store, Bound>::put(Args&&... args)
+{
+    int c;
+    {
+        std::unique_lock<Lock> lk(putLock_, std::defer_lock);
+        stats_.lock(lk);
+        if constexpr(Bound::kBounded)
+            stats_.awaitPut(notFull_, lk, [this]{ return count_.load() < capacity_; });
+        c = enqueue(std::forward<Args>(args)...);
+    }
+    if(c == 0)
+        signalNotEmpty();
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+bool TwoLock<Lock>::Core<Store, Bound>::offer(Args&&... args)
+{
+    if(Bound::kBounded && count_.load() == capacity_)
+        return false;
+    int c;
+    {
+        stats_.lock(putLock_);
+        std::lock_guard<Lock> lk(putLock_, std::adopt_lock);
+        if(Bound::kBounded && count_.load() == capacity_)
+            return false;
+        c = enqueue(std::forward<Args>(args)...);
+    }
+    if(c == 0)
+        signalNotEmpty();
+    return true;
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+void TwoLock<Lock>::Core<Store, Bound>::take(Sink sink)
+{
+    int c;
+    {
+        std::unique_lock<Lock> lk(takeLock_, std::defer_lock);
+        stats_.lock(lk);
+        stats_.awaitTake(notEmpty_, lk, [this]{ return count_.load() > 0; });
+        c = dequeue(sink);
+    }
+    if(Bound::kBounded && c == capacity_)
+        signalNotFull();
+}
+
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+bool TwoLock<Lock>::Core<Store, Bound>::poll(Sink sink)
+{
+    if(count_.load() == 0)
+        return false;
+    int c;
+    {
+        stats_.lock(takeLock_);
+        std::lock_guard<Lock> lk(takeLock_, std::adopt_lock);
+        if(count_.load() == 0)
+            return false;
+        c = dequeue(sink);
+    }
+    if(Bound::kBounded && c == capacity_)
+        signalNotFull();
+    return true;
+}
+
+/*
+ * Call only when holding putLock_ and not full. Returns the count
+ * before the put; wakes the next putter if there is still space.
+ */
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename... Args>
+int TwoLock<Lock>::Core<Store, Bound>::enqueue(Args&&... args)
+{
+    store_.push(std::forward<Args>(args)...);
+    const int c = count_.fetch_add(1);
+    stats_.recordPut(c + 1);
+    if(Bound::kBounded && c + 1 < capacity_)
+        notFull_.notify_one();
+    return c;
+}
+
+/*
+ * Call only when holding takeLock_ and count_ > 0. Returns the count
+ * before the take; wakes the next taker if elements remain.
+ */
+template<typename Lock>
+template<typename Store, typename Bound>
+template<typename Sink>
+int TwoLock<Lock>::Core<Store, Bound>::dequeue(Sink &sink)
+{
+    sink(std::move(store_.front()));
+    store_.pop();
+    const int c = count_.fetch_sub(1);
+    stats_.recordTake();
+    if(c > 1)
+        notEmpty_.notify_one();
+    return c;
+}
+
+/* Signals a waiting take; called from put/offer only. */
+template<typename Lock>
+template<typename Store, typename Bound>
+void TwoLock<Lock>::Core<Store, Bound>::signalNotEmpty()
+{
+    std::lock_guard<Lock> lk(takeLock_);
+    notEmpty_.notify_one();
+}
+
+/* Signals a waiting put; called from take/poll only. */
+template<typename Lock>
+template<typename Store, typename Bound>
+void TwoLock<Lock>::Core<Store, Bound>::signalNotFull()
+{
+    std::lock_guard<Lock> lk(putLock_);
+    notFull_.notify_one();
+}
+
+/**
+ * The queue itself: the Sync policy's core over the Storage policy's
+ * store, with the usual queue surface on top.
+ */
+template<typename T, typename Storage, typename Sync = SingleLock<>, typename Bound = Bounded>
+class BlockingQueue
+{
+    typedef typename Storage::template Store<T> Store;
+    static_assert(!Store::kFixedCapacity || Bound::kBounded, "this storage needs a Bounded queue");
+
+    public:
+        explicit BlockingQueue(int capacity = std::numeric_limits<int>::max()):
+            capacity_(capacity), core_(capacity) {}
+        BlockingQueue(const BlockingQueue&) = delete;
+        BlockingQueue& operator=(const BlockingQueue&) = delete;
+
+        void put(const T &value) { core_.put(value); }
+        void put(T &&value) { core_.put(std::move(value)); }
+        /** Constructs an element in place, waiting for space like put. */
+        template<typename... Args>
+        void emplace(Args&&... args) { core_.put(std::forward<Args>(args)...); }
+
+        bool offer(const T &value) { return core_.offer(value); }
+        /** As above; value is moved from only if it was inserted. */
+        bool offer(T &&value) { return core_.offer(std::move(value)); }
+
+        std::shared_ptr<T> take();
+        std::shared_ptr<T> poll();
+        /** As take(), moving the head into out without allocating. */
+        void take(T &out) { core_.take([&out](T &&v){ out = std::move(v); }); }
+        /** As poll(); returns false, leaving out alone, if the queue is empty. */
+        bool poll(T &out) { return core_.poll([&out](T &&v){ out = std::move(v); }); }
+
+        int size() const { return core_.size(); }
+        bool empty() const { return size() == 0; }
+        /** The bound, or INT_MAX for an Unbounded queue */
+        int capacity() const { return Bound::kBounded ? capacity_ : std::numeric_limits<int>::max(); }
+        QueueStatsSnapshot stats() const { return core_.stats(); }
+
+    private:
+        const int capacity_;
+        typename Sync::template Core<Store, Bound> core_;
+};
+
+template<typename T, typename Storage, typename Sync, typename Bound>
+std::shared_ptr<T> BlockingQueue<T, Storage, Sync, Bound>::take()
+{
+    std::shared_ptr<T> res;
+    core_.take([&res](T &&v){ res = std::make_shared<T>(std::move(v)); });
+    return res;
+}
+
+template<typename T, typename Storage, typename Sync, typename Bound>
+std::shared_ptr<T> BlockingQueue<T, Storage, Sync, Bound>::poll()
+{
+    std::shared_ptr<T> res;
+    core_.poll([&res](T &&v){ res = std::make_shared<T>(std::move(v)); });
+    return res;
+}
+
+/*
+ * The designs of the hand-written queues, as policy combinations, and
+ * the one they could not offer: ring storage with two-lock signaling.
+ */
+
+/** ArrayBlockingQueue's design: a ring under one lock */
+template<typename T, typename Lock = std::mutex>
+using BasicArrayBlockingQueue = BlockingQueue<T, RingStorage, SingleLock<Lock>, Bounded>;
+
+/** LinkedBlockingQueue's design: linked nodes under two locks */
+template<typename T, typename Lock = std::mutex>
+using BasicLinkedBlockingQueue = BlockingQueue<T, LinkedStorage, TwoLock<Lock>, Bounded>;
+
+/** PriorityBlockingQueue's design: an unbounded heap under one lock */
+template<typename T, typename Compare = std::less<>, typename Lock = std::mutex>
+using BasicPriorityBlockingQueue = BlockingQueue<T, HeapStorage<Compare>, SingleLock<Lock>, Unbounded>;
+
+/** A ring whose puts and takes do not contend for a lock */
+template<typename T, typename Lock = std::mutex>
+using TwoLockArrayBlockingQueue = BlockingQueue<T, RingStorage, TwoLock<Lock>, Bounded>;
@@ -0,0 +1,281 @@
+# pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "Locks.h"
+#include "QueueStats.h"
+
+/**
+ * A bounded blocking queue of variable-length byte records, kept
+ * length-prefixed in one contiguous byte ring. It is the byte-bounded
+ * counterpart of ArrayBlockingQueue: its capacity is a number of
+ * bytes, so memory use is fixed up front whatever the mix of record
+ * sizes, and small records sit next to each other instead of each
+ * taking a slot sized for the largest.
+ *
+ * <p>A record takes a 4 byte length header and its payload, rounded up
+ * to 4 bytes. Records are never split: one that does not fit before
+ * the end of the ring is written at its start, and the unused end is
+ * marked as skipped and counts as used until the take reaches it. A
+ * record may be up to maxRecordLength() bytes long, the capacity less
+ * the header and under 4 GiB, since the ring starts over at offset 0
+ * whenever it runs empty; put throws std::length_error for a longer
+ * one.
+ *
+ * <p>Puts wait until their record fits. As waiting puts may need
+ * different amounts of space, a take wakes all of them; those that
+ * still do not fit wait again. Records are copied in and out under the
+ * lock.
+ *
+ * <p>{@code Lock} is the type of the lock, std::mutex by default (see
+ * Locks.h).
+ */
+template<typename Lock = std::mutex>
+class ByteArrayBlockingQueue
+{
+    public:
+        /**
+         * A queue of capacityBytes bytes, rounded down to a multiple of
+         * 4; throws std::invalid_argument if that leaves less than 4.
+         */
+        explicit ByteArrayBlockingQueue(std::size_t capacityBytes);
+        ByteArrayBlockingQueue(const ByteArrayBlockingQueue&) = delete;
+        ByteArrayBlockingQueue& operator=(const ByteArrayBlockingQueue&) = delete;
+
+        /** Appends a record, waiting for space if necessary. */
+        void put(const void *data, std::size_t length);
+        void put(std::string_view record) { put(record.data(), record.size()); }
+
+        /** Appends a record if it fits now; returns false otherwise. */
+        bool offer(const void *data, std::size_t length);
+        bool offer(std::string_view record) { return offer(record.data(), record.size()); }
+
+        /**
+         * Removes the next record, waiting for one if necessary, and
+         * replaces the contents of out with it. Reusing out across takes
+         * saves the allocation.
+         */
+        void take(std::string &out);
+        std::string take();
+
+        /** As take(out); returns false, leaving out alone, if the queue is empty. */
+        bool poll(std::string &out);
+
+        /** Number of records */
+        int size() const;
+        bool empty() const { return size() == 0; }
+        /** Bytes in use, headers, padding and skipped ends included */
+        std::size_t bytes() const;
+        std::size_t capacity() const { return capacity_; }
+        /**
+         * Length of the longest record that can be put: the capacity
+         * less the header, and below kSkip, which the header could not
+         * tell from a skipped end
+         */
+        std::size_t maxRecordLength() const
+        {
+            return std::min(capacity_ - kHeader, static_cast<std::size_t>(kSkip - 1));
+        }
+        QueueStatsSnapshot stats() const { return stats_.snapshot(); }
+
+    private:
+        static constexpr std::size_t kHeader = sizeof(std::uint32_t);
+        static constexpr std::size_t kAlign = 4;
+        /** Length header of a skipped end of the ring */
+        static constexpr std::uint32_t kSkip = 0xffffffffu;
+
+        static std::size_t checkedCapacity(std::size_t capacityBytes);
+
+        static std::size_t recordSize(std::size_t length)
+        {
+            return kHeader + (length + kAlign - 1) / kAlign * kAlign;
+        }
+
+        std::size_t checkedSize(std::size_t length) const;
+        bool fits(std::size_t size) const;
+        void enqueue(const void *data, std::size_t length, std::size_t size);
+        void dequeue(std::string &out);
+
+        const std::size_t capacity_;
+        std::unique_ptr<char[]> ring_;
+        /** Offset of the next record to take */
+        std::size_t head_ = 0;
+        /** Offset at which the next record goes */
+        std::size_t tail_ = 0;
+        /** Bytes from head_ to tail_, skipped ends included */
+        std::size_t used_ = 0;
+        int count_ = 0;
+        /** Number of puts waiting for space */
+        int waitingPuts_ = 0;
+
+        mutable Lock mutex_;
+        ConditionVariableFor<Lock> notEmpty_;
+        ConditionVariableFor<Lock> notFull_;
+        QueueStats stats_;
+};
+
+template<typename Lock>
+ByteArrayBlockingQueue<Lock>::ByteArrayBlockingQueue(std::size_t capacityBytes):
+    capacity_(checkedCapacity(capacityBytes)),
+    ring_(new char[capacity_])
+{
+}
+
+template<typename Lock>
+std::size_t ByteArrayBlockingQueue<Lock>::checkedCapacity(std::size_t capacityBytes)
+{
+    const std::size_t capacity = capacityBytes / kAlign * kAlign;
+    if(capacity < kHeader)
+        throw std::invalid_argument("ByteArrayBlockingQueue: capacity below one record header");
+    return capacity;
+}
+
+template<typename Lock>
+std::size_t ByteArrayBlockingQueue<Lock>::checkedSize(std::size_t length) const
+{
+    if(length > maxRecordLength())
+        throw std::length_error("ByteArrayBlockingQueue: record longer than the queue");
+    return recordSize(length);
+}
+
+template<typename Lock>
+void ByteArrayBlockingQueue<Lock>::put(const void *data, std::size_t length)
+{
+    const std::size_t size = checkedSize(length);
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    if(!fits(size))
+    {
+        ++waitingPuts_;
+        stats_.awaitPut(notFull_, lk, [this, size]{ return fits(size); });
+        --waitingPuts_;
+    }
+    enqueue(data, length, size);
+}
+
+template<typename Lock>
+bool ByteArrayBlockingQueue<Lock>::offer(const void *data, std::size_t length)
+{
+    const std::size_t size = checkedSize(length);
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(!fits(size))
+        return false;
+    enqueue(data, length, size);
+    return true;
+}
+
+template<typename Lock>
+void ByteArrayBlockingQueue<Lock>::take(std::string &out)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(notEmpty_, lk, [this]{ return count_ > 0; });
+    dequeue(out);
+}
+
+template<typename Lock>
+std::string ByteArrayBlockingQueue<Lock>::take()
+{
+    std::string out;
+    take(out);
+    return out;
+}
+
+template<typename Lock>
+bool ByteArrayBlockingQueue<Lock>::poll(std::string &out)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(count_ == 0)
+        return false;
+    dequeue(out);
+    return true;
+}
+
+/**
+ * True if a record of size bytes can be written now: after tail_, or
+ * else at the start of the ring, in which case the end after tail_ is
+ * lost until taken. An empty ring starts over at 0, so any record
+ * fits it. Call only when holding lock.
+ */
+template<typename Lock>
+bool ByteArrayBlockingQueue<Lock>::fits(std::size_t size) const
+{
+    if(used_ == 0)
+        return true;
+    if(used_ + size > capacity_)
+        return false;
+    if(tail_ >= head_)
+        return capacity_ - tail_ >= size || head_ >= size;
+    return head_ - tail_ >= size;
+}
+
+/* Call only when holding lock and fits(size). */
+template<typename Lock>
+void ByteArrayBlockingQueue<Lock>::enqueue(const void *data, std::size_t length, std::size_t size)
+{
+    if(used_ == 0)
+        head_ = tail_ = 0;
+    else if(capacity_ - tail_ < size)
+    {
+        std::memcpy(ring_.get() + tail_, &kSkip, kHeader);
+        used_ += capacity_ - tail_;
+        tail_ = 0;
+    }
+    const std::uint32_t header = static_cast<std::uint32_t>(length);
+    std::memcpy(ring_.get() + tail_, &header, kHeader);
+    if(length > 0)
+        std::memcpy(ring_.get() + tail_ + kHeader, data, length);
+    tail_ += size;
+    if(tail_ == capacity_)
+        tail_ = 0;
+    used_ += size;
+    stats_.recordPut(++count_);
+    notEmpty_.notify_one();
+}
+
+/* Call only when holding lock and count_ > 0. */
+template<typename Lock>
+void ByteArrayBlockingQueue<Lock>::dequeue(std::string &out)
+{
+    std::uint32_t header;
+    std::memcpy(&header, ring_.get() + head_, kHeader);
+    if(header == kSkip)
+    {
+        used_ -= capacity_ - head_;
+        head_ = 0;
+        std::memcpy(&header, ring_.get(), kHeader);
+    }
+    out.assign(ring_.get() + head_ + kHeader, header);
+    const std::size_t size = recordSize(header);
+    head_ += size;
+    if(head_ == capacity_)
+        head_ = 0;
+    used_ -= size;
+    --count_;
+    stats_.recordTake();
+    if(waitingPuts_ > 0)
+        notFull_.notify_all();
+}
+
+template<typename Lock>
+int ByteArrayBlockingQueue<Lock>::size() const
+{
+    std::lock_guard<Lock> lk(mutex_);
+    return count_;
+}
+
+template<typename Lock>
+std::size_t ByteArrayBlockingQueue<Lock>::bytes() const
+{
+    std::lock_guard<Lock> lk(mutex_);
+    return used_;
+}
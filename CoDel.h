@@ -0,0 +1,99 @@
+# pragma once
+#include <chrono>
+#include <functional>
+#include <memory>
+
+/**
+ * Configuration of the active queue management mode of
+ * LinkedBlockingQueue, see CoDel.
+ *
+ * <p>Elements the queue sheds are handed to {@code onDrop}, which may
+ * divert them elsewhere, e.g. answer the request with a rejection; if
+ * it is empty they are simply destroyed. onDrop runs on the taking
+ * thread after the queue's lock has been released.
+ */
+template<typename T>
+struct CoDelOptions
+{
+    /** Sojourn time the queue may keep up persistently */
+    std::chrono::steady_clock::duration target = std::chrono::milliseconds(5);
+
+    /** How long the sojourn time must stay above target before shedding starts */
+    std::chrono::steady_clock::duration interval = std::chrono::milliseconds(100);
+
+    /** Receives every shed element */
+    std::function<void(std::shared_ptr<T>)> onDrop;
+};
+
+/**
+ * Controlled Delay (Nichols and Jacobson, RFC 8289) in the form used
+ * for request queues by Wangle and folly, as a per-element decision for
+ * the head of a queue.
+ *
+ * <p>Each element is stamped when it is queued and its sojourn time is
+ * checked when it is taken. Like CoDel proper, this tracks the minimum
+ * sojourn time over each interval: if some element got through in less
+ * than target, the queue was a burst that drains by itself. If even
+ * the minimum stayed above target for a whole interval, the queue is a
+ * standing one and the next interval runs overloaded. There, every
+ * element that has waited more than twice target is shed, until an
+ * interval whose minimum is back below target.
+ *
+ * <p>CoDel proper instead sheds one element at interval / sqrt(n)
+ * after the previous one. That schedule relies on TCP senders backing
+ * off after a drop; the producers of a request queue do not, and its
+ * slowly rising drop rate leaves the standing queue in place for
+ * seconds. Shedding by age bounds the sojourn time of what is taken to
+ * about twice target as soon as the overload is detected.
+ *
+ * <p>The element that would leave the queue empty is never shed, and a
+ * queue that runs empty ends the overload with the interval.
+ *
+ * <p>Not thread-safe; the owning queue calls it under its take lock.
+ */
+class CoDel
+{
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        CoDel(Clock::duration target, Clock::duration interval):
+            target_(target), interval_(interval) {}
+
+        /**
+         * Decides for the element at the head of the queue, queued
+         * sojourn ago: returns true if it is to be shed. last tells that
+         * it is the only element left.
+         */
+        bool shouldDrop(Clock::time_point now, Clock::duration sojourn, bool last);
+
+        /** The queue ran empty, so no standing queue built up in this interval. */
+        void onEmpty() { minSojourn_ = Clock::duration::zero(); }
+
+        /** True while the last interval has seen a standing queue */
+        bool overloaded() const { return overloaded_; }
+
+    private:
+        const Clock::duration target_;
+        const Clock::duration interval_;
+        /** End of the current interval */
+        Clock::time_point intervalEnd_;
+        /**
+         * Minimum sojourn time seen in the current interval; zero at
+         * first, so the first interval only measures
+         */
+        Clock::duration minSojourn_ = Clock::duration::zero();
+        bool overloaded_ = false;
+};
+
+inline bool CoDel::shouldDrop(Clock::time_point now, Clock::duration sojourn, bool last)
+{
+    if(now >= intervalEnd_)
+    {
+        overloaded_ = minSojourn_ > target_;
+        intervalEnd_ = now + interval_;
+        minSojourn_ = sojourn;
+    }
+    else if(sojourn < minSojourn_)
+        minSojourn_ = sojourn;
+    return overloaded_ && !last && sojourn > 2 * target_;
+}
@@ -0,0 +1,611 @@
+# pragma once
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ParkingLot.h"
+
+/** A unit of work handed to an Executor. */
+class Runnable
+{
+    public:
+        virtual ~Runnable() {}
+        virtual void run() = 0;
+};
+
+/**
+ * Runs tasks, on whatever threads it owns. execute() takes ownership of
+ * the task: it must call run() exactly once and then delete it.
+ */
+class Executor
+{
+    public:
+        virtual ~Executor() {}
+        virtual void execute(Runnable *task) = 0;
+};
+
+/** Runs each task at once in the calling thread. */
+class InlineExecutor : public Executor
+{
+    public:
+        void execute(Runnable *task) override
+        {
+            task->run();
+            delete task;
+        }
+};
+
+template<typename T> class FutureState;
+template<typename T> class CompletableFuture;
+
+/**
+ * A continuation registered on a FutureState<T>. Pending continuations
+ * are linked through {@code next} into the Treiber stack of the state.
+ */
+template<typename T>
+class FutureCompletion : public Runnable
+{
+    public:
+        explicit FutureCompletion(Executor *executor): executor_(executor) {}
+
+        /** Runs the continuation on its executor, or right here without one. */
+        void dispatch()
+        {
+            if(executor_ != nullptr)
+                executor_->execute(this);
+            else
+            {
+                run();
+                delete this;
+            }
+        }
+
+        FutureCompletion *next = nullptr;
+
+        /** Set when the source completes, and keeps it alive until run() */
+        std::shared_ptr<FutureState<T>> source;
+
+    private:
+        Executor *const executor_;
+};
+
+/**
+ * A continuation holding its callable by value, so registering one
+ * costs a single allocation and no std::function.
+ */
+template<typename T, typename F>
+class FutureCallback : public FutureCompletion<T>
+{
+    public:
+        FutureCallback(F &&fn, Executor *executor):
+            FutureCompletion<T>(executor), fn_(std::move(fn)) {}
+        void run() override { fn_(*this->source); }
+    private:
+        F fn_;
+};
+
+/** A task running a callable by value, for supplyAsync. */
+template<typename F>
+class FunctionRunnable : public Runnable
+{
+    public:
+        explicit FunctionRunnable(F &&fn): fn_(std::move(fn)) {}
+        void run() override { fn_(); }
+    private:
+        F fn_;
+};
+
+/**
+ * The shared state of a CompletableFuture: the result, once set, and
+ * the stack of continuations waiting for it.
+ *
+ * <p>Completion is lock-free. The first completer claims the state with
+ * a CAS on {@code status_}, stores the value or exception and publishes
+ * it, then swaps the continuation stack for a marker and runs what it
+ * took, oldest first. A continuation pushed after the swap sees the
+ * marker and runs at once, so each one runs exactly once. Threads
+ * blocked in get() spin and then park on {@code status_}.
+ */
+template<typename T>
+class FutureState : public std::enable_shared_from_this<FutureState<T>>
+{
+    public:
+        /** What is stored for a CompletableFuture<void> */
+        struct Unit {};
+        typedef typename std::conditional<std::is_void<T>::value, Unit, T>::type Value;
+
+        FutureState() = default;
+        ~FutureState();
+        FutureState(const FutureState&) = delete;
+        FutureState& operator=(const FutureState&) = delete;
+
+        /** Completes with a value built from args; false if already completed. */
+        template<typename... Args>
+        bool complete(Args&&... args);
+
+        bool completeExceptionally(std::exception_ptr error);
+
+        bool isDone() const { return status_.load(std::memory_order_acquire) == kDone; }
+
+        /** Blocks until the state is complete */
+        void wait();
+
+        /** Valid once complete and not exceptional */
+        const Value &value() const { return *value_; }
+        /** Valid once complete */
+        const std::exception_ptr &error() const { return error_; }
+
+        /**
+         * Runs fn(*this) once the state is complete, on executor, or
+         * in the completing thread if executor is null. If the state is
+         * already complete that is the calling thread.
+         */
+        template<typename F>
+        void onComplete(F &&fn, Executor *executor);
+
+    private:
+        enum { kPending, kCompleting, kDone };
+
+        static FutureCompletion<T> *doneMarker()
+        {
+            return reinterpret_cast<FutureCompletion<T>*>(std::uintptr_t(1));
+        }
+
+        bool claim();
+        void publish();
+
+        std::atomic<int> status_{kPending};
+        std::optional<Value> value_;
+        std::exception_ptr error_;
+        std::atomic<FutureCompletion<T>*> stack_{nullptr};
+};
+
+template<typename T>
+FutureState<T>::~FutureState()
+{
+    /* continuations of a state that never completed */
+    FutureCompletion<T> *c = stack_.load(std::memory_order_acquire);
+    while(c != nullptr && c != doneMarker())
+    {
+        FutureCompletion<T> *next = c->next;
+        delete c;
+        c = next;
+    }
+}
+
+template<typename T>
+bool FutureState<T>::claim()
+{
+    int expected = kPending;
+    return status_.compare_exchange_strong(expected, kCompleting, std::memory_order_acquire,
+                                           std::memory_order_relaxed);
+}
+
+template<typename T>
+template<typename... Args>
+bool FutureState<T>::complete(Args&&... args)
+{
+    if(!claim())
+        return false;
+    try
+    {
+        value_.emplace(std::forward<Args>(args)...);
+    }
+    catch(...)
+    {
+        status_.store(kPending, std::memory_order_release);
+        throw;
+    }
+    publish();
+    return true;
+}
+
+template<typename T>
+bool FutureState<T>::completeExceptionally(std::exception_ptr error)
+{
+    if(!claim())
+        return false;
+    error_ = std::move(error);
+    publish();
+    return true;
+}
+
+template<typename T>
+void FutureState<T>::publish()
+{
+    std::shared_ptr<FutureState> self = this->shared_from_this();
+    status_.store(kDone);
+    ParkingLot::unparkAll(&status_);
+
+    FutureCompletion<T> *c = stack_.exchange(doneMarker(), std::memory_order_acq_rel);
+    FutureCompletion<T> *fifo = nullptr;
+    while(c != nullptr)
+    {
+        FutureCompletion<T> *next = c->next;
+        c->next = fifo;
+        fifo = c;
+        c = next;
+    }
+    while(fifo != nullptr)
+    {
+        FutureCompletion<T> *next = fifo->next;
+        fifo->source = self;
+        fifo->dispatch();
+        fifo = next;
+    }
+}
+
+template<typename T>
+void FutureState<T>::wait()
+{
+    ParkingLot::parkWhile(&status_, [this]{ return status_.load() != kDone; });
+}
+
+template<typename T>
+template<typename F>
+void FutureState<T>::onComplete(F &&fn, Executor *executor)
+{
+    typedef typename std::decay<F>::type Fn;
+    FutureCompletion<T> *c = new FutureCallback<T, Fn>(Fn(std::forward<F>(fn)), executor);
+    FutureCompletion<T> *head = stack_.load(std::memory_order_acquire);
+    for(;;)
+    {
+        if(head == doneMarker())
+        {
+            c->source = this->shared_from_this();
+            c->dispatch();
+            return;
+        }
+        c->next = head;
+        if(stack_.compare_exchange_weak(head, c, std::memory_order_release,
+                                        std::memory_order_acquire))
+            return;
+    }
+}
+
+/**
+ * A future that may be explicitly completed, by setting its value or
+ * an exception, and that runs dependent actions when it completes.
+ *
+ * <p>thenApply, thenCompose, thenCombine and whenComplete each return a
+ * new future for the result of the next stage, so a multi-stage
+ * pipeline is a chain of continuations and no thread blocks between
+ * stages. A continuation runs on the executor passed with it, or, by
+ * default, in the thread that completes its source (or the registering
+ * thread if the source is already complete). An exception thrown by a
+ * stage completes its future exceptionally, and skips the dependent
+ * stages down to the next whenComplete.
+ *
+ * <p>Futures are cheap handles: copies share one state, which lives as
+ * long as a handle or a pending continuation refers to it. Completion
+ * is lock-free (see FutureState) and a continuation costs one
+ * allocation holding the callable, with no std::function involved.
+ * Values are shared by every dependent, so stages receive them by
+ * const reference.
+ */
+template<typename T>
+class CompletableFuture
+{
+    public:
+        typedef T value_type;
+        /** const T& for get(), void for CompletableFuture<void> */
+        typedef typename std::conditional<std::is_void<T>::value, void,
+                typename std::add_lvalue_reference<const T>::type>::type Reference;
+
+        /** A new incomplete future */
+        CompletableFuture(): state_(std::make_shared<FutureState<T>>()) {}
+
+        /** A future already completed with the given value (none for void) */
+        template<typename... Args>
+        static CompletableFuture completedFuture(Args&&... args);
+
+        /**
+         * Runs fn on executor and completes the returned future with its
+         * result; CompletableFuture<void> for an fn returning nothing.
+         */
+        template<typename F>
+        static CompletableFuture supplyAsync(F &&fn, Executor &executor);
+
+        template<typename... Args>
+        bool complete(Args&&... args) { return state_->complete(std::forward<Args>(args)...); }
+
+        bool completeExceptionally(std::exception_ptr error) { return state_->completeExceptionally(error); }
+
+        bool isDone() const { return state_->isDone(); }
+        bool isCompletedExceptionally() const { return state_->isDone() && state_->error() != nullptr; }
+
+        /**
+         * Waits for completion and returns the value, or rethrows the
+         * exception the future was completed with.
+         */
+        Reference get() const;
+
+        /** Returns fn(value) in a new future. */
+        template<typename F>
+        auto thenApply(F &&fn, Executor *executor = nullptr) const;
+
+        /** Returns a future completing like the future fn(value) returns. */
+        template<typename F>
+        auto thenCompose(F &&fn, Executor *executor = nullptr) const;
+
+        /** Returns fn(value, other's value) once both futures completed. */
+        template<typename U, typename F>
+        auto thenCombine(const CompletableFuture<U> &other, F &&fn, Executor *executor = nullptr) const;
+
+        /**
+         * Calls fn(const T *value, std::exception_ptr error), value being
+         * null on failure (fn(error) for void), and returns a future with
+         * the same result, or with the exception fn threw.
+         */
+        template<typename F>
+        CompletableFuture whenComplete(F &&fn, Executor *executor = nullptr) const;
+
+    private:
+        template<typename U> friend class CompletableFuture;
+        friend class FutureCombinators;
+
+        explicit CompletableFuture(std::shared_ptr<FutureState<T>> state): state_(std::move(state)) {}
+
+        /** fn(value), or fn() for void */
+        template<typename F>
+        static decltype(auto) invokeWith(F &fn, const FutureState<T> &source)
+        {
+            if constexpr(std::is_void<T>::value)
+                return fn();
+            else
+                return fn(source.value());
+        }
+
+        /** Completes target with produce(), which may return void */
+        template<typename G>
+        static void completeWith(FutureState<T> &target, G &&produce)
+        {
+            if constexpr(std::is_void<T>::value)
+            {
+                produce();
+                target.complete();
+            }
+            else
+                target.complete(produce());
+        }
+
+        /** Completes target with the outcome of source */
+        static void relay(const FutureState<T> &source, FutureState<T> &target)
+        {
+            if(source.error())
+                target.completeExceptionally(source.error());
+            else if constexpr(std::is_void<T>::value)
+                target.complete();
+            else
+                target.complete(source.value());
+        }
+
+        std::shared_ptr<FutureState<T>> state_;
+};
+
+template<typename T>
+template<typename... Args>
+CompletableFuture<T> CompletableFuture<T>::completedFuture(Args&&... args)
+{
+    CompletableFuture f;
+    f.complete(std::forward<Args>(args)...);
+    return f;
+}
+
+template<typename T>
+template<typename F>
+CompletableFuture<T> CompletableFuture<T>::supplyAsync(F &&fn, Executor &executor)
+{
+    CompletableFuture f;
+    auto task = [target = f.state_, fn = std::forward<F>(fn)]() mutable {
+        try
+        {
+            completeWith(*target, fn);
+        }
+        catch(...)
+        {
+            target->completeExceptionally(std::current_exception());
+        }
+    };
+    executor.execute(new FunctionRunnable<decltype(task)>(std::move(task)));
+    return f;
+}
+
+template<typename T>
+typename CompletableFuture<T>::Reference CompletableFuture<T>::get() const
+{
+    state_->wait();
+    if(state_->error())
+        std::rethrow_exception(state_->error());
+    if constexpr(!std::is_void<T>::value)
+        return state_->value();
+}
+
+template<typename T>
+template<typename F>
+auto CompletableFuture<T>::thenApply(F &&fn, Executor *executor) const
+{
+    typedef typename std::decay<F>::type Fn;
+    typedef typename std::decay<decltype(invokeWith(std::declval<Fn&>(),
+                                                    std::declval<const FutureState<T>&>()))>::type R;
+    CompletableFuture<R> next;
+    state_->onComplete([target = next.state_, fn = Fn(std::forward<F>(fn))](const FutureState<T> &source) mutable {
+        if(source.error())
+        {
+            target->completeExceptionally(source.error());
+            return;
+        }
+        try
+        {
+            CompletableFuture<R>::completeWith(*target, [&]{ return invokeWith(fn, source); });
+        }
+        catch(...)
+        {
+            target->completeExceptionally(std::current_exception());
+        }
+    }, executor);
+    return next;
+}
+
+template<typename T>
+template<typename F>
+auto CompletableFuture<T>::thenCompose(F &&fn, Executor *executor) const
+{
+    typedef typename std::decay<F>::type Fn;
+    typedef typename std::decay<decltype(invokeWith(std::declval<Fn&>(),
+                                                    std::declval<const FutureState<T>&>()))>::type Inner;
+    typedef typename Inner::value_type U;
+    CompletableFuture<U> next;
+    state_->onComplete([target = next.state_, fn = Fn(std::forward<F>(fn))](const FutureState<T> &source) mutable {
+        if(source.error())
+        {
+            target->completeExceptionally(source.error());
+            return;
+        }
+        try
+        {
+            Inner inner = invokeWith(fn, source);
+            inner.state_->onComplete([target](const FutureState<U> &result) {
+                CompletableFuture<U>::relay(result, *target);
+            }, nullptr);
+        }
+        catch(...)
+        {
+            target->completeExceptionally(std::current_exception());
+        }
+    }, executor);
+    return next;
+}
+
+template<typename T>
+template<typename U, typename F>
+auto CompletableFuture<T>::thenCombine(const CompletableFuture<U> &other, F &&fn, Executor *executor) const
+{
+    static_assert(!std::is_void<T>::value && !std::is_void<U>::value,
+                  "thenCombine needs a value on both sides");
+    return thenCompose([other, fn = typename std::decay<F>::type(std::forward<F>(fn)), executor](const T &a) {
+        return other.thenApply([a, fn](const U &b) mutable { return fn(a, b); }, executor);
+    }, executor);
+}
+
+template<typename T>
+template<typename F>
+CompletableFuture<T> CompletableFuture<T>::whenComplete(F &&fn, Executor *executor) const
+{
+    typedef typename std::decay<F>::type Fn;
+    CompletableFuture next;
+    state_->onComplete([target = next.state_, fn = Fn(std::forward<F>(fn))](const FutureState<T> &source) mutable {
+        try
+        {
+            if constexpr(std::is_void<T>::value)
+                fn(source.error());
+            else
+                fn(source.error() ? nullptr : &source.value(), source.error());
+        }
+        catch(...)
+        {
+            if(!source.error())
+            {
+                target->completeExceptionally(std::current_exception());
+                return;
+            }
+        }
+        relay(source, *target);
+    }, executor);
+    return next;
+}
+
+/**
+ * allOf and anyOf, kept in one friend of CompletableFuture.
+ */
+class FutureCombinators
+{
+    public:
+        template<typename... Ts>
+        static CompletableFuture<void> allOf(const CompletableFuture<Ts>&... futures)
+        {
+            CompletableFuture<void> all;
+            std::shared_ptr<Join> join = std::make_shared<Join>(all.state_, sizeof...(Ts));
+            if(sizeof...(Ts) == 0)
+                all.complete();
+            (arriveOn(futures, join), ...);
+            return all;
+        }
+
+        template<typename T>
+        static CompletableFuture<void> allOf(const std::vector<CompletableFuture<T>> &futures)
+        {
+            CompletableFuture<void> all;
+            std::shared_ptr<Join> join = std::make_shared<Join>(all.state_, static_cast<int>(futures.size()));
+            if(futures.empty())
+                all.complete();
+            for(const CompletableFuture<T> &f : futures)
+                arriveOn(f, join);
+            return all;
+        }
+
+        template<typename T>
+        static CompletableFuture<T> anyOf(const std::vector<CompletableFuture<T>> &futures)
+        {
+            CompletableFuture<T> any;
+            for(const CompletableFuture<T> &f : futures)
+                f.state_->onComplete([target = any.state_](const FutureState<T> &source) {
+                    CompletableFuture<T>::relay(source, *target);
+                }, nullptr);
+            return any;
+        }
+
+    private:
+        /** Counts down the futures of an allOf and keeps the first exception */
+        struct Join
+        {
+            Join(std::shared_ptr<FutureState<void>> t, int n): target(std::move(t)), remaining(n) {}
+            std::shared_ptr<FutureState<void>> target;
+            std::atomic<int> remaining;
+            std::atomic<bool> failed{false};
+            std::exception_ptr error;
+        };
+
+        template<typename T>
+        static void arriveOn(const CompletableFuture<T> &future, const std::shared_ptr<Join> &join)
+        {
+            future.state_->onComplete([join](const FutureState<T> &source) {
+                bool expected = false;
+                if(source.error() && join->failed.compare_exchange_strong(expected, true))
+                    join->error = source.error();
+                if(join->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    return;
+                if(join->failed.load(std::memory_order_relaxed))
+                    join->target->completeExceptionally(join->error);
+                else
+                    join->target->complete();
+            }, nullptr);
+        }
+};
+
+/**
+ * Returns a future completing when all the given futures have; it is
+ * exceptional, with the first exception seen, if any of them was.
+ */
+template<typename... Ts>
+CompletableFuture<void> allOf(const CompletableFuture<Ts>&... futures)
+{
+    return FutureCombinators::allOf(futures...);
+}
+
+template<typename T>
+CompletableFuture<void> allOf(const std::vector<CompletableFuture<T>> &futures)
+{
+    return FutureCombinators::allOf(futures);
+}
+
+/** Returns a future completing like the first of the given futures to complete. */
+template<typename T>
+CompletableFuture<T> anyOf(const std::vector<CompletableFuture<T>> &futures)
+{
+    return FutureCombinators::anyOf(futures);
+}
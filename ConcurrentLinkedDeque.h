@@ -0,0 +1,483 @@
+# pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "Epoch.h"
+
+/**
+ * An unbounded lock-free deque, the non-blocking companion of
+ * LinkedBlockingDeque: offers never block and polls return nothing
+ * instead of waiting.
+ *
+ * <p>This is Maged Michael's CAS-based deque. One 64-bit anchor word
+ * holds the leftmost node, the rightmost node and a status. A push
+ * swings the anchor to the new node with one CAS and leaves the status
+ * at RPUSH or LPUSH until the old end's link to the new node is set;
+ * every thread that finds the anchor in such a state finishes that
+ * step before doing its own operation. A pop is one CAS on the anchor.
+ * So both ends are lock-free, and an operation on one end never waits
+ * for a lock held at the other.
+ *
+ * <p>The anchor fits one ordinary CAS because nodes are named by 31-bit
+ * indices into a pool instead of by pointers. The pool grows in
+ * segments of doubling size that are never moved, and keeps free nodes
+ * on a lock-free list, so after warm-up an offer allocates nothing.
+ * Popped nodes go back to the pool through Epoch.h once no thread can
+ * still be reading their links.
+ *
+ * <p>Like Java's ConcurrentLinkedDeque there is no constant-time
+ * size(); empty() is a single read of the anchor.
+ */
+template<typename T>
+class ConcurrentLinkedDeque
+{
+    public:
+        ConcurrentLinkedDeque();
+        ConcurrentLinkedDeque(const ConcurrentLinkedDeque&) = delete;
+        ConcurrentLinkedDeque& operator=(const ConcurrentLinkedDeque&) = delete;
+        ~ConcurrentLinkedDeque();
+
+        /** Inserts value at the front; always returns true, the deque is unbounded. */
+        bool offerFirst(T value);
+        /** Inserts value at the back; always returns true, the deque is unbounded. */
+        bool offerLast(T value);
+        template<typename... Args>
+        void emplaceFirst(Args&&... args);
+        template<typename... Args>
+        void emplaceLast(Args&&... args);
+
+        /** Removes and returns the first element, or nothing if the deque is empty. */
+        std::optional<T> pollFirst();
+        /** Removes and returns the last element, or nothing if the deque is empty. */
+        std::optional<T> pollLast();
+
+        bool empty() const;
+
+    private:
+        enum Status : std::uint64_t { kStable = 0, kRightPush = 1, kLeftPush = 2 };
+
+        static const int kIndexBits = 31;
+        static const std::uint64_t kIndexMask = (std::uint64_t(1) << kIndexBits) - 1;
+
+        struct Node
+        {
+            /** The neighbours, 0 for none */
+            std::atomic<std::uint32_t> left{0};
+            std::atomic<std::uint32_t> right{0};
+            /** Link of the pool's free list */
+            std::atomic<std::uint32_t> freeNext{0};
+            std::uint32_t index = 0;
+            typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+            T &value() { return *reinterpret_cast<T*>(&storage); }
+        };
+
+        /**
+         * Nodes addressed by index, 0 meaning none. Segment k holds
+         * kFirstSegment << k nodes, so 25 segments cover every 31-bit
+         * index. Reference counted like SkipListArena: the deque holds
+         * one reference and every retired node another.
+         */
+        class Pool
+        {
+            public:
+                Pool();
+                ~Pool();
+
+                Node *node(std::uint32_t index) const;
+                /** A free node; call inside an Epoch::Guard */
+                Node *allocate();
+                void recycle(Node *node);
+
+                void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+                void release();
+
+            private:
+                static const int kFirstShift = 6;
+                static const std::uint32_t kFirstSegment = std::uint32_t(1) << kFirstShift;
+                static const int kSegments = 25;
+
+                static int segmentOf(std::uint32_t position);
+                void push(Node *first, Node *last);
+                Node *grow();
+
+                std::atomic<std::uint32_t> free_{0};
+                std::atomic<Node*> segments_[kSegments];
+                int used_ = 0;
+                std::mutex growMutex_;
+                std::atomic<long> refs_{1};
+        };
+
+        static std::uint32_t leftOf(std::uint64_t a) { return static_cast<std::uint32_t>(a & kIndexMask); }
+        static std::uint32_t rightOf(std::uint64_t a) { return static_cast<std::uint32_t>((a >> kIndexBits) & kIndexMask); }
+        static std::uint64_t statusOf(std::uint64_t a) { return a >> (2 * kIndexBits); }
+        static std::uint64_t anchor(std::uint32_t left, std::uint32_t right, std::uint64_t status)
+        {
+            return left | (std::uint64_t(right) << kIndexBits) | (status << (2 * kIndexBits));
+        }
+
+        static void reclaimNode(void *node, void *pool);
+
+        template<typename... Args>
+        Node *newNode(Args&&... args);
+        void pushLeft(Node *node);
+        void pushRight(Node *node);
+        std::optional<T> take(Node *node);
+        void stabilize(std::uint64_t a);
+        void stabilizeLeft(std::uint64_t a);
+        void stabilizeRight(std::uint64_t a);
+
+        alignas(64) std::atomic<std::uint64_t> anchor_{0};
+        Pool *pool_;
+};
+
+template<typename T>
+ConcurrentLinkedDeque<T>::Pool::Pool()
+{
+    for(int k = 0; k < kSegments; ++k)
+        segments_[k].store(nullptr, std::memory_order_relaxed);
+}
+
+template<typename T>
+ConcurrentLinkedDeque<T>::Pool::~Pool()
+{
+    for(int k = 0; k < used_; ++k)
+        delete[] segments_[k].load(std::memory_order_relaxed);
+}
+
+/* position = index - 1 + kFirstSegment, which is at least kFirstSegment */
+template<typename T>
+int ConcurrentLinkedDeque<T>::Pool::segmentOf(std::uint32_t position)
+{
+    int bit = 31;
+    while((position >> bit) == 0)
+        --bit;
+    return bit - kFirstShift;
+}
+
+template<typename T>
+typename ConcurrentLinkedDeque<T>::Node *ConcurrentLinkedDeque<T>::Pool::node(std::uint32_t index) const
+{
+    const std::uint32_t position = index - 1 + kFirstSegment;
+    const int k = segmentOf(position);
+    return segments_[k].load(std::memory_order_acquire) + (position - (kFirstSegment << k));
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::Pool::push(Node *first, Node *last)
+{
+    std::uint32_t head = free_.load(std::memory_order_relaxed);
+    do
+        last->freeNext.store(head, std::memory_order_relaxed);
+    while(!free_.compare_exchange_weak(head, first->index, std::memory_order_release,
+                                       std::memory_order_relaxed));
+}
+
+/*
+ * Adds the next segment, keeps its first node and frees the rest.
+ * Pops are ABA-safe for the same reason as in SkipListArena: nodes
+ * come back only after an epoch grace period.
+ */
+template<typename T>
+typename ConcurrentLinkedDeque<T>::Node *ConcurrentLinkedDeque<T>::Pool::grow()
+{
+    std::lock_guard<std::mutex> guard(growMutex_);
+    if(used_ == kSegments)
+        throw std::bad_alloc();
+    const int k = used_++;
+    const std::uint32_t size = kFirstSegment << k;
+    const std::uint32_t base = (kFirstSegment << k) - kFirstSegment + 1;
+    Node *segment = new Node[size];
+    for(std::uint32_t i = 0; i < size; ++i)
+    {
+        segment[i].index = base + i;
+        if(i + 1 < size)
+            segment[i].freeNext.store(base + i + 1, std::memory_order_relaxed);
+    }
+    segments_[k].store(segment, std::memory_order_release);
+    if(size > 1)
+        push(&segment[1], &segment[size - 1]);
+    return &segment[0];
+}
+
+template<typename T>
+typename ConcurrentLinkedDeque<T>::Node *ConcurrentLinkedDeque<T>::Pool::allocate()
+{
+    std::uint32_t head = free_.load(std::memory_order_acquire);
+    while(head != 0 &&
+          !free_.compare_exchange_weak(head, node(head)->freeNext.load(std::memory_order_relaxed),
+                                       std::memory_order_acquire, std::memory_order_acquire))
+        ;
+    return head != 0 ? node(head) : grow();
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::Pool::recycle(Node *node)
+{
+    push(node, node);
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::Pool::release()
+{
+    if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+template<typename T>
+ConcurrentLinkedDeque<T>::ConcurrentLinkedDeque():
+    pool_(new Pool())
+{
+
+}
+
+/* No other thread may use the deque any more, so the links are stable. */
+template<typename T>
+ConcurrentLinkedDeque<T>::~ConcurrentLinkedDeque()
+{
+    std::uint64_t a = anchor_.load(std::memory_order_acquire);
+    for(std::uint32_t i = leftOf(a); i != 0; )
+    {
+        Node *node = pool_->node(i);
+        node->value().~T();
+        i = i == rightOf(a) ? 0 : node->right.load(std::memory_order_relaxed);
+    }
+    pool_->release();
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::reclaimNode(void *node, void *pool)
+{
+    static_cast<Pool*>(pool)->recycle(static_cast<Node*>(node));
+    static_cast<Pool*>(pool)->release();
+}
+
+template<typename T>
+template<typename... Args>
+typename ConcurrentLinkedDeque<T>::Node *ConcurrentLinkedDeque<T>::newNode(Args&&... args)
+{
+    Node *node = pool_->allocate();
+    try
+    {
+        new (&node->storage) T(std::forward<Args>(args)...);
+    }
+    catch(...)
+    {
+        /* another thread's allocate() may have seen it on the free list */
+        pool_->retain();
+        Epoch::retire(node, &reclaimNode, pool_);
+        throw;
+    }
+    node->left.store(0, std::memory_order_relaxed);
+    node->right.store(0, std::memory_order_relaxed);
+    return node;
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::pushRight(Node *node)
+{
+    for(;;)
+    {
+        std::uint64_t a = anchor_.load();
+        if(rightOf(a) == 0)
+        {
+            if(anchor_.compare_exchange_weak(a, anchor(node->index, node->index, kStable)))
+                return;
+        }
+        else if(statusOf(a) == kStable)
+        {
+            node->left.store(rightOf(a));
+            std::uint64_t pushed = anchor(leftOf(a), node->index, kRightPush);
+            if(anchor_.compare_exchange_weak(a, pushed))
+            {
+                stabilizeRight(pushed);
+                return;
+            }
+        }
+        else
+            stabilize(a);
+    }
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::pushLeft(Node *node)
+{
+    for(;;)
+    {
+        std::uint64_t a = anchor_.load();
+        if(leftOf(a) == 0)
+        {
+            if(anchor_.compare_exchange_weak(a, anchor(node->index, node->index, kStable)))
+                return;
+        }
+        else if(statusOf(a) == kStable)
+        {
+            node->right.store(leftOf(a));
+            std::uint64_t pushed = anchor(node->index, rightOf(a), kLeftPush);
+            if(anchor_.compare_exchange_weak(a, pushed))
+            {
+                stabilizeLeft(pushed);
+                return;
+            }
+        }
+        else
+            stabilize(a);
+    }
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::stabilize(std::uint64_t a)
+{
+    if(statusOf(a) == kRightPush)
+        stabilizeRight(a);
+    else
+        stabilizeLeft(a);
+}
+
+/*
+ * Completes a push at the right: points the old rightmost node at the
+ * new one, unless that has been done, then marks the anchor stable.
+ * Any thread may run this; the anchor is rechecked before every write
+ * so a stale helper changes nothing.
+ */
+template<typename T>
+void ConcurrentLinkedDeque<T>::stabilizeRight(std::uint64_t a)
+{
+    const std::uint32_t pushed = rightOf(a);
+    Node *prev = pool_->node(pool_->node(pushed)->left.load());
+    if(anchor_.load() != a)
+        return;
+    std::uint32_t prevNext = prev->right.load();
+    if(prevNext != pushed)
+    {
+        if(anchor_.load() != a)
+            return;
+        if(!prev->right.compare_exchange_strong(prevNext, pushed))
+            return;
+    }
+    anchor_.compare_exchange_strong(a, anchor(leftOf(a), pushed, kStable));
+}
+
+template<typename T>
+void ConcurrentLinkedDeque<T>::stabilizeLeft(std::uint64_t a)
+{
+    const std::uint32_t pushed = leftOf(a);
+    Node *next = pool_->node(pool_->node(pushed)->right.load());
+    if(anchor_.load() != a)
+        return;
+    std::uint32_t nextPrev = next->left.load();
+    if(nextPrev != pushed)
+    {
+        if(anchor_.load() != a)
+            return;
+        if(!next->left.compare_exchange_strong(nextPrev, pushed))
+            return;
+    }
+    anchor_.compare_exchange_strong(a, anchor(pushed, rightOf(a), kStable));
+}
+
+/* Moves the value out of a node popped by the caller and retires the node. */
+template<typename T>
+std::optional<T> ConcurrentLinkedDeque<T>::take(Node *node)
+{
+    std::optional<T> value(std::move(node->value()));
+    node->value().~T();
+    pool_->retain();
+    Epoch::retire(node, &reclaimNode, pool_);
+    return value;
+}
+
+template<typename T>
+bool ConcurrentLinkedDeque<T>::offerFirst(T value)
+{
+    Epoch::Guard guard;
+    pushLeft(newNode(std::move(value)));
+    return true;
+}
+
+template<typename T>
+bool ConcurrentLinkedDeque<T>::offerLast(T value)
+{
+    Epoch::Guard guard;
+    pushRight(newNode(std::move(value)));
+    return true;
+}
+
+template<typename T>
+template<typename... Args>
+void ConcurrentLinkedDeque<T>::emplaceFirst(Args&&... args)
+{
+    Epoch::Guard guard;
+    pushLeft(newNode(std::forward<Args>(args)...));
+}
+
+template<typename T>
+template<typename... Args>
+void ConcurrentLinkedDeque<T>::emplaceLast(Args&&... args)
+{
+    Epoch::Guard guard;
+    pushRight(newNode(std::forward<Args>(args)...));
+}
+
+template<typename T>
+std::optional<T> ConcurrentLinkedDeque<T>::pollLast()
+{
+    Epoch::Guard guard;
+    for(;;)
+    {
+        std::uint64_t a = anchor_.load();
+        const std::uint32_t right = rightOf(a);
+        if(right == 0)
+            return std::nullopt;
+        if(right == leftOf(a))
+        {
+            if(anchor_.compare_exchange_weak(a, anchor(0, 0, kStable)))
+                return take(pool_->node(right));
+        }
+        else if(statusOf(a) == kStable)
+        {
+            std::uint32_t prev = pool_->node(right)->left.load();
+            if(anchor_.compare_exchange_weak(a, anchor(leftOf(a), prev, kStable)))
+                return take(pool_->node(right));
+        }
+        else
+            stabilize(a);
+    }
+}
+
+template<typename T>
+std::optional<T> ConcurrentLinkedDeque<T>::pollFirst()
+{
+    Epoch::Guard guard;
+    for(;;)
+    {
+        std::uint64_t a = anchor_.load();
+        const std::uint32_t left = leftOf(a);
+        if(left == 0)
+            return std::nullopt;
+        if(left == rightOf(a))
+        {
+            if(anchor_.compare_exchange_weak(a, anchor(0, 0, kStable)))
+                return take(pool_->node(left));
+        }
+        else if(statusOf(a) == kStable)
+        {
+            std::uint32_t next = pool_->node(left)->right.load();
+            if(anchor_.compare_exchange_weak(a, anchor(next, rightOf(a), kStable)))
+                return take(pool_->node(left));
+        }
+        else
+            stabilize(a);
+    }
+}
+
+template<typename T>
+bool ConcurrentLinkedDeque<T>::empty() const
+{
+    return leftOf(anchor_.load(std::memory_order_acquire)) == 0;
+}
@@ -0,0 +1,809 @@
+# pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Epoch.h"
+
+/**
+ * Memory for skip list nodes, carved out of chunks and recycled per
+ * tower height.
+ *
+ * <p>Each slot has a small header holding the free-list link, so a
+ * node's own fields are never touched while it is free. The free lists
+ * are Treiber stacks. Popping is ABA-safe because slots come back only
+ * through Epoch::retire(): a slot cannot return to a list while a
+ * thread that saw it at the top is still inside its guard. Only a
+ * refill, once per kChunkSlots allocations of a height, takes a lock.
+ *
+ * <p>The arena is reference counted: its map holds one reference and
+ * every retired node another, so nodes still waiting in a limbo list
+ * can be recycled after the map is gone.
+ */
+class SkipListArena
+{
+    public:
+        /** nodeSize(h) = baseSize + (h - 1) * levelSize */
+        SkipListArena(std::size_t baseSize, std::size_t levelSize, int maxHeight);
+        ~SkipListArena();
+        SkipListArena(const SkipListArena&) = delete;
+        SkipListArena& operator=(const SkipListArena&) = delete;
+
+        /** Memory for a node of the given height; call inside an Epoch::Guard. */
+        void *allocate(int height);
+        /** Returns memory obtained from allocate(height). */
+        void recycle(void *node, int height);
+
+        void retain() { refs_.fetch_add(1, std::memory_order_relaxed); }
+        /** Drops a reference, deleting the arena with the last one. */
+        void release();
+
+    private:
+        static const int kChunkSlots = 64;
+
+        struct Slot
+        {
+            std::atomic<Slot*> next{nullptr};
+        };
+
+        static const std::size_t kHeaderSize =
+            (sizeof(Slot) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+        std::size_t slotSize(int height) const;
+        void push(int height, Slot *first, Slot *last);
+        Slot *refill(int height);
+
+        const std::size_t baseSize_;
+        const std::size_t levelSize_;
+        std::unique_ptr<std::atomic<Slot*>[]> free_;
+        std::mutex chunkMutex_;
+        std::vector<void*> chunks_;
+        std::atomic<long> refs_{1};
+};
+
+inline SkipListArena::SkipListArena(std::size_t baseSize, std::size_t levelSize, int maxHeight):
+    baseSize_(baseSize), levelSize_(levelSize), free_(new std::atomic<Slot*>[maxHeight])
+{
+    for(int i = 0; i < maxHeight; ++i)
+        free_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+inline SkipListArena::~SkipListArena()
+{
+    for(void *chunk : chunks_)
+        ::operator delete(chunk);
+}
+
+inline std::size_t SkipListArena::slotSize(int height) const
+{
+    const std::size_t align = alignof(std::max_align_t);
+    std::size_t size = kHeaderSize + baseSize_ + static_cast<std::size_t>(height - 1) * levelSize_;
+    return (size + align - 1) / align * align;
+}
+
+inline void SkipListArena::push(int height, Slot *first, Slot *last)
+{
+    std::atomic<Slot*> &list = free_[height - 1];
+    Slot *head = list.load(std::memory_order_relaxed);
+    do
+        last->next.store(head, std::memory_order_relaxed);
+    while(!list.compare_exchange_weak(head, first, std::memory_order_release,
+                                      std::memory_order_relaxed));
+}
+
+/* Carves a new chunk, keeps one slot and frees the rest. */
+inline SkipListArena::Slot *SkipListArena::refill(int height)
+{
+    const std::size_t size = slotSize(height);
+    char *chunk = static_cast<char*>(::operator new(size * kChunkSlots));
+    {
+        std::lock_guard<std::mutex> guard(chunkMutex_);
+        chunks_.push_back(chunk);
+    }
+    Slot *slots[kChunkSlots];
+    for(int i = 0; i < kChunkSlots; ++i)
+        slots[i] = new (chunk + i * size) Slot();
+    for(int i = 1; i < kChunkSlots - 1; ++i)
+        slots[i]->next.store(slots[i + 1], std::memory_order_relaxed);
+    push(height, slots[1], slots[kChunkSlots - 1]);
+    return slots[0];
+}
+
+inline void *SkipListArena::allocate(int height)
+{
+    std::atomic<Slot*> &list = free_[height - 1];
+    Slot *slot = list.load(std::memory_order_acquire);
+    while(slot != nullptr &&
+          !list.compare_exchange_weak(slot, slot->next.load(std::memory_order_relaxed),
+                                      std::memory_order_acquire, std::memory_order_acquire))
+        ;
+    if(slot == nullptr)
+        slot = refill(height);
+    return reinterpret_cast<char*>(slot) + kHeaderSize;
+}
+
+inline void SkipListArena::recycle(void *node, int height)
+{
+    Slot *slot = reinterpret_cast<Slot*>(static_cast<char*>(node) - kHeaderSize);
+    push(height, slot, slot);
+}
+
+inline void SkipListArena::release()
+{
+    if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+/**
+ * A scalable concurrent sorted map, after Java's ConcurrentSkipListMap.
+ * Keys are ordered by Compare; each key maps to at most one value.
+ *
+ * <p>The map is a lock-free skip list in the style of Fraser and of
+ * Herlihy and Shavit. The next pointer of every level carries a mark
+ * bit. A removal first swaps the node's value pointer to null, which is
+ * the point where the key leaves the map, then marks the node's next
+ * pointers from the top level down; marked nodes are unlinked by any
+ * thread whose search runs into them. An insertion links the bottom
+ * level with one CAS, which is where the key enters the map, and then
+ * the levels above. Replacing the value of a present key is a single
+ * CAS on its value pointer.
+ *
+ * <p>Lookups, ordered queries and iteration never write shared memory:
+ * they pass over marked nodes rather than unlink them, and entering
+ * the Epoch::Guard they run under touches only the calling thread's
+ * record. Readers therefore scale with the number of threads.
+ *
+ * <p>Unlinked nodes and replaced values are reclaimed through Epoch.h.
+ * A node is retired once both the thread that removed it and the one
+ * that inserted it have seen it unlinked at every level, since the
+ * inserter may still be linking upper levels while it is removed.
+ * Node towers live in a SkipListArena, which recycles them per height
+ * instead of going through the allocator.
+ *
+ * <p>Results are copies: get() and the entry queries return
+ * std::optional, so K and V must be copy constructible. Iteration with
+ * forEach() and forEachInRange() is weakly consistent: it sees every
+ * entry present for the whole traversal, may or may not see entries
+ * added or removed during it, and never fails. Like Java's, size() is
+ * a traversal, not a constant-time count.
+ */
+template<typename K, typename V, typename Compare = std::less<K>>
+class ConcurrentSkipListMap
+{
+    public:
+        typedef std::pair<K, V> Entry;
+
+        explicit ConcurrentSkipListMap(const Compare &compare = Compare());
+        ~ConcurrentSkipListMap();
+        ConcurrentSkipListMap(const ConcurrentSkipListMap&) = delete;
+        ConcurrentSkipListMap& operator=(const ConcurrentSkipListMap&) = delete;
+
+        /** The value mapped to key, or nothing. */
+        std::optional<V> get(const K &key) const;
+        bool containsKey(const K &key) const;
+
+        /** Maps key to value; returns the previous value, if any. */
+        std::optional<V> put(const K &key, const V &value);
+        /** Maps key to value unless it is present; returns the present value, if any. */
+        std::optional<V> putIfAbsent(const K &key, const V &value);
+        /** Removes the mapping for key; returns the removed value, if any. */
+        std::optional<V> remove(const K &key);
+
+        /** The entry with the least key, or nothing if the map is empty. */
+        std::optional<Entry> firstEntry() const;
+        /** Removes and returns the entry with the least key. */
+        std::optional<Entry> pollFirstEntry();
+
+        /** The entry with the least key not less than key. */
+        std::optional<Entry> ceilingEntry(const K &key) const { return ceiling(key, true); }
+        /** The entry with the least key greater than key. */
+        std::optional<Entry> higherEntry(const K &key) const { return ceiling(key, false); }
+        /** The entry with the greatest key not greater than key. */
+        std::optional<Entry> floorEntry(const K &key) const { return floor(key, true); }
+        /** The entry with the greatest key less than key. */
+        std::optional<Entry> lowerEntry(const K &key) const { return floor(key, false); }
+
+        /** Calls fn(key, value) for each entry in ascending key order. */
+        template<typename F>
+        void forEach(F fn) const;
+        /** Calls fn(key, value) for each entry with from <= key < to, in order. */
+        template<typename F>
+        void forEachInRange(const K &from, const K &to, F fn) const;
+
+        /** Counts the entries; linear in the size of the map. */
+        int size() const;
+        bool empty() const;
+
+    private:
+        static const int kMaxHeight = 16;
+
+        struct Node
+        {
+            Node(int h, V *v): value(v), refs(2), height(h) {}
+
+            K &key() { return *reinterpret_cast<K*>(&keyStorage); }
+
+            /** Left unconstructed in the head */
+            typename std::aligned_storage<sizeof(K), alignof(K)>::type keyStorage;
+            /** Null once the key has been removed */
+            std::atomic<V*> value;
+            /** Held by the inserter and by the remover; retired at zero */
+            std::atomic<int> refs;
+            const int height;
+            /** height words, the tower; bit 0 marks the node removed at that level */
+            std::atomic<std::uintptr_t> next[1];
+        };
+
+        static_assert(alignof(Node) <= alignof(std::max_align_t), "over-aligned key");
+
+        static bool isMarked(std::uintptr_t word) { return (word & 1) != 0; }
+        static Node *pointer(std::uintptr_t word) { return reinterpret_cast<Node*>(word & ~std::uintptr_t(1)); }
+        static std::uintptr_t word(Node *node) { return reinterpret_cast<std::uintptr_t>(node); }
+        static std::size_t nodeSize(int height)
+        {
+            return sizeof(Node) + static_cast<std::size_t>(height - 1) * sizeof(std::atomic<std::uintptr_t>);
+        }
+
+        bool less(const K &a, const K &b) const { return compare_(a, b); }
+
+        static int randomHeight();
+        static V *newValue(const V &value);
+        static void deleteValue(V *value);
+        static void retireValue(V *value);
+        static void reclaimValue(void *value, void *);
+        static void reclaimNode(void *node, void *arena);
+        static void reclaimKeylessNode(void *node, void *arena);
+
+        Node *newNode(const K &key, V *value, int height);
+        void destroyNode(Node *node);
+        void releaseNode(Node *node);
+
+        bool search(const K &key, Node **preds, Node **succs);
+        bool find(const K &key, Node **preds, Node **succs);
+        Node *seek(const K &key, Node *&pred) const;
+        void linkUpper(Node *node, Node **preds, Node **succs);
+        static void markTower(Node *node);
+        void finishRemove(Node *node, V *value);
+        std::optional<V> doPut(const K &key, const V &value, bool onlyIfAbsent);
+        std::optional<Entry> ceiling(const K &key, bool inclusive) const;
+        std::optional<Entry> floor(const K &key, bool inclusive) const;
+
+        const Compare compare_;
+        SkipListArena *arena_;
+        Node *head_;
+};
+
+template<typename K, typename V, typename Compare>
+ConcurrentSkipListMap<K, V, Compare>::ConcurrentSkipListMap(const Compare &compare):
+    compare_(compare),
+    arena_(new SkipListArena(nodeSize(1), sizeof(std::atomic<std::uintptr_t>), kMaxHeight))
+{
+    void *memory = ::operator new(nodeSize(kMaxHeight));
+    head_ = new (memory) Node(kMaxHeight, nullptr);
+    for(int level = 0; level < kMaxHeight; ++level)
+        new (&head_->next[level]) std::atomic<std::uintptr_t>(0);
+}
+
+/* No other thread may use the map any more; retired nodes keep the arena alive. */
+template<typename K, typename V, typename Compare>
+ConcurrentSkipListMap<K, V, Compare>::~ConcurrentSkipListMap()
+{
+    Node *node = pointer(head_->next[0].load(std::memory_order_relaxed));
+    while(node != nullptr)
+    {
+        Node *next = pointer(node->next[0].load(std::memory_order_relaxed));
+        deleteValue(node->value.load(std::memory_order_relaxed));
+        node->key().~K();
+        node->~Node();
+        node = next;
+    }
+    head_->~Node();
+    ::operator delete(head_);
+    arena_->release();
+}
+
+/* Heights 1, 2, 3, ... with probability 3/4, 3/16, 3/64, ... */
+template<typename K, typename V, typename Compare>
+int ConcurrentSkipListMap<K, V, Compare>::randomHeight()
+{
+    thread_local std::uint32_t seed = static_cast<std::uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int height = 1;
+    for(std::uint32_t bits = seed; height < kMaxHeight && (bits & 3) == 0; bits >>= 2)
+        ++height;
+    return height;
+}
+
+/*
+ * Values of an empty type carry no state, so they all share one object
+ * and are never allocated; ConcurrentSkipListSet relies on that.
+ */
+template<typename K, typename V, typename Compare>
+V *ConcurrentSkipListMap<K, V, Compare>::newValue(const V &value)
+{
+    if constexpr(std::is_empty<V>::value)
+    {
+        static V shared;
+        return &shared;
+    }
+    else
+        return new V(value);
+}
+
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::deleteValue(V *value)
+{
+    if constexpr(!std::is_empty<V>::value)
+        delete value;
+}
+
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::retireValue(V *value)
+{
+    if constexpr(!std::is_empty<V>::value)
+        Epoch::retire(value, &reclaimValue, nullptr);
+}
+
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::reclaimValue(void *value, void *)
+{
+    delete static_cast<V*>(value);
+}
+
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::reclaimNode(void *object, void *context)
+{
+    Node *node = static_cast<Node*>(object);
+    SkipListArena *arena = static_cast<SkipListArena*>(context);
+    const int height = node->height;
+    node->key().~K();
+    node->~Node();
+    arena->recycle(node, height);
+    arena->release();
+}
+
+/* As reclaimNode, for a node whose key was never constructed. */
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::reclaimKeylessNode(void *object, void *context)
+{
+    Node *node = static_cast<Node*>(object);
+    SkipListArena *arena = static_cast<SkipListArena*>(context);
+    const int height = node->height;
+    node->~Node();
+    arena->recycle(node, height);
+    arena->release();
+}
+
+template<typename K, typename V, typename Compare>
+typename ConcurrentSkipListMap<K, V, Compare>::Node *
+ConcurrentSkipListMap<K, V, Compare>::newNode(const K &key, V *value, int height)
+{
+    Node *node = new (arena_->allocate(height)) Node(height, value);
+    for(int level = 1; level < height; ++level)
+        new (&node->next[level]) std::atomic<std::uintptr_t>(0);
+    try
+    {
+        new (&node->keyStorage) K(key);
+    }
+    catch(...)
+    {
+        arena_->retain();
+        Epoch::retire(node, &reclaimKeylessNode, arena_);
+        throw;
+    }
+    return node;
+}
+
+/*
+ * Frees a node that was never published. It still goes through
+ * Epoch::retire(): another thread's allocate() may have seen its slot
+ * at the top of the free list, and recycling it at once would let that
+ * thread's pop succeed with a stale successor.
+ */
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::destroyNode(Node *node)
+{
+    arena_->retain();
+    Epoch::retire(node, &reclaimNode, arena_);
+}
+
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::releaseNode(Node *node)
+{
+    if(node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        arena_->retain();
+        Epoch::retire(node, &reclaimNode, arena_);
+    }
+}
+
+/*
+ * One pass of find(): fills preds and succs with the last node before
+ * key and the first node at or after it on every level, unlinking the
+ * marked nodes on the way. Returns false if an unlink failed and the
+ * pass has to start over.
+ */
+template<typename K, typename V, typename Compare>
+bool ConcurrentSkipListMap<K, V, Compare>::search(const K &key, Node **preds, Node **succs)
+{
+    Node *pred = head_;
+    for(int level = kMaxHeight - 1; level >= 0; --level)
+    {
+        Node *curr = pointer(pred->next[level].load());
+        while(curr != nullptr)
+        {
+            std::uintptr_t succ = curr->next[level].load();
+            if(isMarked(succ))
+            {
+                std::uintptr_t expected = word(curr);
+                if(!pred->next[level].compare_exchange_strong(expected, succ & ~std::uintptr_t(1)))
+                    return false;
+                curr = pointer(succ);
+                continue;
+            }
+            if(!less(curr->key(), key))
+                break;
+            pred = curr;
+            curr = pointer(succ);
+        }
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return true;
+}
+
+/* Returns true if succs[0] holds key. Call inside an Epoch::Guard. */
+template<typename K, typename V, typename Compare>
+bool ConcurrentSkipListMap<K, V, Compare>::find(const K &key, Node **preds, Node **succs)
+{
+    while(!search(key, preds, succs))
+        ;
+    return succs[0] != nullptr && !less(key, succs[0]->key());
+}
+
+/*
+ * The read-only search: returns the first unmarked node at or after key
+ * on the bottom level, and in pred the last node before key. Marked
+ * nodes are stepped over, not unlinked.
+ */
+template<typename K, typename V, typename Compare>
+typename ConcurrentSkipListMap<K, V, Compare>::Node *
+ConcurrentSkipListMap<K, V, Compare>::seek(const K &key, Node *&pred) const
+{
+    Node *p = head_;
+    Node *curr = nullptr;
+    for(int level = kMaxHeight - 1; level >= 0; --level)
+    {
+        curr = pointer(p->next[level].load(std::memory_order_acquire));
+        while(curr != nullptr)
+        {
+            std::uintptr_t succ = curr->next[level].load(std::memory_order_acquire);
+            if(isMarked(succ))
+            {
+                curr = pointer(succ);
+                continue;
+            }
+            if(!less(curr->key(), key))
+                break;
+            p = curr;
+            curr = pointer(succ);
+        }
+    }
+    pred = p;
+    return curr;
+}
+
+/*
+ * Links the levels above the bottom one, stopping early if the node
+ * gets removed meanwhile. Before a level is linked the node's own next
+ * pointer is set by CAS, which fails once a remover has marked it, so
+ * nothing is linked above a marked level afterwards except by a CAS
+ * that raced the mark; the caller cleans those up.
+ */
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::linkUpper(Node *node, Node **preds, Node **succs)
+{
+    for(int level = 1; level < node->height; ++level)
+    {
+        for(;;)
+        {
+            std::uintptr_t own = node->next[level].load();
+            if(isMarked(own))
+                return;
+            if(pointer(own) != succs[level] &&
+               !node->next[level].compare_exchange_strong(own, word(succs[level])))
+                continue;
+            std::uintptr_t expected = word(succs[level]);
+            if(preds[level]->next[level].compare_exchange_strong(expected, word(node)))
+                break;
+            if(!find(node->key(), preds, succs) || succs[0] != node)
+                return;
+        }
+    }
+}
+
+/* Marks every level of a node whose value is gone; idempotent, so anyone can help. */
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::markTower(Node *node)
+{
+    for(int level = node->height - 1; level >= 0; --level)
+        node->next[level].fetch_or(1);
+}
+
+/* The rest of a removal whose value CAS succeeded. */
+template<typename K, typename V, typename Compare>
+void ConcurrentSkipListMap<K, V, Compare>::finishRemove(Node *node, V *value)
+{
+    Node *preds[kMaxHeight];
+    Node *succs[kMaxHeight];
+    markTower(node);
+    find(node->key(), preds, succs);
+    retireValue(value);
+    releaseNode(node);
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<V> ConcurrentSkipListMap<K, V, Compare>::get(const K &key) const
+{
+    Epoch::Guard guard;
+    Node *pred;
+    Node *node = seek(key, pred);
+    if(node != nullptr && !less(key, node->key()))
+    {
+        V *value = node->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            return *value;
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Compare>
+bool ConcurrentSkipListMap<K, V, Compare>::containsKey(const K &key) const
+{
+    Epoch::Guard guard;
+    Node *pred;
+    Node *node = seek(key, pred);
+    return node != nullptr && !less(key, node->key()) &&
+           node->value.load(std::memory_order_acquire) != nullptr;
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<V> ConcurrentSkipListMap<K, V, Compare>::put(const K &key, const V &value)
+{
+    return doPut(key, value, false);
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<V> ConcurrentSkipListMap<K, V, Compare>::putIfAbsent(const K &key, const V &value)
+{
+    return doPut(key, value, true);
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<V> ConcurrentSkipListMap<K, V, Compare>::doPut(const K &key, const V &value, bool onlyIfAbsent)
+{
+    Epoch::Guard guard;
+    Node *preds[kMaxHeight];
+    Node *succs[kMaxHeight];
+    std::unique_ptr<V, void(*)(V*)> fresh(nullptr, &deleteValue);
+    Node *node = nullptr;
+    for(;;)
+    {
+        if(find(key, preds, succs))
+        {
+            Node *found = succs[0];
+            V *old = found->value.load();
+            if(old == nullptr)
+            {
+                /* being removed: help, so the next find() no longer sees it */
+                markTower(found);
+                continue;
+            }
+            if(!onlyIfAbsent)
+            {
+                if(!fresh)
+                    fresh.reset(newValue(value));
+                if(!found->value.compare_exchange_strong(old, fresh.get()))
+                    continue;
+                fresh.release();
+            }
+            std::optional<V> previous(*old);
+            if(!onlyIfAbsent)
+                retireValue(old);
+            if(node != nullptr)
+                destroyNode(node);
+            return previous;
+        }
+        if(node == nullptr)
+        {
+            if(!fresh)
+                fresh.reset(newValue(value));
+            node = newNode(key, fresh.get(), randomHeight());
+        }
+        for(int level = 0; level < node->height; ++level)
+            node->next[level].store(word(succs[level]), std::memory_order_relaxed);
+        std::uintptr_t expected = word(succs[0]);
+        if(preds[0]->next[0].compare_exchange_strong(expected, word(node)))
+            break;
+    }
+    fresh.release();
+    linkUpper(node, preds, succs);
+    if(isMarked(node->next[0].load()))
+        find(key, preds, succs);
+    releaseNode(node);
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<V> ConcurrentSkipListMap<K, V, Compare>::remove(const K &key)
+{
+    Epoch::Guard guard;
+    Node *preds[kMaxHeight];
+    Node *succs[kMaxHeight];
+    if(!find(key, preds, succs))
+        return std::nullopt;
+    Node *node = succs[0];
+    V *value = node->value.load();
+    while(value != nullptr)
+    {
+        if(node->value.compare_exchange_weak(value, nullptr))
+        {
+            std::optional<V> removed(*value);
+            finishRemove(node, value);
+            return removed;
+        }
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<typename ConcurrentSkipListMap<K, V, Compare>::Entry>
+ConcurrentSkipListMap<K, V, Compare>::firstEntry() const
+{
+    Epoch::Guard guard;
+    for(Node *node = pointer(head_->next[0].load(std::memory_order_acquire)); node != nullptr;
+        node = pointer(node->next[0].load(std::memory_order_acquire)))
+    {
+        V *value = node->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            return Entry(node->key(), *value);
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<typename ConcurrentSkipListMap<K, V, Compare>::Entry>
+ConcurrentSkipListMap<K, V, Compare>::pollFirstEntry()
+{
+    Epoch::Guard guard;
+    Node *node = pointer(head_->next[0].load());
+    while(node != nullptr)
+    {
+        V *value = node->value.load();
+        if(value == nullptr)
+        {
+            node = pointer(node->next[0].load());
+            continue;
+        }
+        if(node->value.compare_exchange_strong(value, nullptr))
+        {
+            std::optional<Entry> entry(std::in_place, node->key(), *value);
+            finishRemove(node, value);
+            return entry;
+        }
+    }
+    return std::nullopt;
+}
+
+template<typename K, typename V, typename Compare>
+std::optional<typename ConcurrentSkipListMap<K, V, Compare>::Entry>
+ConcurrentSkipListMap<K, V, Compare>::ceiling(const K &key, bool inclusive) const
+{
+    Epoch::Guard guard;
+    Node *pred;
+    for(Node *node = seek(key, pred); node != nullptr;
+        node = pointer(node->next[0].load(std::memory_order_acquire)))
+    {
+        if(!inclusive && !less(key, node->key()))
+            continue;
+        V *value = node->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            return Entry(node->key(), *value);
+    }
+    return std::nullopt;
+}
+
+/*
+ * If the candidate before the bound is being removed, searches again
+ * below its key, which stays valid inside the guard.
+ */
+template<typename K, typename V, typename Compare>
+std::optional<typename ConcurrentSkipListMap<K, V, Compare>::Entry>
+ConcurrentSkipListMap<K, V, Compare>::floor(const K &key, bool inclusive) const
+{
+    Epoch::Guard guard;
+    const K *bound = &key;
+    for(;;)
+    {
+        Node *pred;
+        Node *node = seek(*bound, pred);
+        if(inclusive && node != nullptr && !less(*bound, node->key()))
+        {
+            V *value = node->value.load(std::memory_order_acquire);
+            if(value != nullptr)
+                return Entry(node->key(), *value);
+        }
+        if(pred == head_)
+            return std::nullopt;
+        V *value = pred->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            return Entry(pred->key(), *value);
+        bound = &pred->key();
+        inclusive = false;
+    }
+}
+
+/** fn gets references that are valid only during the call. */
+template<typename K, typename V, typename Compare>
+template<typename F>
+void ConcurrentSkipListMap<K, V, Compare>::forEach(F fn) const
+{
+    Epoch::Guard guard;
+    for(Node *node = pointer(head_->next[0].load(std::memory_order_acquire)); node != nullptr;
+        node = pointer(node->next[0].load(std::memory_order_acquire)))
+    {
+        V *value = node->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            fn(static_cast<const K&>(node->key()), static_cast<const V&>(*value));
+    }
+}
+
+/**
+ * Starts with a search for from, so a scan costs O(log n) plus the
+ * entries visited. fn gets references that are valid only during the
+ * call.
+ */
+template<typename K, typename V, typename Compare>
+template<typename F>
+void ConcurrentSkipListMap<K, V, Compare>::forEachInRange(const K &from, const K &to, F fn) const
+{
+    Epoch::Guard guard;
+    Node *pred;
+    for(Node *node = seek(from, pred); node != nullptr && less(node->key(), to);
+        node = pointer(node->next[0].load(std::memory_order_acquire)))
+    {
+        V *value = node->value.load(std::memory_order_acquire);
+        if(value != nullptr)
+            fn(static_cast<const K&>(node->key()), static_cast<const V&>(*value));
+    }
+}
+
+template<typename K, typename V, typename Compare>
+int ConcurrentSkipListMap<K, V, Compare>::size() const
+{
+    int count = 0;
+    forEach([&count](const K&, const V&) { ++count; });
+    return count;
+}
+
+template<typename K, typename V, typename Compare>
+bool ConcurrentSkipListMap<K, V, Compare>::empty() const
+{
+    Epoch::Guard guard;
+    for(Node *node = pointer(head_->next[0].load(std::memory_order_acquire)); node != nullptr;
+        node = pointer(node->next[0].load(std::memory_order_acquire)))
+        if(node->value.load(std::memory_order_acquire) != nullptr)
+            return false;
+    return true;
+}
@@ -0,0 +1,73 @@
+# pragma once
+#include <functional>
+#include <optional>
+#include "ConcurrentSkipListMap.h"
+
+/**
+ * A scalable concurrent sorted set, after Java's ConcurrentSkipListSet.
+ *
+ * <p>The set is a ConcurrentSkipListMap whose values are of an empty
+ * type; the map shares one object among all such values, so an element
+ * costs one tower node and nothing else. Concurrency, ordering and
+ * iteration semantics are those of the map.
+ */
+template<typename K, typename Compare = std::less<K>>
+class ConcurrentSkipListSet
+{
+    public:
+        explicit ConcurrentSkipListSet(const Compare &compare = Compare()): map_(compare) {}
+        ConcurrentSkipListSet(const ConcurrentSkipListSet&) = delete;
+        ConcurrentSkipListSet& operator=(const ConcurrentSkipListSet&) = delete;
+
+        /** Adds key unless present; returns true if it was added. */
+        bool add(const K &key) { return !map_.putIfAbsent(key, Present()).has_value(); }
+        /** Removes key; returns true if it was present. */
+        bool remove(const K &key) { return map_.remove(key).has_value(); }
+        bool contains(const K &key) const { return map_.containsKey(key); }
+
+        /** The least element, or nothing if the set is empty. */
+        std::optional<K> first() const { return keyOf(map_.firstEntry()); }
+        /** Removes and returns the least element. */
+        std::optional<K> pollFirst() { return keyOf(map_.pollFirstEntry()); }
+
+        /** The least element not less than key. */
+        std::optional<K> ceiling(const K &key) const { return keyOf(map_.ceilingEntry(key)); }
+        /** The least element greater than key. */
+        std::optional<K> higher(const K &key) const { return keyOf(map_.higherEntry(key)); }
+        /** The greatest element not greater than key. */
+        std::optional<K> floor(const K &key) const { return keyOf(map_.floorEntry(key)); }
+        /** The greatest element less than key. */
+        std::optional<K> lower(const K &key) const { return keyOf(map_.lowerEntry(key)); }
+
+        /** Calls fn(key) for each element in ascending order; weakly consistent. */
+        template<typename F>
+        void forEach(F fn) const
+        {
+            map_.forEach([&fn](const K &key, const Present&) { fn(key); });
+        }
+
+        /** Calls fn(key) for each element with from <= key < to, in order. */
+        template<typename F>
+        void forEachInRange(const K &from, const K &to, F fn) const
+        {
+            map_.forEachInRange(from, to, [&fn](const K &key, const Present&) { fn(key); });
+        }
+
+        /** Counts the elements; linear in the size of the set. */
+        int size() const { return map_.size(); }
+        bool empty() const { return map_.empty(); }
+
+    private:
+        struct Present {};
+
+        typedef ConcurrentSkipListMap<K, Present, Compare> Map;
+
+        static std::optional<K> keyOf(const std::optional<typename Map::Entry> &entry)
+        {
+            if(!entry)
+                return std::nullopt;
+            return entry->first;
+        }
+
+        Map map_;
+};
@@ -1,39 +1,57 @@
+# pragma once
 #include <mutex>
 #include <condition_variable>
+#include "QueueStats.h"
 class CountDownLatch
 {
     private:
         int count_;
         mutable std::mutex mutex_; 
         std::condition_variable cond_;
+
+        /**
+         * Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS.
+         * puts counts countDown() calls, takes counts await() calls.
+         */
+        QueueStats stats_;
     public:
         explicit  CountDownLatch(int count);
         void await();
         void countDown();
         int getCount() const;
+        QueueStatsSnapshot stats() const;
 };
-CountDownLatch::CountDownLatch(int count):
+inline CountDownLatch::CountDownLatch(int count):
     count_(count)
 {
 
 }
 
-void CountDownLatch::await()
+inline void CountDownLatch::await()
 {
-    std::unique_lock<std::mutex> lk(mutex_);
-    cond_.wait(lk, [this]{ return count_ == 0; });
+    std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitTake(cond_, lk, [this]{ return count_ == 0; });
+    stats_.recordTake();
 }
 
-void CountDownLatch::countDown()
+inline void CountDownLatch::countDown()
 {
-    std::unique_lock<std::mutex> lk(mutex_);
+    std::unique_lock<std::mutex> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
     --count_;
+    stats_.recordPut(0);
     if(count_ == 0)
         cond_.notify_all();
 }
 
-int CountDownLatch::getCount() const
+inline int CountDownLatch::getCount() const
 {
     std::lock_guard<std::mutex> lk(mutex_);
     return count_;
-}
\ No newline at end of file
+}
+
+inline QueueStatsSnapshot CountDownLatch::stats() const
+{
+    return stats_.snapshot();
+}
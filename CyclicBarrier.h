@@ -0,0 +1,238 @@
+# pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include "ParkingLot.h"
+
+/**
+ * How the arrivals of one phase of a CyclicBarrier are counted.
+ *
+ * <p>An Arrival is built with the number of parties. arrive() is called
+ * once per party and phase and returns 0 to exactly one caller, the
+ * last one, after it has reset the Arrival for the next phase; no party
+ * arrives again before that caller has advanced the barrier.
+ */
+
+/**
+ * A single sense-reversing counter: every party decrements one atomic
+ * word, so a phase costs P read-modify-writes on one cache line but
+ * takes no lock. Best for a few parties.
+ */
+class CentralArrival
+{
+    public:
+        explicit CentralArrival(int parties): parties_(parties), remaining_(parties) {}
+        CentralArrival(const CentralArrival&) = delete;
+        CentralArrival& operator=(const CentralArrival&) = delete;
+
+        /** Returns the arrival index: parties-1 for the first, 0 for the last */
+        int arrive()
+        {
+            int index = remaining_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+            if(index == 0)
+                remaining_.store(parties_, std::memory_order_relaxed);
+            return index;
+        }
+
+    private:
+        const int parties_;
+        alignas(64) std::atomic<int> remaining_;
+};
+
+/**
+ * A combining tree of counters with fan-in {@code fanIn}. Parties are
+ * spread over the leaves, and the last arrival at a node carries on to
+ * its parent, so each counter sees at most fanIn arrivals per phase and
+ * the longest chain of dependent updates is log_fanIn(P) long.
+ *
+ * <p>The leaf slot of an arrival is its ticket within the phase, taken
+ * from a running counter modulo {@code parties}, so each leaf gets
+ * exactly its share of every phase whichever threads arrive; a thread
+ * may use any number of barriers, and another thread may take its
+ * place, as with the Java class.
+ */
+class TreeArrival
+{
+    public:
+        static const int kDefaultFanIn = 4;
+
+        explicit TreeArrival(int parties, int fanIn = kDefaultFanIn);
+        TreeArrival(const TreeArrival&) = delete;
+        TreeArrival& operator=(const TreeArrival&) = delete;
+
+        /** Returns 0 for the last arrival, the remaining count of its node otherwise */
+        int arrive();
+
+    private:
+        struct alignas(64) Node
+        {
+            std::atomic<int> remaining{0};
+            int parties = 0;
+            /** Index of the parent node, -1 for the root */
+            int parent = -1;
+        };
+
+        const int parties_;
+        const int fanIn_;
+        /** Leaves first, then each level up to the root */
+        std::unique_ptr<Node[]> nodes_;
+        /** Arrivals so far; wide enough never to wrap */
+        alignas(64) std::atomic<std::uint64_t> tickets_;
+};
+
+inline TreeArrival::TreeArrival(int parties, int fanIn):
+    parties_(parties),
+    fanIn_(fanIn),
+    tickets_(0)
+{
+    /* count the nodes of every level, the leaves holding the parties */
+    int total = 0;
+    for(int width = parties; ; width = (width + fanIn - 1) / fanIn)
+    {
+        int nodes = (width + fanIn - 1) / fanIn;
+        total += nodes;
+        if(nodes == 1)
+            break;
+    }
+    nodes_.reset(new Node[total]);
+
+    int levelStart = 0;
+    int width = parties;
+    for(;;)
+    {
+        int nodes = (width + fanIn - 1) / fanIn;
+        for(int i = 0; i < nodes; ++i)
+        {
+            Node &n = nodes_[levelStart + i];
+            n.parties = (i + 1) * fanIn <= width ? fanIn : width - i * fanIn;
+            n.remaining.store(n.parties, std::memory_order_relaxed);
+            n.parent = nodes == 1 ? -1 : levelStart + nodes + i / fanIn;
+        }
+        if(nodes == 1)
+            break;
+        levelStart += nodes;
+        width = nodes;
+    }
+}
+
+/*
+ * A phase has exactly parties_ arrivals, and none of the next phase
+ * comes before the last of them, so tickets modulo parties_ number the
+ * arrivals of each phase 0 to parties_-1.
+ */
+inline int TreeArrival::arrive()
+{
+    int slot = static_cast<int>(tickets_.fetch_add(1, std::memory_order_relaxed) % parties_);
+    int index = slot / fanIn_;
+    for(;;)
+    {
+        Node &n = nodes_[index];
+        int remaining = n.remaining.fetch_sub(1, std::memory_order_acq_rel) - 1;
+        if(remaining > 0)
+            return remaining;
+        n.remaining.store(n.parties, std::memory_order_relaxed);
+        if(n.parent < 0)
+            return 0;
+        index = n.parent;
+    }
+}
+
+/**
+ * A synchronization aid that allows a set of threads to all wait for
+ * each other to reach a common barrier point. The barrier is called
+ * cyclic because it can be re-used after the waiting threads are
+ * released.
+ *
+ * <p>The optional barrier action is run once per barrier point, after
+ * the last thread in the party arrives, but before any threads are
+ * released, by the last thread to arrive.
+ *
+ * <p>{@code Arrival} decides how arrivals are counted: CentralArrival,
+ * one sense-reversing counter, or TreeArrival, a combining tree for
+ * many parties. Either way the release is one store to a phase word on
+ * a line of its own, and waiting threads spin on that word before they
+ * park (see ParkingLot.h), so a phase takes no lock unless a thread
+ * actually has to sleep. Unlike the Java class there is no timeout or
+ * interruption, and so no broken state: if the barrier action throws,
+ * the barrier still advances and releases the other parties, and the
+ * exception propagates from the await() of the last thread only.
+ */
+template<typename Arrival = CentralArrival>
+class CyclicBarrier
+{
+    public:
+        explicit CyclicBarrier(int parties, std::function<void()> barrierAction = nullptr);
+        CyclicBarrier(const CyclicBarrier&) = delete;
+        CyclicBarrier& operator=(const CyclicBarrier&) = delete;
+
+        /**
+         * Waits until all parties have called await on this barrier.
+         * Returns 0 for the thread that arrived last and ran the
+         * barrier action, a positive number for the others (the
+         * arrival index, parties-1 for the first, with CentralArrival).
+         */
+        int await();
+
+        int getParties() const;
+
+        /** Number of times the barrier has been tripped, modulo 2^32 */
+        std::uint32_t getPhase() const;
+
+    private:
+        const int parties_;
+        std::function<void()> barrierAction_;
+        Arrival arrival_;
+
+        /** Advanced by the last arrival of every phase */
+        alignas(64) std::atomic<std::uint32_t> phase_;
+};
+
+template<typename Arrival>
+CyclicBarrier<Arrival>::CyclicBarrier(int parties, std::function<void()> barrierAction):
+    parties_(parties),
+    barrierAction_(std::move(barrierAction)),
+    arrival_(parties),
+    phase_(0)
+{
+}
+
+template<typename Arrival>
+int CyclicBarrier<Arrival>::await()
+{
+    const std::uint32_t phase = phase_.load(std::memory_order_acquire);
+    int index = arrival_.arrive();
+    if(index == 0)
+    {
+        if(barrierAction_)
+        {
+            try
+            {
+                barrierAction_();
+            }
+            catch(...)
+            {
+                phase_.store(phase + 1);
+                ParkingLot::unparkAll(&phase_);
+                throw;
+            }
+        }
+        phase_.store(phase + 1);
+        ParkingLot::unparkAll(&phase_);
+        return 0;
+    }
+    ParkingLot::parkWhile(&phase_, [&]{ return phase_.load() == phase; });
+    return index;
+}
+
+template<typename Arrival>
+int CyclicBarrier<Arrival>::getParties() const
+{
+    return parties_;
+}
+
+template<typename Arrival>
+std::uint32_t CyclicBarrier<Arrival>::getPhase() const
+{
+    return phase_.load(std::memory_order_acquire);
+}
@@ -1,11 +1,15 @@
 # pragma once
-#include <queue>
+#include <algorithm>
+#include <vector>
+#include <utility>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <memory>
 #include <chrono>
-template<typename T>
+#include "Locks.h"
+#include "QueueStats.h"
+template<typename T, typename Lock = std::mutex>
 class DelayQueue
 {
     
@@ -15,21 +19,38 @@ class DelayQueue
         DelayQueue& operator=(const DelayQueue&) = delete;
         ~DelayQueue() = default;
         void put(const T &value);
+        void put(T &&value);
         bool offer(const T &value);
+        bool offer(T &&value);
+
+        /** Constructs an element in place and inserts it. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
         const T& peek();
         std::shared_ptr<T> poll();
         std::shared_ptr<T> take();
         int size();
+        QueueStatsSnapshot stats() const;
     private:
-        std::priority_queue<T> queue_;
-        mutable std::mutex mutex_;
+        std::shared_ptr<T> dequeue();
+
+        /**
+         * Binary max-heap by operator<, kept with std::push_heap and
+         * std::pop_heap as std::priority_queue would, but the head can
+         * be moved out of the vector before it is popped.
+         */
+        std::vector<T> queue_;
+
+        /** Lock guarding all access, std::mutex unless another Lock is given */
+        mutable Lock mutex_;
 
     /**
      * Condition signalled when a newer element becomes available
      * at the head of the queue or a new thread may need to
      * become leader.
      */
-    std::condition_variable available_;
+    ConditionVariableFor<Lock> available_;
 
      /**
      * Thread designated to wait for the element at the head of
@@ -50,7 +71,10 @@ class DelayQueue
     std::thread::id leader_;
     
     bool hasLeader_;
-    
+
+    /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+    QueueStats stats_;
+
 };
 
 /*
@@ -58,10 +82,16 @@ class DelayQueue
  * unbounded this method will never block.
  */
 
-template<typename T>
-void  DelayQueue<T>::put(const T &value)
+template<typename T, typename Lock>
+void  DelayQueue<T, Lock>::put(const T &value)
+{
+    emplace(value);
+}
+
+template<typename T, typename Lock>
+void  DelayQueue<T, Lock>::put(T &&value)
 {
-    offer(value);
+    emplace(std::move(value));
 }
 
 /*
@@ -69,27 +99,43 @@ void  DelayQueue<T>::put(const T &value)
  * unbounded this method will never block.
  */
 
-template<typename T>
-bool DelayQueue<T>::offer(const T &value)
+template<typename T, typename Lock>
+bool DelayQueue<T, Lock>::offer(const T &value)
+{
+    emplace(value);
+    return true;
+}
+
+template<typename T, typename Lock>
+bool DelayQueue<T, Lock>::offer(T &&value)
+{
+    emplace(std::move(value));
+    return true;
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void DelayQueue<T, Lock>::emplace(Args&&... args)
 {
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    bool  resetLeader_ = queue_.size() == 0 ||  value < queue_.top()
-                        ? true
-                        : false;
-    queue_.push(value);
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lock(mutex_, std::adopt_lock);
+    queue_.emplace_back(std::forward<Args>(args)...);
+    /* the new element becomes the head if it ranks above the old one */
+    bool  resetLeader_ = queue_.size() == 1 || queue_.front() < queue_.back();
+    std::push_heap(queue_.begin(), queue_.end());
+    stats_.recordPut(queue_.size());
     /* Whenever the head of the queue is replaced with
      * an element with an earlier expiration time, the leader
      * field is invalidated by being reset to null, and some
      * waiting thread, but not necessarily the current leader, is
      * signalled.
      */
-    if(true)
+    if(resetLeader_)
     {
         hasLeader_ = false;
         available_.notify_one();
     }
-    return true;
 }
 
 
@@ -98,17 +144,14 @@ bool DelayQueue<T>::offer(const T &value)
  * if this queue has no elements with an expired delay.
  */
 
-template<typename T>
-std::shared_ptr<T> DelayQueue<T>::poll()
+template<typename T, typename Lock>
+std::shared_ptr<T> DelayQueue<T, Lock>::poll()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if(queue_.size() == 0 || (queue_.top()).getDelay() > std::chrono::steady_clock::now())
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lock(mutex_, std::adopt_lock);
+    if(queue_.size() == 0 || (queue_.front()).getDelay() > std::chrono::steady_clock::now())
         return std::shared_ptr<T>();
-    
-    std::shared_ptr<T> const res(std::make_shared<T>(std::move(queue_.top())));
-    queue_.pop();
-    return res;
-    
+    return dequeue();
 }
 
 
@@ -116,25 +159,32 @@ std::shared_ptr<T> DelayQueue<T>::poll()
  * Retrieves and removes the head of this queue, waiting if necessary
  * until an element with an expired delay is available on this queue.
  */
-template<typename T>
-std::shared_ptr<T> DelayQueue<T>::take()
+template<typename T, typename Lock>
+std::shared_ptr<T> DelayQueue<T, Lock>::take()
 {
-    std::unique_lock<std::mutex> lock(mutex_);
+    std::unique_lock<Lock> lock(mutex_, std::defer_lock);
+    stats_.lock(lock);
+    QueueStats::WaitScope wait(stats_, false);
     for(;;)
     {
         if(queue_.size() == 0)
+        {
+            wait.blocked();
             available_.wait(lock);
+        }
         else
         {
-            std::chrono::steady_clock::time_point timeout =  (queue_.top()).getDelay(); //FIXME
+            std::chrono::steady_clock::time_point timeout =  (queue_.front()).getDelay(); //FIXME
             if(timeout <= std::chrono::steady_clock::now())
                 break;
+            wait.blocked();
             if(hasLeader_)
                 available_.wait(lock);
             else
             {
                 std::thread::id thisThread =  std::this_thread::get_id();
                 leader_ =  thisThread;
+                hasLeader_ = true;
                 //while(available_.wait_until(lock, timeout) != std::cv_status::timeout);
                 available_.wait_until(lock, timeout);
                 if(leader_ == thisThread)
@@ -143,8 +193,7 @@ std::shared_ptr<T> DelayQueue<T>::take()
 
         }
     }
-    std::shared_ptr<T> const res(std::make_shared<T>(std::move(queue_.top())));
-    queue_.pop(); 
+    std::shared_ptr<T> const res = dequeue();
 
     if(!hasLeader_ && queue_.size() > 0)
         available_.notify_one();
@@ -152,17 +201,41 @@ std::shared_ptr<T> DelayQueue<T>::take()
     return res;
 }
 
+/**
+ * Moves the head out of the heap and removes it.
+ * Call only when holding lock and the queue is not empty.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> DelayQueue<T, Lock>::dequeue()
+{
+    std::pop_heap(queue_.begin(), queue_.end());
+    std::shared_ptr<T> const res(std::make_shared<T>(std::move(queue_.back())));
+    queue_.pop_back();
+    stats_.recordTake();
+    return res;
+}
+
 /* Retrieves, but does not remove, the head of this queue*/
-template<typename T>
-const T& DelayQueue<T>::peek()
+template<typename T, typename Lock>
+const T& DelayQueue<T, Lock>::peek()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return queue_.top();
+    std::lock_guard<Lock> lock(mutex_);
+    return queue_.front();
 }
 
-template<typename T>
-int  DelayQueue<T>::size()
+template<typename T, typename Lock>
+int  DelayQueue<T, Lock>::size()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Lock> lock(mutex_);
     return queue_.size();
 }
+
+/**
+ * Returns a snapshot of the runtime statistics. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot DelayQueue<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
@@ -0,0 +1,202 @@
+# pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Epoch-based reclamation for the lock-free structures.
+ *
+ * <p>A thread reads shared nodes only inside an Epoch::Guard, which
+ * announces the global epoch in the thread's record. A node unlinked
+ * from a structure is handed to retire() instead of being freed, and
+ * is kept in a limbo list of the retiring thread, tagged with the
+ * epoch it was retired in. The global epoch advances only once every
+ * thread inside a guard has announced the current one, so when it has
+ * moved two steps past a node's tag no guard can still hold a
+ * reference to that node, and it is reclaimed.
+ *
+ * <p>Entering and leaving a guard writes only the calling thread's own
+ * record, a cache line of its own, so readers do not contend. Guards
+ * nest. Every 64th retire of a thread tries to advance the epoch and
+ * reclaims what has become safe.
+ *
+ * <p>Thread records are never freed. A record is released when its
+ * thread exits and adopted by the next new thread, together with any
+ * nodes still in its limbo lists.
+ */
+class Epoch
+{
+    public:
+        /** Frees or recycles a retired object */
+        typedef void (*Reclaim)(void *object, void *context);
+
+    private:
+        struct Retired
+        {
+            void *object;
+            Reclaim reclaim;
+            void *context;
+        };
+
+        struct alignas(64) Record
+        {
+            /** Announced epoch times two, plus one while inside a guard */
+            std::atomic<std::uint64_t> local{0};
+            std::atomic<bool> inUse{true};
+            Record *next = nullptr;
+            /** Owner only from here on */
+            int depth = 0;
+            int sinceCollect = 0;
+            /** Objects retired in the epoch of the same index mod 3 */
+            std::vector<Retired> limbo[3];
+            std::uint64_t limboEpoch[3] = {0, 0, 0};
+        };
+
+    public:
+        /** Announces the calling thread for its lifetime; nests. */
+        class Guard
+        {
+            public:
+                Guard(): record_(Epoch::record()) { enter(*record_); }
+                ~Guard() { leave(*record_); }
+                Guard(const Guard&) = delete;
+                Guard& operator=(const Guard&) = delete;
+            private:
+                Record *record_;
+        };
+
+        /**
+         * Hands an unlinked object over for reclamation: reclaim(object,
+         * context) runs once no guard that may have seen it is left.
+         */
+        static void retire(void *object, Reclaim reclaim, void *context);
+
+        /** Tries to advance the epoch and reclaims the calling thread's safe objects. */
+        static void collect();
+
+    private:
+        static const int kCollectInterval = 64;
+
+        static std::atomic<std::uint64_t> &globalEpoch()
+        {
+            static std::atomic<std::uint64_t> epoch(1);
+            return epoch;
+        }
+
+        static std::atomic<Record*> &records()
+        {
+            static std::atomic<Record*> head(nullptr);
+            return head;
+        }
+
+        static Record *acquireRecord();
+        static Record *record();
+        static void enter(Record &r);
+        static void leave(Record &r);
+        static bool tryAdvance(std::uint64_t epoch);
+        static void reclaim(std::vector<Retired> &limbo);
+        static void reclaimSafe(Record &r, std::uint64_t epoch);
+};
+
+inline Epoch::Record *Epoch::acquireRecord()
+{
+    for(Record *r = records().load(std::memory_order_acquire); r != nullptr; r = r->next)
+    {
+        bool expected = false;
+        if(!r->inUse.load(std::memory_order_relaxed) &&
+           r->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return r;
+    }
+    Record *r = new Record();
+    Record *head = records().load(std::memory_order_relaxed);
+    do
+        r->next = head;
+    while(!records().compare_exchange_weak(head, r, std::memory_order_release,
+                                           std::memory_order_relaxed));
+    return r;
+}
+
+inline Epoch::Record *Epoch::record()
+{
+    struct Holder
+    {
+        Record *record = acquireRecord();
+        ~Holder()
+        {
+            reclaimSafe(*record, globalEpoch().load());
+            record->inUse.store(false, std::memory_order_release);
+        }
+    };
+    thread_local Holder holder;
+    return holder.record;
+}
+
+inline void Epoch::enter(Record &r)
+{
+    if(r.depth++ == 0)
+        r.local.store(globalEpoch().load() * 2 + 1);
+}
+
+inline void Epoch::leave(Record &r)
+{
+    if(--r.depth == 0)
+        r.local.store(0, std::memory_order_release);
+}
+
+/*
+ * Moves the epoch from epoch to epoch+1 if every thread inside a guard
+ * has announced epoch. Returns false if one lags behind.
+ */
+inline bool Epoch::tryAdvance(std::uint64_t epoch)
+{
+    for(Record *r = records().load(std::memory_order_acquire); r != nullptr; r = r->next)
+    {
+        std::uint64_t local = r->local.load();
+        if((local & 1) != 0 && local / 2 != epoch)
+            return false;
+    }
+    globalEpoch().compare_exchange_strong(epoch, epoch + 1);
+    return true;
+}
+
+inline void Epoch::reclaim(std::vector<Retired> &limbo)
+{
+    for(const Retired &retired : limbo)
+        retired.reclaim(retired.object, retired.context);
+    limbo.clear();
+}
+
+/* Reclaims the limbo lists of r tagged two or more epochs before epoch. */
+inline void Epoch::reclaimSafe(Record &r, std::uint64_t epoch)
+{
+    for(int i = 0; i < 3; ++i)
+        if(!r.limbo[i].empty() && r.limboEpoch[i] + 2 <= epoch)
+            reclaim(r.limbo[i]);
+}
+
+inline void Epoch::retire(void *object, Reclaim reclaimFn, void *context)
+{
+    Record &r = *record();
+    const std::uint64_t epoch = globalEpoch().load();
+    const int index = static_cast<int>(epoch % 3);
+    if(r.limboEpoch[index] != epoch)
+    {
+        /* the list holds objects from epoch-3 or before, all safe */
+        reclaim(r.limbo[index]);
+        r.limboEpoch[index] = epoch;
+    }
+    r.limbo[index].push_back(Retired{ object, reclaimFn, context });
+    if(++r.sinceCollect >= kCollectInterval)
+        collect();
+}
+
+inline void Epoch::collect()
+{
+    Record &r = *record();
+    r.sinceCollect = 0;
+    std::uint64_t epoch = globalEpoch().load();
+    if(tryAdvance(epoch))
+        ++epoch;
+    reclaimSafe(r, epoch);
+}
@@ -0,0 +1,225 @@
+# pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include "ParkingLot.h"
+
+/**
+ * A synchronization point at which threads can pair and swap elements
+ * within pairs. Each thread presents some object on entry to the
+ * exchange method, matches with a partner thread, and receives its
+ * partner's object on return. A typical use is swapping a filled
+ * buffer for an empty one between a producer and a consumer.
+ *
+ * <p>The first thread of a pair installs a node, living on its own
+ * stack, in a slot with one CAS; the second removes it with another
+ * CAS, moves the first one's object out, moves its own in and flags the
+ * node. There is no lock, and nothing is allocated.
+ *
+ * <p>A single slot serves while exchanges do not overlap. When a CAS on
+ * a slot fails because another thread got there first, the thread
+ * moves to an arena of further slots, one cache line each, whose used
+ * width grows with such collisions, so that concurrent pairs meet in
+ * different slots instead of fighting over one. A thread waiting in the
+ * arena only spins; if nobody comes it withdraws and tries a slot
+ * closer to the first, narrowing the arena, and only in the first slot
+ * does it park (see ParkingLot.h).
+ */
+template<typename T>
+class Exchanger
+{
+    public:
+        Exchanger();
+        Exchanger(const Exchanger&) = delete;
+        Exchanger& operator=(const Exchanger&) = delete;
+
+        /** Waits for a partner and returns its object in exchange for item. */
+        T exchange(T item);
+
+        /**
+         * As exchange(), giving up after timeout: returns false and
+         * leaves item alone if no partner came, otherwise replaces item
+         * with the partner's object and returns true.
+         */
+        template<typename Rep, typename Period>
+        bool exchange(T &item, const std::chrono::duration<Rep, Period> &timeout);
+
+    private:
+        /** Spin rounds of a waiter in an arena slot before it withdraws */
+        static constexpr int kArenaSpins = 1 << 10;
+        static constexpr int kMaxArena = 32;
+
+        struct Node
+        {
+            explicit Node(T *offered): item(offered) {}
+            /** The waiter's object, moved out by its partner */
+            T *item;
+            /** The partner's object */
+            std::optional<T> received;
+            std::atomic<bool> matched{false};
+        };
+
+        struct alignas(64) Slot
+        {
+            std::atomic<Node*> node{nullptr};
+        };
+
+        bool doExchange(T &item, const std::chrono::steady_clock::time_point *deadline);
+        void match(Node *other, T &item);
+        bool awaitMatch(Node &node, const std::chrono::steady_clock::time_point *deadline);
+        int collide();
+        void narrow();
+
+        /** Slot 0 is the single slot, the others the arena */
+        std::unique_ptr<Slot[]> slots_;
+        const int arenaSize_;
+        /** Highest arena index currently in use, 0 while there is no contention */
+        std::atomic<int> bound_;
+};
+
+template<typename T>
+Exchanger<T>::Exchanger():
+    arenaSize_(std::max(1, std::min(kMaxArena, static_cast<int>(std::thread::hardware_concurrency()) / 2))),
+    bound_(0)
+{
+    slots_.reset(new Slot[arenaSize_]);
+}
+
+template<typename T>
+T Exchanger<T>::exchange(T item)
+{
+    doExchange(item, nullptr);
+    return item;
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+bool Exchanger<T>::exchange(T &item, const std::chrono::duration<Rep, Period> &timeout)
+{
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    return doExchange(item, &deadline);
+}
+
+/**
+ * Swaps item with the object of a waiting node just removed from its
+ * slot. The partner's thread may return as soon as matched is set, so
+ * the node is not touched after that.
+ */
+template<typename T>
+void Exchanger<T>::match(Node *other, T &item)
+{
+    T theirs(std::move(*other->item));
+    other->received.emplace(std::move(item));
+    item = std::move(theirs);
+    other->matched.store(true);
+    ParkingLot::unparkAll(&other->matched);
+}
+
+/**
+ * Widens the arena after a collision and picks a random slot in it.
+ */
+template<typename T>
+int Exchanger<T>::collide()
+{
+    if(arenaSize_ == 1)
+        return 0;
+    int b = bound_.load(std::memory_order_relaxed);
+    if(b < arenaSize_ - 1 && bound_.compare_exchange_strong(b, b + 1, std::memory_order_relaxed))
+        ++b;
+    /* a failed CAS reloads b, which a concurrent narrow() may have brought to 0 */
+    if(b == 0)
+        return 0;
+    thread_local std::uint32_t seed = static_cast<std::uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return 1 + static_cast<int>(seed % static_cast<std::uint32_t>(b));
+}
+
+/** Narrows the arena after a waiter found nobody there. */
+template<typename T>
+void Exchanger<T>::narrow()
+{
+    int b = bound_.load(std::memory_order_relaxed);
+    if(b > 0)
+        bound_.compare_exchange_strong(b, b - 1, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool Exchanger<T>::doExchange(T &item, const std::chrono::steady_clock::time_point *deadline)
+{
+    Node node(&item);
+    int index = 0;
+    for(;;)
+    {
+        std::atomic<Node*> &slot = slots_[index].node;
+        Node *other = slot.load(std::memory_order_acquire);
+        if(other != nullptr)
+        {
+            if(slot.compare_exchange_strong(other, nullptr, std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+            {
+                match(other, item);
+                return true;
+            }
+            index = collide();
+            continue;
+        }
+        if(!slot.compare_exchange_strong(other, &node, std::memory_order_release,
+                                         std::memory_order_relaxed))
+        {
+            index = collide();
+            continue;
+        }
+
+        bool matched;
+        if(index == 0)
+            matched = awaitMatch(node, deadline);
+        else
+        {
+            for(int i = 0; i < kArenaSpins && !node.matched.load(std::memory_order_acquire); ++i)
+                cpuRelax();
+            matched = node.matched.load(std::memory_order_acquire);
+        }
+        if(!matched)
+        {
+            Node *expected = &node;
+            if(slot.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed))
+            {
+                /* withdrawn; nobody can reach the node any more */
+                if(index == 0)
+                    return false;
+                narrow();
+                index /= 2;
+                continue;
+            }
+            /* a partner removed the node and is about to flag it */
+            ParkingLot::parkWhile(&node.matched, [&node]{ return !node.matched.load(); });
+        }
+        item = std::move(*node.received);
+        return true;
+    }
+}
+
+/**
+ * Waits in the single slot, spinning and then parking; returns false at
+ * the deadline.
+ */
+template<typename T>
+bool Exchanger<T>::awaitMatch(Node &node, const std::chrono::steady_clock::time_point *deadline)
+{
+    auto unmatched = [&node]{ return !node.matched.load(); };
+    if(deadline == nullptr)
+    {
+        ParkingLot::parkWhile(&node.matched, unmatched);
+        return true;
+    }
+    return ParkingLot::parkUntil(&node.matched, unmatched, *deadline);
+}
@@ -1,65 +1,56 @@
+# pragma once
 #include <limits>
 #include <memory>
 #include <mutex>
 #include <condition_variable>
-template<typename T>
+#include <utility>
+#include "Locks.h"
+#include "QueueStats.h"
+#include "SelectWaiter.h"
+template<typename T, typename Lock = std::mutex>
 class LinkedBlockingDeque
 {
 
     
     /*
      * Implemented as a simple doubly-linked list protected by a
-     * single lock and using conditions to manage blocking.
+     * single lock and using conditions to manage blocking. The lock
+     * type is the Lock parameter, see Locks.h.
      */
     public:
-        explicit LinkedBlockingDeque(int capacity);
-        LinkedBlockingDeque(const &LinkedBlockingDeque) = delete;
-        LinkedBlockingDeque& operator=(const &LinkedBlockingDeque) = delete;
-        ~LinkedBlockingDeque() = default;
+        explicit LinkedBlockingDeque(int capacity = std::numeric_limits<int>::max());
+        LinkedBlockingDeque(const LinkedBlockingDeque&) = delete;
+        LinkedBlockingDeque& operator=(const LinkedBlockingDeque&) = delete;
+        ~LinkedBlockingDeque();
         void putFirst(T value);
         bool offerFirst(T value);
+        template<typename... Args>
+        void emplaceFirst(Args&&... args);
         std::shared_ptr<T> takeFirst();
         std::shared_ptr<T> pollFirst();
 
         void putLast(T value);
         bool offerLast(T value);
+        template<typename... Args>
+        void emplaceLast(Args&&... args);
         std::shared_ptr<T> takeLast();
         std::shared_ptr<T> pollLast();
 
+        std::shared_ptr<T> poll();
+
         
         bool empty() const;
         int capacity() const;
         int size() const;
         void clear();
+        QueueStatsSnapshot stats() const;
 
-
-    private:
-        bool linkFirst(std::shared_ptr<T> pnode);
-        std::shared_ptr<T> unlinkFirst();
-
-        bool linkLast(std::shared_ptr<T> pnode);
-        std::shared_ptr<T> unlinkLast();
-        
+        /** Select support, see Select.h */
+        void addSelectWaiter(SelectWaiter *waiter);
+        void removeSelectWaiter(SelectWaiter *waiter);
 
 
     private:
-
-        /** Maximum number of items in the deque */
-        const int capacity_;
-        
-        /** Number of items in the deque */
-        int count_;
-
-        /** Main lock guarding all access */
-        mutable std::mutex mutex_;
-
-        /** Condition for waiting takes */
-        std::condition_variable notFull_;
-
-        /** Condition for waiting puts */
-        std::condition_variable notEmpty_;
-
-        
         struct Node
         {
             /**
@@ -82,15 +73,48 @@ class LinkedBlockingDeque
              * - null, meaning there is no successor
              */
             std::shared_ptr<Node> next;
-            Node(T value){ item = std::make_shared<T>(std::move(value)); }
+            explicit Node(std::shared_ptr<T> value): item(std::move(value)) {}
         };
 
+        bool linkFirst(std::shared_ptr<Node> pnode);
+        std::shared_ptr<T> unlinkFirst();
+
+        bool linkLast(std::shared_ptr<Node> pnode);
+        std::shared_ptr<T> unlinkLast();
+        
+
+
+    private:
+
+        /** Maximum number of items in the deque */
+        const int capacity_;
+        
+        /** Number of items in the deque */
+        int count_;
+
+        /** Main lock guarding all access */
+        mutable Lock mutex_;
+
+        /** Condition for waiting takes */
+        ConditionVariableFor<Lock> notFull_;
+
+        /** Condition for waiting puts */
+        ConditionVariableFor<Lock> notEmpty_;
+
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
+
+        /** Threads selecting on this queue among others */
+        WaiterList selectWaiters_;
+
+        
+
         /**
          * Pointer to first node.
          * Invariant: (first == null && last == null) ||
          *            (first.prev == null && first.item != null)
          */
-        std::shared_ptr<T> first;
+        std::shared_ptr<Node> first;
 
         
         /**
@@ -98,11 +122,11 @@ class LinkedBlockingDeque
          * Invariant: (first == null && last == null) ||
          *            (last.next == null && last.item != null)
          */
-        std::shared_ptr<T> last; 
+        std::shared_ptr<Node> last;
 };
 
-template<typename T> 
-LinkedBlockingDeque<T>::LinkedBlockingDeque(int capacity = std::numeric_limits<int>):
+template<typename T, typename Lock>
+LinkedBlockingDeque<T, Lock>::LinkedBlockingDeque(int capacity):
     capacity_(capacity),
     count_(0),
     last(nullptr)
@@ -110,14 +134,21 @@ LinkedBlockingDeque<T>::LinkedBlockingDeque(int capacity = std::numeric_limits<i
 
 }
 
+template<typename T, typename Lock>
+LinkedBlockingDeque<T, Lock>::~LinkedBlockingDeque()
+{
+    /* prev links form reference cycles, break them explicitly */
+    clear();
+}
+
 
 // Basic linking and unlinking operations, called only while holding lock
 
  /**
   * Links node as first element, or returns false if full.
   */
-template<typename T>
-bool LinkedBlockingDeque<T>::linkFirst(std::shared_ptr<T> pnode)
+template<typename T, typename Lock>
+bool LinkedBlockingDeque<T, Lock>::linkFirst(std::shared_ptr<Node> pnode)
 {
     if(count_ >= capacity_)
         return false;
@@ -126,10 +157,12 @@ bool LinkedBlockingDeque<T>::linkFirst(std::shared_ptr<T> pnode)
     if(last == nullptr)
         last = pnode;
     else
-        frist->prev = pnode;
+        first->prev = pnode;
     first = pnode;
     ++count_;
+    stats_.recordPut(count_);
     notEmpty_.notify_one();
+    selectWaiters_.signalAll();
     return true;
 }
 
@@ -137,8 +170,8 @@ bool LinkedBlockingDeque<T>::linkFirst(std::shared_ptr<T> pnode)
   * Removes and returns first element, or null if empty.
   */
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::unlinkFirst()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::unlinkFirst()
 {
     if(first == nullptr)
         return std::shared_ptr<T>();
@@ -149,6 +182,7 @@ std::shared_ptr<T> LinkedBlockingDeque<T>::unlinkFirst()
         ((first->next)->prev).reset();
     first = first->next;
     --count_;
+    stats_.recordTake();
     notFull_.notify_one();
     return res;
 }
@@ -157,8 +191,8 @@ std::shared_ptr<T> LinkedBlockingDeque<T>::unlinkFirst()
  * Links node as last element, or returns false if full.
  */
 
-template<typename T>
-bool LinkedBlockingDeque<T>::linkLast(std::shared_ptr<T> pnode)
+template<typename T, typename Lock>
+bool LinkedBlockingDeque<T, Lock>::linkLast(std::shared_ptr<Node> pnode)
 {
     if(count_ >= capacity_)
         return false;
@@ -170,7 +204,9 @@ bool LinkedBlockingDeque<T>::linkLast(std::shared_ptr<T> pnode)
         last->next = pnode;
     last = pnode;
     ++count_;
+    stats_.recordPut(count_);
     notEmpty_.notify_one();
+    selectWaiters_.signalAll();
     return true;
 }
 
@@ -178,8 +214,8 @@ bool LinkedBlockingDeque<T>::linkLast(std::shared_ptr<T> pnode)
 /**
  * Removes and returns last element, or null if empty.
  */
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::unlinkLast()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::unlinkLast()
 {
     if(last == nullptr)
         return std::shared_ptr<T>();
@@ -190,44 +226,60 @@ std::shared_ptr<T> LinkedBlockingDeque<T>::unlinkLast()
         ((last->prev)->next).reset();
     last = last->prev;
     --count_;
+    stats_.recordTake();
     notFull_.notify_one();
     return res;
 }
 
-template<typename T>
-void LinkedBlockingDeque<T>::putFirst(T value)
+template<typename T, typename Lock>
+void LinkedBlockingDeque<T, Lock>::putFirst(T value)
 {
-    std::shared_ptr<T> pnode(new Node(std::move(value)));
-    std::unique_lock<std::mutex> putLock(mutex_);
-    notFull_.wait(putLock, [thise]{ return linkFirst(pnode); });
+    emplaceFirst(std::move(value));
 }
 
-template<typename T>
-bool LinkedBlockingDeque<T>::offerFirst(T value)
+/**
+ * Constructs an element in place and links it as first element,
+ * waiting if necessary for space to become available.
+ */
+template<typename T, typename Lock>
+template<typename... Args>
+void LinkedBlockingDeque<T, Lock>::emplaceFirst(Args&&... args)
 {
-    std::shared_ptr<T> pnode(new Node(std::move(value)));
-    std::lock_guard<std::mutex> putLock;
+    std::shared_ptr<Node> pnode(std::make_shared<Node>(std::make_shared<T>(std::forward<Args>(args)...)));
+    std::unique_lock<Lock> putLock(mutex_, std::defer_lock);
+    stats_.lock(putLock);
+    stats_.awaitPut(notFull_, putLock, [&]{ return linkFirst(pnode); });
+}
+
+template<typename T, typename Lock>
+bool LinkedBlockingDeque<T, Lock>::offerFirst(T value)
+{
+    std::shared_ptr<Node> pnode(std::make_shared<Node>(std::make_shared<T>(std::move(value))));
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> putLock(mutex_, std::adopt_lock);
     return linkFirst(pnode);
 }
 
 
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::takeFirst()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::takeFirst()
 {
     std::shared_ptr<T> res;
-    std::unique_lock<std::mutex> takeLock(mutex_);
+    std::unique_lock<Lock> takeLock(mutex_, std::defer_lock);
+    stats_.lock(takeLock);
     
-    notEmpty_.wait(takeLock, [&]{ 
+    stats_.awaitTake(notEmpty_, takeLock, [&]{ 
         res = unlinkFirst();
         return res != nullptr; });
     return res;
 }
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::pollFirst()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::pollFirst()
 {
-    std::lock_guard<std::mutex> takeLock(mutex_);
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> takeLock(mutex_, std::adopt_lock);
     return unlinkFirst();
 }
 
@@ -235,39 +287,64 @@ std::shared_ptr<T> LinkedBlockingDeque<T>::pollFirst()
 
 
 
-template<typename T>
-void LinkedBlockingDeque<T>::putLast(T value)
+/**
+ * Retrieves and removes the head of the queue represented by this deque,
+ * or returns null if this deque is empty. Equivalent to pollFirst().
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::poll()
 {
-    std::shared_ptr<T> pnode(new Node(std::move(value)));
-    std::unique_lock<std::mutex> putLock(mutex_);
-    notFull_.wait(putLock, [thise]{ return linkLast(pnode); });
+    return pollFirst();
 }
 
-template<typename T>
-bool LinkedBlockingDeque<T>::offerLast(T value)
+template<typename T, typename Lock>
+void LinkedBlockingDeque<T, Lock>::putLast(T value)
 {
-    std::shared_ptr<T> pnode(new Node(std::move(value)));
-    std::lock_guard<std::mutex> putLock;
+    emplaceLast(std::move(value));
+}
+
+/**
+ * Constructs an element in place and links it as last element,
+ * waiting if necessary for space to become available.
+ */
+template<typename T, typename Lock>
+template<typename... Args>
+void LinkedBlockingDeque<T, Lock>::emplaceLast(Args&&... args)
+{
+    std::shared_ptr<Node> pnode(std::make_shared<Node>(std::make_shared<T>(std::forward<Args>(args)...)));
+    std::unique_lock<Lock> putLock(mutex_, std::defer_lock);
+    stats_.lock(putLock);
+    stats_.awaitPut(notFull_, putLock, [&]{ return linkLast(pnode); });
+}
+
+template<typename T, typename Lock>
+bool LinkedBlockingDeque<T, Lock>::offerLast(T value)
+{
+    std::shared_ptr<Node> pnode(std::make_shared<Node>(std::make_shared<T>(std::move(value))));
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> putLock(mutex_, std::adopt_lock);
     return linkLast(pnode);
 }
 
 
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::takeLast()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::takeLast()
 {
     std::shared_ptr<T> res;
-    std::unique_lock<std::mutex> takeLock(mutex_);
-    notEmpty_.wait(takeLock, [&]{ 
+    std::unique_lock<Lock> takeLock(mutex_, std::defer_lock);
+    stats_.lock(takeLock);
+    stats_.awaitTake(notEmpty_, takeLock, [&]{ 
         res = unlinkLast();
         return res != nullptr; });
     return res;
 }
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingDeque<T>::pollLast()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingDeque<T, Lock>::pollLast()
 {
-    std::lock_guard<std::mutex> takeLock(mutex_);
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> takeLock(mutex_, std::adopt_lock);
     return unlinkLast();
 }
 
@@ -276,25 +353,25 @@ std::shared_ptr<T> LinkedBlockingDeque<T>::pollLast()
 
 
 
-template<typename T>
-bool LinkedBlockingDeque<T>::empty() const
+template<typename T, typename Lock>
+bool LinkedBlockingDeque<T, Lock>::empty() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
-    return count_.load() == 0;
+    std::lock_guard<Lock> lk(mutex_);
+    return count_ == 0;
 }
 
 
-template<typename T>
-int LinkedBlockingDeque<T>::size() const
+template<typename T, typename Lock>
+int LinkedBlockingDeque<T, Lock>::size() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
-    return count_.load();
+    std::lock_guard<Lock> lk(mutex_);
+    return count_;
 }
 
-template<typename T>
-int LinkedBlockingDeque<T>::capacity() const
+template<typename T, typename Lock>
+int LinkedBlockingDeque<T, Lock>::capacity() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
+    std::lock_guard<Lock> lk(mutex_);
     return capacity_;
 }
 
@@ -304,13 +381,13 @@ int LinkedBlockingDeque<T>::capacity() const
 * The deque will be empty after this call returns.
 */
 
-template<typename T>
-void LinkedBlockingDeque<T>::clear()
+template<typename T, typename Lock>
+void LinkedBlockingDeque<T, Lock>::clear()
 {
-   std::lock_guard<std::mutex> lk(mutex_);
-   for(std::shared_ptr<T> f = first; f != nullptr; )
+   std::lock_guard<Lock> lk(mutex_);
+   for(std::shared_ptr<Node> f = first; f != nullptr; )
    {
-       (f.item).reset();
+       (f->item).reset();
        auto n = f->next;
        (f->prev).reset();
        (f->next).reset();
@@ -321,3 +398,25 @@ void LinkedBlockingDeque<T>::clear()
    count_= 0;
    notFull_.notify_all();
 }
+
+/**
+ * Returns a snapshot of the runtime statistics. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot LinkedBlockingDeque<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
+
+template<typename T, typename Lock>
+void LinkedBlockingDeque<T, Lock>::addSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.add(waiter);
+}
+
+template<typename T, typename Lock>
+void LinkedBlockingDeque<T, Lock>::removeSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.remove(waiter);
+}
@@ -1,14 +1,46 @@
+# pragma once
 #include <memory>
 #include <mutex>
 #include <condition_variable>
+#include <algorithm>
 #include <atomic>
-#include <memory>
+#include <chrono>
+#include <functional>
+#include <iterator>
 #include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "AsyncWaiter.h"
+#include "CoDel.h"
+#include "Locks.h"
+#include "QueueStats.h"
+#include "SelectWaiter.h"
+#include "SpillStore.h"
 
+/**
+ * Configuration of the byte bound of LinkedBlockingQueue.
+ *
+ * <p>Every element counts sizeOf(element) bytes, sizeof(T) if sizeOf is
+ * empty, and a put waits while the queued elements and its own would
+ * add up to more than maxBytes. An element larger than maxBytes by
+ * itself is let in once the queue is empty, so it cannot wait forever.
+ * The element count bound applies as well.
+ */
 template<typename T>
+struct ByteBudget
+{
+    /** Total accounted size the queue may hold */
+    std::size_t maxBytes = std::size_t(64) << 20;
+
+    /** Accounted size of an element */
+    std::function<std::size_t(const T&)> sizeOf;
+};
+
+template<typename T, typename Lock = std::mutex>
 class LinkedBlockingQueue
 {
-    
+
     /*
      * A variant of the "two lock queue" algorithm.  The putLock gates
      * entry to put (and offer), and has an associated condition for
@@ -20,27 +52,121 @@ class LinkedBlockingQueue
      * it signals taker. That taker in turn signals others if more
      * items have been entered since the signal. And symmetrically for
      * takes signalling puts. Operations such as remove(Object) and
-     * iterators acquire both locks.
+     * iterators acquire both locks. Both locks are of type Lock
+     * (std::mutex by default, see Locks.h).
+     *
+     * With a SpillOptions the queue overflows to disk: once the
+     * in-memory budget is used up, puts encode their element into a
+     * SpillStore instead of linking a node, and keep doing so until
+     * takes have drained the store again. Takes read the store only
+     * when no in-memory element is left, which keeps FIFO order, since
+     * nothing is linked in memory while the store is not empty. The
+     * store has a lock of its own, taken inside putLock or takeLock.
+     * count_ counts the elements in both places, memoryCount_ only the
+     * linked ones; a put increments memoryCount_ before count_, so a
+     * take that sees count_ > 0 and memoryCount_ == 0 knows its element
+     * is on disk.
+     *
+     * Coroutines suspended in asyncTake wait in asyncTakes_, guarded by
+     * takeLock, and those suspended in asyncPut in asyncPuts_, guarded
+     * by putLock. Like the waiting threads they are served by the
+     * cascading signals: signalWaiters completes their operations
+     * under the matching lock and resumes them after releasing it.
+     *
+     * takeBatch detaches a run of nodes from the head in one critical
+     * section with one RMW on count_. A batch taker that lingers for
+     * more elements publishes the count it waits for in lingerTarget_;
+     * the put that brings count_ to exactly that value signals it like
+     * the put that makes the queue non-empty.
+     *
+     * With a CoDelOptions the queue sheds load: insert stamps each node,
+     * and take and poll run the head through the CoDel controller,
+     * under takeLock, shedding elements while it says so. All elements
+     * removed by one take, shed or not, leave count_ in one fetch_sub,
+     * and the shed ones reach onDrop after takeLock is released. The
+     * controller never sheds the last element, so a take always returns
+     * one. Spilling and load shedding are separate modes; takeBatch and
+     * coroutine takes bypass the controller.
+     *
+     * With a ByteBudget the queue is bounded by bytes as well: puts
+     * size their element before taking putLock, and the node carries
+     * the size so that takes subtract it from bytes_ without calling
+     * sizeOf. A put adds to bytes_ before count_, so bytes_ never goes
+     * below the size of the counted elements. Unlike the count bound,
+     * the byte bound has no single transition at which a waiting put is
+     * enabled, since waiting puts have different sizes: a put that
+     * finds no room sets bytesWaiting_ before checking again, and the
+     * take that clears it wakes all waiting puts. The byte budget is a
+     * mode of its own, like spilling and load shedding.
      * */
 
     public:
-        explicit LinkedBlockingQueue(int capacity);
+        explicit LinkedBlockingQueue(int capacity = std::numeric_limits<int>::max());
+        LinkedBlockingQueue(int capacity, SpillOptions<T> spill);
+        /** A queue that sheds elements with a standing sojourn time, see CoDel.h */
+        LinkedBlockingQueue(int capacity, CoDelOptions<T> codel);
+        /** A queue bounded by the accounted size of its elements as well */
+        LinkedBlockingQueue(int capacity, ByteBudget<T> budget);
         ~LinkedBlockingQueue();
         LinkedBlockingQueue(const LinkedBlockingQueue&) = delete;
         LinkedBlockingQueue& operator=(const LinkedBlockingQueue& ) = delete;
 
         void put(T new_value);
         bool offer(T new_value);
+
+        /** Constructs an element in place, waiting for space like put. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
         std::shared_ptr<T> take();
         std::shared_ptr<T> poll();
 
+        class Batch;
+
+        /**
+         * Takes at least one element, waiting for it like take(), and at
+         * most max. If fewer than max are queued once there is one, waits
+         * up to linger for more, returning early when max are there. The
+         * elements come as the node chain they were queued in, detached
+         * with one lock acquisition whatever their number. Throws
+         * std::invalid_argument if max is less than 1.
+         */
+        template<typename Rep, typename Period>
+        Batch takeBatch(int max, const std::chrono::duration<Rep, Period> &linger);
+
         bool empty() const;
         int capacity() const;
         int size() const;
         void clear();
+        QueueStatsSnapshot stats() const;
+
+        /** Number of elements currently spilled to disk */
+        int spilled() const;
+
+        /** Accounted size of the queued elements, with a ByteBudget; 0 otherwise */
+        std::size_t bytes() const;
+
+        /** Select support, see Select.h */
+        void addSelectWaiter(SelectWaiter *waiter);
+        void removeSelectWaiter(SelectWaiter *waiter);
+
+    private:
+        struct Node;
+
+    public:
+#ifdef JAVATHREAD_COROUTINES
+        /** {@code co_await q.asyncTake(executor)} takes without blocking a thread. */
+        AsyncTake<T, LinkedBlockingQueue> asyncTake(Executor &executor);
+
+        /** {@code co_await q.asyncPut(value, executor)} puts without blocking a thread. */
+        AsyncPut<std::unique_ptr<Node>, LinkedBlockingQueue> asyncPut(T value, Executor &executor);
+
+        /** Coroutine support, see AsyncWaiter.h; false if done without waiting */
+        bool suspendTake(AsyncWaiter<std::shared_ptr<T>> &waiter);
+        bool suspendPut(AsyncWaiter<std::unique_ptr<Node>> &waiter);
+#endif
 
 
-  
     private:
         /**
         * Linked list node class.
@@ -51,16 +177,136 @@ class LinkedBlockingQueue
             /**
              * One of:
              * - the real successor Node
-             * - this Node, meaning the successor is head.next
              * - null, meaning there is no successor (this is the last node)
             */
-            std::unique_ptr<T> next;
-            Node(T value)
-            {
-                item = std::make_shared<T>(std::move(value)); 
-            }
-            Node();
+            std::unique_ptr<Node> next;
+            /** Accounted size of item, in spill and byte budget modes */
+            std::size_t bytes = 0;
+            /** When the node was linked, in load shedding mode only */
+            std::chrono::steady_clock::time_point enqueued;
+            explicit Node(std::shared_ptr<T> value): item(std::move(value)) {}
+            Node() = default;
+        };
+
+    public:
+        /**
+         * Elements taken by takeBatch, in queue order, owning the nodes
+         * they were queued in. Iteration yields T&; splice() appends
+         * another batch in constant time.
+         */
+        class Batch
+        {
+            public:
+                class iterator
+                {
+                    public:
+                        typedef std::forward_iterator_tag iterator_category;
+                        typedef T value_type;
+                        typedef std::ptrdiff_t difference_type;
+                        typedef T *pointer;
+                        typedef T &reference;
+
+                        explicit iterator(Node *node = nullptr): node_(node) {}
+                        T &operator*() const { return *node_->item; }
+                        T *operator->() const { return node_->item.get(); }
+                        iterator &operator++() { node_ = node_->next.get(); return *this; }
+                        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+                        bool operator==(const iterator &rhs) const { return node_ == rhs.node_; }
+                        bool operator!=(const iterator &rhs) const { return node_ != rhs.node_; }
+                    private:
+                        Node *node_;
+                };
+
+                Batch() = default;
+                Batch(Batch &&other) noexcept { swap(other); }
+                Batch &operator=(Batch &&other) noexcept
+                {
+                    Batch(std::move(other)).swap(*this);
+                    return *this;
+                }
+                ~Batch()
+                {
+                    /* iteratively, like the queue's destructor */
+                    while(head_)
+                        head_ = std::move(head_->next);
+                }
+
+                int size() const { return size_; }
+                bool empty() const { return size_ == 0; }
+                iterator begin() const { return iterator(head_.get()); }
+                iterator end() const { return iterator(); }
+
+                /** Removes and returns the first element, or null if empty. */
+                std::shared_ptr<T> poll()
+                {
+                    if(!head_)
+                        return std::shared_ptr<T>();
+                    std::shared_ptr<T> item = std::move(head_->item);
+                    head_ = std::move(head_->next);
+                    if(!head_)
+                        tail_ = nullptr;
+                    --size_;
+                    return item;
+                }
+
+                /** Appends the elements of other, leaving it empty. */
+                void splice(Batch &other)
+                {
+                    if(!other.head_)
+                        return;
+                    if(head_)
+                        tail_->next = std::move(other.head_);
+                    else
+                        head_ = std::move(other.head_);
+                    tail_ = other.tail_;
+                    size_ += other.size_;
+                    other.tail_ = nullptr;
+                    other.size_ = 0;
+                }
+
+                void swap(Batch &other) noexcept
+                {
+                    std::swap(head_, other.head_);
+                    std::swap(tail_, other.tail_);
+                    std::swap(size_, other.size_);
+                }
+
+            private:
+                friend class LinkedBlockingQueue;
+
+                /*
+                 * Takes over a chain detached from the queue: the old
+                 * dummy head up to the node before the new one, whose
+                 * items are one node behind. Shifts them into place,
+                 * outside the queue's lock.
+                 */
+                Batch(std::unique_ptr<Node> chain, Node *last, std::shared_ptr<T> lastItem, int size):
+                    head_(std::move(chain)), tail_(last), size_(size)
+                {
+                    for(Node *node = head_.get(); node != last; node = node->next.get())
+                        node->item = std::move(node->next->item);
+                    last->item = std::move(lastItem);
+                }
+
+                /** Appends a single element; the spill path uses this */
+                void append(std::shared_ptr<T> item)
+                {
+                    std::unique_ptr<Node> node(new Node(std::move(item)));
+                    Node *last = node.get();
+                    if(head_)
+                        tail_->next = std::move(node);
+                    else
+                        head_ = std::move(node);
+                    tail_ = last;
+                    ++size_;
+                }
+
+                std::unique_ptr<Node> head_;
+                Node *tail_ = nullptr;
+                int size_ = 0;
         };
+
+    private:
           /** The capacity bound, or std::numeric_limits<int>::max() if none */
         const int capacity_;
 
@@ -77,46 +323,266 @@ class LinkedBlockingQueue
         * Tail of linked list.
         * Invariant: last.next == null
         */
-        Node *tail;
+        Node *tail_;
 
         /** Lock held by take, poll, etc */
-        mutable std::mutex headMutex_;
+        mutable Lock headMutex_;
 
         /** Wait queue for waiting takes */
-        std::condition_variable notEmpty_;
-        
+        ConditionVariableFor<Lock> notEmpty_;
+
          /** Lock held by put, offer, etc */
-        mutable std::mutex tailMutex_;
+        mutable Lock tailMutex_;
 
          /** Wait queue for waiting puts */
-        std::condition_variable notFull_;
+        ConditionVariableFor<Lock> notFull_;
+
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
+
+        /** Threads selecting on this queue among others */
+        WaiterList selectWaiters_;
+
+        /** Wait queue for batch takes lingering for more elements */
+        ConditionVariableFor<Lock> batchReady_;
+
+        /** Smallest count a lingering batch take waits for; max() if none */
+        std::atomic<int> lingerTarget_{std::numeric_limits<int>::max()};
+
+        /** Number of lingering batch takes, guarded by takeLock */
+        int lingerers_ = 0;
+
+        /** State of the overflow mode */
+        struct Spill
+        {
+            explicit Spill(SpillOptions<T> opts):
+                options(std::move(opts)), store(options.directory, options.segmentBytes) {}
+            SpillOptions<T> options;
+            SpillStore store;
+            /** Guards store, spilling and buffer */
+            Lock mutex;
+            /** Puts go to the store until it is empty again */
+            std::atomic<bool> spilling{false};
+            std::string buffer;
+        };
+
+        /** Overflow mode, null unless the queue was given SpillOptions */
+        std::unique_ptr<Spill> spill_;
+
+        /** State of the load shedding mode */
+        struct Shedding
+        {
+            explicit Shedding(CoDelOptions<T> opts):
+                options(std::move(opts)), codel(options.target, options.interval) {}
+            CoDelOptions<T> options;
+            /** Guarded by takeLock */
+            CoDel codel;
+        };
+
+        /** Load shedding mode, null unless the queue was given CoDelOptions */
+        std::unique_ptr<Shedding> shedding_;
+
+        /** Byte bound, null unless the queue was given a ByteBudget */
+        std::unique_ptr<ByteBudget<T>> budget_;
+
+        /** Accounted size of the queued elements, in byte budget mode */
+        std::atomic<std::size_t> bytes_{0};
+
+        /** Set by a put waiting for bytes, cleared by the take that wakes it */
+        std::atomic<bool> bytesWaiting_{false};
+
+        /** Number and accounted size of the linked elements, in spill mode */
+        std::atomic<int> memoryCount_;
+        std::atomic<std::size_t> memoryBytes_;
+
+#ifdef JAVATHREAD_COROUTINES
+        /** Suspended coroutines, guarded by takeLock and putLock */
+        AsyncWaitQueue<std::shared_ptr<T>> asyncTakes_;
+        AsyncWaitQueue<std::unique_ptr<Node>> asyncPuts_;
+#endif
 
         private:
-            void enqueue( std::unique_ptr<T> pnode);
+            void enqueue(std::unique_ptr<Node> pnode);
             std::shared_ptr<T> dequeue();
+            bool wakesBatch(int c) const;
+            std::shared_ptr<T> dequeueManaged(int &removed, std::vector<std::shared_ptr<T>> &shed);
+            void dropShed(std::vector<std::shared_ptr<T>> &shed);
+            void insert(std::unique_ptr<Node> pnode);
+            bool fitsInMemory(std::size_t bytes) const;
+            void measure(Node &node) const;
+            bool fitsBudget(std::size_t bytes) const;
+            bool admits(std::size_t bytes);
+            bool bytesFreed();
+            void signalNotEmpty();
+            void signalNotFull();
+            void signalWaiters(bool notEmpty, bool notFull);
 };
 
-template<typename T>
-LinkedBlockingQueue<T>::LinkedBlockingQueue(int capacity = std::numeric_limits<int>::max() ):
-    capacity_(capacity), 
+template<typename T, typename Lock>
+LinkedBlockingQueue<T, Lock>::LinkedBlockingQueue(int capacity):
+    capacity_(capacity),
     count_(0),
     head_(new Node()),
-    tail_(head_.get())
+    tail_(head_.get()),
+    memoryCount_(0),
+    memoryBytes_(0)
+{
+
+}
+
+template<typename T, typename Lock>
+LinkedBlockingQueue<T, Lock>::LinkedBlockingQueue(int capacity, SpillOptions<T> spill):
+    LinkedBlockingQueue(capacity)
+{
+    completeSpillOptions(spill);
+    spill_.reset(new Spill(std::move(spill)));
+}
+
+template<typename T, typename Lock>
+LinkedBlockingQueue<T, Lock>::LinkedBlockingQueue(int capacity, CoDelOptions<T> codel):
+    LinkedBlockingQueue(capacity)
+{
+    shedding_.reset(new Shedding(std::move(codel)));
+}
+
+template<typename T, typename Lock>
+LinkedBlockingQueue<T, Lock>::LinkedBlockingQueue(int capacity, ByteBudget<T> budget):
+    LinkedBlockingQueue(capacity)
 {
+    if(!budget.sizeOf)
+        budget.sizeOf = [](const T&){ return sizeof(T); };
+    budget_.reset(new ByteBudget<T>(std::move(budget)));
+}
 
+template<typename T, typename Lock>
+LinkedBlockingQueue<T, Lock>::~LinkedBlockingQueue()
+{
+    /* Unlink nodes one by one, a long chain of unique_ptr would
+     * otherwise be destroyed recursively. */
+    while(head_->next)
+        head_->next = std::move((head_->next)->next);
 }
 
-/* Inserts the specified element into this queue, 
- * waiting if necessary for space to become available. 
+/**
+ * Signals a waiting take. Called only from put/offer (which do not
+ * otherwise ordinarily lock takeLock.)
  */
-template<typename T>
-void LinkedBlockingQueue<T>::put(T new_value)
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::signalNotEmpty()
+{
+#ifdef JAVATHREAD_COROUTINES
+    signalWaiters(true, false);
+#else
+    std::lock_guard<Lock> takeLock(headMutex_);
+    notEmpty_.notify_one();
+    if(lingerers_ > 0)
+        batchReady_.notify_all();
+#endif
+}
+
+/**
+ * Signals a waiting put, or all of them in byte budget mode, where the
+ * one woken might not fit while another would. Called only from
+ * take/poll.
+ */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::signalNotFull()
+{
+#ifdef JAVATHREAD_COROUTINES
+    signalWaiters(false, true);
+#else
+    std::lock_guard<Lock> putLock(tailMutex_);
+    if(budget_)
+        notFull_.notify_all();
+    else
+        notFull_.notify_one();
+#endif
+}
+
+/**
+ * Signals a waiting take and/or put, and serves suspended coroutines
+ * on the way: takes while there are elements, puts while there is
+ * room. Serving one side may enable the other, which is then signalled
+ * in turn, iteratively rather than by nested calls so that neither lock
+ * is held while taking the other. The served coroutines are resumed
+ * once both locks are released.
+ */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::signalWaiters(bool notEmpty, bool notFull)
+{
+#ifdef JAVATHREAD_COROUTINES
+    AsyncReadyList ready;
+    bool inserted = false;
+    while(notEmpty || notFull)
+    {
+        if(notEmpty)
+        {
+            notEmpty = false;
+            std::lock_guard<Lock> takeLock(headMutex_);
+            notEmpty_.notify_one();
+            if(lingerers_ > 0)
+                batchReady_.notify_all();
+            while(count_.load() > 0 && !asyncTakes_.empty())
+            {
+                AsyncWaiter<std::shared_ptr<T>> *waiter = asyncTakes_.pop();
+                waiter->payload = dequeue();
+                if(count_.fetch_sub(1) == capacity_ || bytesFreed())
+                    notFull = true;
+                ready.push(waiter);
+            }
+        }
+        if(notFull)
+        {
+            notFull = false;
+            std::lock_guard<Lock> putLock(tailMutex_);
+            if(budget_)
+                notFull_.notify_all();
+            else
+                notFull_.notify_one();
+            while(count_.load() < capacity_ && !asyncPuts_.empty() &&
+                  admits(asyncPuts_.front()->payload->bytes))
+            {
+                AsyncWaiter<std::unique_ptr<Node>> *waiter = asyncPuts_.pop();
+                insert(std::move(waiter->payload));
+                int c = count_.fetch_add(1);
+                stats_.recordPut(c + 1);
+                if(c == 0 || wakesBatch(c))
+                    notEmpty = true;
+                inserted = true;
+                ready.push(waiter);
+            }
+        }
+    }
+    if(inserted)
+        selectWaiters_.signalAll();
+    ready.resumeAll();
+#else
+    if(notEmpty)
+        signalNotEmpty();
+    if(notFull)
+        signalNotFull();
+#endif
+}
+
+/* Inserts the specified element into this queue,
+ * waiting if necessary for space to become available.
+ */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::put(T new_value)
 {
+    emplace(std::move(new_value));
+}
 
+template<typename T, typename Lock>
+template<typename... Args>
+void LinkedBlockingQueue<T, Lock>::emplace(Args&&... args)
+{
+    std::unique_ptr<Node> pnode(new Node(std::make_shared<T>(std::forward<Args>(args)...)));
+    measure(*pnode);
+    const std::size_t bytes = pnode->bytes;
+    std::unique_lock<Lock> putLock(tailMutex_, std::defer_lock);
+    stats_.lock(putLock);
 
-    std::unique_ptr<Node> pnode(new Node(new_value));
-    std::unique_lock<std::mutex> putLcok(tailMutex_);
-    
      /*
     * Note that count is used in wait guard even though it is
     * not protected by lock. This works because count can
@@ -125,131 +591,493 @@ void LinkedBlockingQueue<T>::put(T new_value)
     * signalled if it ever changes from capacity. Similarly
     * for all other uses of count in other wait guards.
     */
-    
-    notFull.wait(putLcok, [this]{ return count_.load() < capacity_; });
-    enqueue(std::move(pnode));
+
+    stats_.awaitPut(notFull_, putLock, [this, bytes]{
+        return count_.load() < capacity_ && admits(bytes);
+    });
+    insert(std::move(pnode));
 
     int c = count_.fetch_add(1);
+    stats_.recordPut(c + 1);
     if(c + 1 < capacity_)
         notFull_.notify_one();
-    putLcok.unlock();
-    if(c == 0)
-        notEmpty_.notify_one();
+    putLock.unlock();
+    if(c == 0 || wakesBatch(c))
+        signalNotEmpty();
+    selectWaiters_.signalAll();
 
 }
 
-template<typename T>
-bool LinkedBlockingQueue<T>::offer(T new_value)
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::offer(T new_value)
 {
-    std::unique_ptr<Node> pnode(new Node(new_value));
-    std::lock_guard<std::mutex> putLcok(tailMutex_);
-    if(count_.load() == capacity_)
+    std::unique_ptr<Node> pnode(new Node(std::make_shared<T>(std::move(new_value))));
+    measure(*pnode);
+    std::unique_lock<Lock> putLock(tailMutex_, std::defer_lock);
+    stats_.lock(putLock);
+    if(count_.load() == capacity_ || (budget_ && !fitsBudget(pnode->bytes)))
         return false;
-    enqueue(std::move(pnode));
-    
+    insert(std::move(pnode));
+
     int c = count_.fetch_add(1);
+    stats_.recordPut(c + 1);
     if(c + 1 < capacity_)
         notFull_.notify_one();
-    putLcok.unlock();
-    if(c == 0)
-        notEmpty_.notify_one();
+    putLock.unlock();
+    if(c == 0 || wakesBatch(c))
+        signalNotEmpty();
+    selectWaiters_.signalAll();
 
     return true;
 
 }
 
 
-template<typename T>
-void LinkedBlockingQueue<T>::enqueue( std::unique_ptr<T> pnode)
+/* Sets the accounted size of a new node in byte budget mode. */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::measure(Node &node) const
 {
-    tail->next = std::move(pnode);
-    tail = (tail->next).get();
+    if(budget_)
+        node.bytes = budget_->sizeOf(*node.item);
 }
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingQueue<T>::poll()
+/* True if an element of the given size fits in the byte budget now. */
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::fitsBudget(std::size_t bytes) const
+{
+    const std::size_t used = bytes_.load();
+    return used == 0 || used + bytes <= budget_->maxBytes;
+}
+
+/*
+ * The byte part of the put wait guard: true if the element fits, or
+ * if no budget is set. Otherwise announces the waiting put before
+ * checking again, so that a take freeing bytes meanwhile either is
+ * seen here or sees the flag. Call only when holding putLock.
+ */
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::admits(std::size_t bytes)
 {
-    std::unique_lock<std::mutex> putLock(headMutex_);
+    if(!budget_ || fitsBudget(bytes))
+        return true;
+    bytesWaiting_.store(true);
+    return fitsBudget(bytes);
+}
+
+/*
+ * Called by takes after they subtracted from bytes_: true if a put
+ * waits for bytes and has to be signalled.
+ */
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::bytesFreed()
+{
+    return budget_ && bytesWaiting_.load() && bytesWaiting_.exchange(false);
+}
+
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::fitsInMemory(std::size_t bytes) const
+{
+    const SpillOptions<T> &options = spill_->options;
+    return memoryCount_.load() < options.memoryElements &&
+           (options.memoryBytes == 0 || memoryBytes_.load() + bytes <= options.memoryBytes);
+}
+
+/**
+ * Links node at end of queue, or spills its element if the queue is in
+ * overflow mode and over budget. Call only when holding putLock.
+ */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::insert(std::unique_ptr<Node> pnode)
+{
+    if(!spill_)
+    {
+        if(shedding_)
+            pnode->enqueued = std::chrono::steady_clock::now();
+        if(budget_)
+            bytes_.fetch_add(pnode->bytes);
+        enqueue(std::move(pnode));
+        return;
+    }
+    Spill &spill = *spill_;
+    std::size_t bytes = spill.options.sizeOf(*pnode->item);
+    if(spill.spilling.load() || !fitsInMemory(bytes))
+    {
+        std::lock_guard<Lock> spillLock(spill.mutex);
+        /* a take may have drained the store since, in which case
+         * nothing is linked and the element can go to memory again */
+        if(spill.spilling.load() || !fitsInMemory(bytes))
+        {
+            spill.options.encode(*pnode->item, spill.buffer);
+            spill.store.append(spill.buffer.data(), spill.buffer.size());
+            spill.spilling.store(true);
+            return;
+        }
+    }
+    pnode->bytes = bytes;
+    enqueue(std::move(pnode));
+    memoryBytes_.fetch_add(bytes);
+    memoryCount_.fetch_add(1);
+}
+
+/**
+ * Links node at end of queue.
+ */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::enqueue(std::unique_ptr<Node> pnode)
+{
+    tail_->next = std::move(pnode);
+    tail_ = (tail_->next).get();
+}
+
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingQueue<T, Lock>::poll()
+{
+    std::unique_lock<Lock> takeLock(headMutex_, std::defer_lock);
+    stats_.lock(takeLock);
     if(count_.load() == 0)
+    {
+        if(shedding_)
+            shedding_->codel.onEmpty();
         return std::shared_ptr<T>(); //return nullptr;
-    std::shared_ptr<T> res = dequeue();
-    int c = count_.fetch_sub(1);
-    if(c > 1)
+    }
+    std::vector<std::shared_ptr<T>> shed;
+    int n = 1;
+    std::shared_ptr<T> res = shedding_ ? dequeueManaged(n, shed) : dequeue();
+    int c = count_.fetch_sub(n);
+    if(c > n)
         notEmpty_.notify_one();
-    putLock.unlock();
-    if(c == capacity_)
-        notFull_.notify_one();
+    takeLock.unlock();
+    if(c == capacity_ || bytesFreed())
+        signalNotFull();
+    dropShed(shed);
     return res;
 }
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingQueue<T>::take()
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingQueue<T, Lock>::take()
 {
-    std::lock_guard<std::mutex> putLock(headMutex_);
-    notEmpty_.wait(headLock, [this]{ count_.load() > 0; });
-    std::shared_ptr<T> res = dequeue();
-    
-    int c = count_.fetch_sub(1);
-    if(c > 1)
+    std::unique_lock<Lock> takeLock(headMutex_, std::defer_lock);
+    stats_.lock(takeLock);
+    if(shedding_ && count_.load() == 0)
+        shedding_->codel.onEmpty();
+    stats_.awaitTake(notEmpty_, takeLock, [this]{ return count_.load() > 0; });
+    std::vector<std::shared_ptr<T>> shed;
+    int n = 1;
+    std::shared_ptr<T> res = shedding_ ? dequeueManaged(n, shed) : dequeue();
+
+    int c = count_.fetch_sub(n);
+    if(c > n)
         notEmpty_.notify_one();
-    putLock.unlock();
-    if(c == capacity_)
-        notFull_.notify_one();
+    takeLock.unlock();
+    if(c == capacity_ || bytesFreed())
+        signalNotFull();
+    dropShed(shed);
     return res;
 }
 
+/**
+ * Takes the head element past the CoDel controller, moving the elements
+ * it sheds into shed, and sets removed to the number of elements taken
+ * off. The controller keeps the last element, so this always returns
+ * one. Call only when holding takeLock, with count_ > 0.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingQueue<T, Lock>::dequeueManaged(int &removed, std::vector<std::shared_ptr<T>> &shed)
+{
+    const auto now = std::chrono::steady_clock::now();
+    /* count_ only grows meanwhile, so this is a lower bound */
+    const int available = count_.load();
+    removed = 0;
+    for(;;)
+    {
+        const bool last = available - removed == 1;
+        const bool drop = shedding_->codel.shouldDrop(now, now - head_->next->enqueued, last);
+        std::shared_ptr<T> res = dequeue();
+        ++removed;
+        if(!drop)
+            return res;
+        shed.push_back(std::move(res));
+    }
+}
 
-template<typename T>
-std::shared_ptr<T> LinkedBlockingQueue<T>::dequeue()
+/* Hands shed elements to onDrop; called after releasing takeLock. */
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::dropShed(std::vector<std::shared_ptr<T>> &shed)
 {
-    std::shared_ptr<T> const res((head_->next)->item);
-    head_->next = std::move((head_->next)->next);    
+    if(shed.empty() || !shedding_->options.onDrop)
+        return;
+    for(auto &item : shed)
+        shedding_->options.onDrop(std::move(item));
+}
+
+/**
+ * True if the put that found count c brought count_ to what a lingering
+ * batch take waits for.
+ */
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::wakesBatch(int c) const
+{
+    return c + 1 == lingerTarget_.load();
+}
+
+template<typename T, typename Lock>
+template<typename Rep, typename Period>
+typename LinkedBlockingQueue<T, Lock>::Batch
+LinkedBlockingQueue<T, Lock>::takeBatch(int max, const std::chrono::duration<Rep, Period> &linger)
+{
+    if(max < 1)
+        throw std::invalid_argument("LinkedBlockingQueue::takeBatch: max must be at least 1");
+    const int target = std::min(max, capacity_);
+    std::unique_lock<Lock> takeLock(headMutex_, std::defer_lock);
+    stats_.lock(takeLock);
+    bool lingered = target <= 1 || linger <= linger.zero();
+    for(;;)
+    {
+        stats_.awaitTake(notEmpty_, takeLock, [this]{ return count_.load() > 0; });
+        if(lingered || count_.load() >= target)
+            break;
+        /* other takes may run meanwhile and leave nothing, hence the loop */
+        lingered = true;
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::ceil<std::chrono::steady_clock::duration>(linger);
+        ++lingerers_;
+        if(target < lingerTarget_.load())
+            lingerTarget_.store(target);
+        batchReady_.wait_until(takeLock, deadline, [&]{ return count_.load() >= target; });
+        if(--lingerers_ == 0)
+            lingerTarget_.store(std::numeric_limits<int>::max());
+    }
+
+    const int n = std::min(max, count_.load());
+    Batch batch;
+    std::unique_ptr<Node> chain;
+    Node *last = nullptr;
+    std::shared_ptr<T> lastItem;
+    if(spill_)
+    {
+        for(int i = 0; i < n; ++i)
+            batch.append(dequeue());
+    }
+    else
+    {
+        /* the n-th node becomes the new dummy head, as in dequeue() */
+        last = head_.get();
+        std::size_t bytes = last->next->bytes;
+        for(int i = 1; i < n; ++i)
+        {
+            last = last->next.get();
+            bytes += last->next->bytes;
+        }
+        if(budget_)
+            bytes_.fetch_sub(bytes);
+        chain = std::move(head_);
+        head_ = std::move(last->next);
+        lastItem = std::move(head_->item);
+        for(int i = 0; i < n; ++i)
+            stats_.recordTake();
+    }
+    int c = count_.fetch_sub(n);
+    if(c > n)
+        notEmpty_.notify_one();
+    takeLock.unlock();
+    if(c == capacity_ || bytesFreed())
+        signalNotFull();
+    if(chain)
+        return Batch(std::move(chain), last, std::move(lastItem), n);
+    return batch;
+}
+
+/**
+ * Removes a node from head of queue.
+ * The first real node becomes the new dummy head, so that tail_ never
+ * points to a freed node while a put is running concurrently.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> LinkedBlockingQueue<T, Lock>::dequeue()
+{
+    if(spill_)
+    {
+        if(memoryCount_.load() == 0)
+        {
+            Spill &spill = *spill_;
+            std::lock_guard<Lock> spillLock(spill.mutex);
+            spill.store.readNext(spill.buffer);
+            if(spill.store.empty())
+                spill.spilling.store(false);
+            stats_.recordTake();
+            return std::make_shared<T>(spill.options.decode(spill.buffer.data(), spill.buffer.size()));
+        }
+        memoryBytes_.fetch_sub(head_->next->bytes);
+        memoryCount_.fetch_sub(1);
+    }
+    else if(budget_)
+        bytes_.fetch_sub(head_->next->bytes);
+    std::unique_ptr<Node> h = std::move(head_);
+    head_ = std::move(h->next);
+    std::shared_ptr<T> res = std::move(head_->item);
+    stats_.recordTake();
     return res;
 }
 
 
 
-template<typename T>
-bool LinkedBlockingQueue<T>::empty() const
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::empty() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
     return count_.load() == 0;
 }
 
 
-template<typename T>
-int LinkedBlockingQueue<T>::size() const
+template<typename T, typename Lock>
+int LinkedBlockingQueue<T, Lock>::size() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
     return count_.load();
 }
 
-template<typename T>
-int LinkedBlockingQueue<T>::capacity() const
+template<typename T, typename Lock>
+int LinkedBlockingQueue<T, Lock>::capacity() const
 {
-    std::lock_guard<std::mutex> lk(mutex_);
     return capacity_;
 }
 
-template<typename T>
-void LinkedBlockingQueue<T>::clear()
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::clear()
 {
      /**
      * Locks to prevent both puts and takes.
      */
-    // std::lock_guard<std::mutex> putLock(tailMutex_); Bad
-    // std::lock_guard<std::mutex> takeLock(headMutex_); Bad
+    // std::lock_guard<Lock> putLock(tailMutex_); Bad
+    // std::lock_guard<Lock> takeLock(headMutex_); Bad
     // In C++17 std::scoped_lock guard(tailMutex_, headMutex_); Good
     // See:C++ Concurreny In Action 3.2.4 Deadlock: the problem and a solution
-    std::lock(tailMutex_, headMutex_);
-    std::lock_guard<std::mutex> putLock(tailMutex_, std::adopt_lock);
-    std::lock_guard<std::mutex> takeLock(headMutex_, std::adopt_lock);
-    while(head_->next)
+    bool wakePuts = false;
     {
-        ((head_->next)->item).reset();
-        head_->next = (head_->next)->next;
+        std::lock(tailMutex_, headMutex_);
+        std::lock_guard<Lock> putLock(tailMutex_, std::adopt_lock);
+        std::lock_guard<Lock> takeLock(headMutex_, std::adopt_lock);
+        while(head_->next)
+            head_->next = std::move((head_->next)->next);
+        tail_ = head_.get();
+        if(spill_)
+        {
+            std::lock_guard<Lock> spillLock(spill_->mutex);
+            spill_->store.clear();
+            spill_->spilling.store(false);
+            memoryCount_.store(0);
+            memoryBytes_.store(0);
+        }
+        if(count_.exchange(0) == capacity_)
+            wakePuts = true;
+        if(budget_)
+        {
+            bytes_.store(0);
+            if(bytesWaiting_.exchange(false))
+                wakePuts = true;
+            if(wakePuts)
+                notFull_.notify_all();
+        }
+        else if(wakePuts)
+            notFull_.notify_one();
     }
-    tail_ = head_.get();
-    if(count_.exchange(0) == capacity_)
+#ifdef JAVATHREAD_COROUTINES
+    /* suspended puts fit now */
+    if(wakePuts)
+        signalWaiters(false, true);
+#endif
+}
+
+/**
+ * Returns a snapshot of the runtime statistics. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot LinkedBlockingQueue<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
+
+template<typename T, typename Lock>
+int LinkedBlockingQueue<T, Lock>::spilled() const
+{
+    if(!spill_)
+        return 0;
+    std::lock_guard<Lock> spillLock(spill_->mutex);
+    return static_cast<int>(spill_->store.records());
+}
+
+template<typename T, typename Lock>
+std::size_t LinkedBlockingQueue<T, Lock>::bytes() const
+{
+    return bytes_.load();
+}
+
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::addSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.add(waiter);
+}
+
+template<typename T, typename Lock>
+void LinkedBlockingQueue<T, Lock>::removeSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.remove(waiter);
+}
+
+#ifdef JAVATHREAD_COROUTINES
+template<typename T, typename Lock>
+AsyncTake<T, LinkedBlockingQueue<T, Lock>> LinkedBlockingQueue<T, Lock>::asyncTake(Executor &executor)
+{
+    return AsyncTake<T, LinkedBlockingQueue>(*this, executor);
+}
+
+template<typename T, typename Lock>
+AsyncPut<std::unique_ptr<typename LinkedBlockingQueue<T, Lock>::Node>, LinkedBlockingQueue<T, Lock>>
+LinkedBlockingQueue<T, Lock>::asyncPut(T value, Executor &executor)
+{
+    std::unique_ptr<Node> pnode(new Node(std::make_shared<T>(std::move(value))));
+    measure(*pnode);
+    return AsyncPut<std::unique_ptr<Node>, LinkedBlockingQueue>(*this, std::move(pnode), executor);
+}
+
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::suspendTake(AsyncWaiter<std::shared_ptr<T>> &waiter)
+{
+    std::unique_lock<Lock> takeLock(headMutex_, std::defer_lock);
+    stats_.lock(takeLock);
+    if(count_.load() == 0)
+    {
+        asyncTakes_.push(&waiter);
+        return true;
+    }
+    waiter.payload = dequeue();
+    int c = count_.fetch_sub(1);
+    if(c > 1)
+        notEmpty_.notify_one();
+    takeLock.unlock();
+    if(c == capacity_ || bytesFreed())
+        signalNotFull();
+    return false;
+}
+
+template<typename T, typename Lock>
+bool LinkedBlockingQueue<T, Lock>::suspendPut(AsyncWaiter<std::unique_ptr<Node>> &waiter)
+{
+    std::unique_lock<Lock> putLock(tailMutex_, std::defer_lock);
+    stats_.lock(putLock);
+    if(count_.load() == capacity_ || !admits(waiter.payload->bytes))
+    {
+        asyncPuts_.push(&waiter);
+        return true;
+    }
+    insert(std::move(waiter.payload));
+    int c = count_.fetch_add(1);
+    stats_.recordPut(c + 1);
+    if(c + 1 < capacity_)
         notFull_.notify_one();
+    putLock.unlock();
+    if(c == 0 || wakesBatch(c))
+        signalNotEmpty();
+    selectWaiters_.signalAll();
+    return false;
 }
+#endif
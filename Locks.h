@@ -0,0 +1,274 @@
+# pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+/**
+ * Lock policies for the queue internals.
+ *
+ * <p>Every queue takes a {@code Lock} template parameter that defaults
+ * to {@code std::mutex}. Any type meeting the standard Lockable
+ * requirements (lock, try_lock, unlock) can be used; the spin locks
+ * below suit the very short critical sections of the queues, where
+ * parking a thread in the kernel costs more than the protected work.
+ *
+ * <p>Blocking operations wait on {@code ConditionVariableFor<Lock>}:
+ * the native condition_variable for std::mutex and
+ * condition_variable_any for everything else, which parks the waiting
+ * thread on its own internal mutex while the spin lock is released.
+ */
+
+template<typename Lock>
+using ConditionVariableFor = typename std::conditional<
+    std::is_same<Lock, std::mutex>::value,
+    std::condition_variable,
+    std::condition_variable_any>::type;
+
+/** Hints the CPU that the caller is spinning. */
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * Bounded exponential backoff. Spins for 1, 2, 4, ... pause
+ * instructions, and once the limit is reached yields the processor so
+ * that a preempted lock holder can make progress.
+ */
+class Backoff
+{
+    public:
+        explicit Backoff(int limit = 1024): spins_(1), limit_(limit) {}
+        void pause()
+        {
+            if(spins_ <= limit_)
+            {
+                for(int i = 0; i < spins_; ++i)
+                    cpuRelax();
+                spins_ <<= 1;
+            }
+            else
+                std::this_thread::yield();
+        }
+        void reset() { spins_ = 1; }
+    private:
+        int spins_;
+        const int limit_;
+};
+
+/**
+ * Test-and-test-and-set spin lock with exponential backoff. Waiters
+ * spin on a plain load, so the cache line is only written when the
+ * lock looks free.
+ */
+class SpinLock
+{
+    public:
+        SpinLock() = default;
+        SpinLock(const SpinLock&) = delete;
+        SpinLock& operator=(const SpinLock&) = delete;
+
+        void lock()
+        {
+            Backoff backoff;
+            for(;;)
+            {
+                if(!locked_.exchange(true, std::memory_order_acquire))
+                    return;
+                while(locked_.load(std::memory_order_relaxed))
+                    backoff.pause();
+            }
+        }
+
+        bool try_lock()
+        {
+            return !locked_.load(std::memory_order_relaxed) &&
+                   !locked_.exchange(true, std::memory_order_acquire);
+        }
+
+        void unlock()
+        {
+            locked_.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<bool> locked_{false};
+};
+
+/**
+ * FIFO ticket lock. Each acquirer draws a ticket and waits until it is
+ * served; the backoff is proportional to the number of threads ahead.
+ * A waiter that keeps spinning yields instead, since with more threads
+ * than cores the thread to be served next may itself be preempted.
+ */
+class TicketLock
+{
+    public:
+        TicketLock() = default;
+        TicketLock(const TicketLock&) = delete;
+        TicketLock& operator=(const TicketLock&) = delete;
+
+        void lock()
+        {
+            const std::uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+            for(int rounds = 0; ; ++rounds)
+            {
+                std::uint32_t serving = serving_.load(std::memory_order_acquire);
+                if(serving == ticket)
+                    return;
+                std::uint32_t ahead = ticket - serving;
+                if(ahead > 4 || rounds > kSpinRounds)
+                    std::this_thread::yield();
+                else
+                    for(std::uint32_t i = 0; i < ahead * 32; ++i)
+                        cpuRelax();
+            }
+        }
+
+        bool try_lock()
+        {
+            std::uint32_t serving = serving_.load(std::memory_order_acquire);
+            std::uint32_t expected = serving;
+            return next_.compare_exchange_strong(expected, serving + 1, std::memory_order_acquire,
+                                                 std::memory_order_relaxed);
+        }
+
+        void unlock()
+        {
+            serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        static const int kSpinRounds = 64;
+
+        std::atomic<std::uint32_t> next_{0};
+        std::atomic<std::uint32_t> serving_{0};
+};
+
+/**
+ * Mellor-Crummey and Scott queue lock. Waiters form a linked queue and
+ * each one spins on a flag in its own node, so a release touches only
+ * the successor's cache line.
+ *
+ * <p>The Lockable interface has no room for the caller's queue node,
+ * so nodes come from a small per-thread free list and the holder keeps
+ * its node in {@code owner_}, which only the holder reads or writes. A
+ * node is back on the free list as soon as unlock has handed the lock
+ * over, so a thread can hold several MCS locks at once.
+ */
+class MCSLock
+{
+    public:
+        MCSLock() = default;
+        MCSLock(const MCSLock&) = delete;
+        MCSLock& operator=(const MCSLock&) = delete;
+
+        void lock()
+        {
+            Node *node = acquireNode();
+            Node *pred = tail_.exchange(node, std::memory_order_acq_rel);
+            if(pred != nullptr)
+            {
+                node->locked.store(true, std::memory_order_relaxed);
+                pred->next.store(node, std::memory_order_release);
+                Backoff backoff(64);
+                while(node->locked.load(std::memory_order_acquire))
+                    backoff.pause();
+            }
+            owner_ = node;
+        }
+
+        bool try_lock()
+        {
+            Node *node = acquireNode();
+            Node *expected = nullptr;
+            if(tail_.compare_exchange_strong(expected, node, std::memory_order_acquire,
+                                             std::memory_order_relaxed))
+            {
+                owner_ = node;
+                return true;
+            }
+            releaseNode(node);
+            return false;
+        }
+
+        void unlock()
+        {
+            Node *node = owner_;
+            Node *succ = node->next.load(std::memory_order_acquire);
+            if(succ == nullptr)
+            {
+                Node *expected = node;
+                if(tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+                                                 std::memory_order_relaxed))
+                {
+                    releaseNode(node);
+                    return;
+                }
+                /* a successor swapped itself in but has not linked yet */
+                while((succ = node->next.load(std::memory_order_acquire)) == nullptr)
+                    cpuRelax();
+            }
+            succ->locked.store(false, std::memory_order_release);
+            releaseNode(node);
+        }
+
+    private:
+        struct alignas(64) Node
+        {
+            std::atomic<Node*> next{nullptr};
+            std::atomic<bool> locked{false};
+            Node *free = nullptr;
+        };
+
+        struct NodePool
+        {
+            Node *head = nullptr;
+            ~NodePool()
+            {
+                while(head != nullptr)
+                {
+                    Node *n = head;
+                    head = n->free;
+                    delete n;
+                }
+            }
+        };
+
+        static NodePool &pool()
+        {
+            thread_local NodePool pool;
+            return pool;
+        }
+
+        static Node *acquireNode()
+        {
+            NodePool &p = pool();
+            Node *node = p.head;
+            if(node == nullptr)
+                node = new Node();
+            else
+                p.head = node->free;
+            node->next.store(nullptr, std::memory_order_relaxed);
+            return node;
+        }
+
+        static void releaseNode(Node *node)
+        {
+            NodePool &p = pool();
+            node->free = p.head;
+            p.head = node;
+        }
+
+        std::atomic<Node*> tail_{nullptr};
+
+        /** Queue node of the current holder, accessed only by the holder */
+        Node *owner_ = nullptr;
+};
@@ -0,0 +1,326 @@
+# pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+/**
+ * The striping machinery behind LongAdder and LongAccumulator, after
+ * Java's Striped64.
+ *
+ * <p>Values are folded into a base word with CAS as long as that CAS
+ * keeps succeeding. The first failed CAS shows that threads contend
+ * for the line, and from then on a table of cells takes the updates.
+ * Each cell is a cache line of its own, and threads are assigned to
+ * cells by a per-thread hash, the probe. A thread whose CAS on its cell
+ * fails moves to another cell by rehashing its probe; if it collides
+ * again, the table doubles, up to the smallest power of two not below
+ * the number of hardware threads. Cells are created only when a thread
+ * first lands on an empty slot. Contended updates thus end up on a
+ * line that is, most of the time, used by one core alone.
+ *
+ * <p>The table is allocated at its largest size up front; only its used
+ * width grows, so readers never see it move. Table changes are guarded
+ * by a try-lock. A thread that finds it taken does not wait but
+ * rehashes and tries elsewhere.
+ *
+ * <p>Op must be associative and commutative, and identity must be its
+ * neutral element.
+ */
+template<typename Op>
+class Striped64
+{
+    public:
+        Striped64(const Striped64&) = delete;
+        Striped64& operator=(const Striped64&) = delete;
+
+    protected:
+        Striped64(Op op, std::int64_t identity);
+        ~Striped64();
+
+        /** Folds x into the value. */
+        void update(std::int64_t x);
+        /** The base folded with every cell; not an atomic snapshot. */
+        std::int64_t fold() const;
+        /** Sets the base and every cell back to identity. */
+        void reset();
+        /** fold() and reset() in one pass, each word read and reset by one exchange. */
+        std::int64_t foldThenReset();
+
+    private:
+        struct alignas(64) Cell
+        {
+            explicit Cell(std::int64_t v): value(v) {}
+            std::atomic<std::int64_t> value;
+        };
+
+        static std::uint32_t &probe();
+        static std::uint32_t rehash(std::uint32_t h);
+        bool tryLock();
+        void unlock() { busy_.store(false, std::memory_order_release); }
+        void updateContended(std::int64_t x, bool wasUncontended);
+
+        const Op op_;
+        const std::int64_t identity_;
+        alignas(64) std::atomic<std::int64_t> base_;
+        /** Used width of the table: 0 until the first contention, then a power of two */
+        std::atomic<int> width_{0};
+        std::atomic<bool> busy_{false};
+        const int maxWidth_;
+        std::unique_ptr<std::atomic<Cell*>[]> cells_;
+};
+
+template<typename Op>
+Striped64<Op>::Striped64(Op op, std::int64_t identity):
+    op_(op), identity_(identity), base_(identity),
+    maxWidth_([]{
+        int n = 1;
+        while(n < static_cast<int>(std::thread::hardware_concurrency()))
+            n <<= 1;
+        return n;
+    }()),
+    cells_(new std::atomic<Cell*>[maxWidth_])
+{
+    for(int i = 0; i < maxWidth_; ++i)
+        cells_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+template<typename Op>
+Striped64<Op>::~Striped64()
+{
+    for(int i = 0; i < maxWidth_; ++i)
+        delete cells_[i].load(std::memory_order_relaxed);
+}
+
+/*
+ * The calling thread's hash, shared by all instances like Java's
+ * thread probe. It is never zero, which xorshift needs.
+ */
+template<typename Op>
+std::uint32_t &Striped64<Op>::probe()
+{
+    thread_local std::uint32_t h = static_cast<std::uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    return h;
+}
+
+template<typename Op>
+std::uint32_t Striped64<Op>::rehash(std::uint32_t h)
+{
+    h ^= h << 13;
+    h ^= h >> 17;
+    h ^= h << 5;
+    return h;
+}
+
+template<typename Op>
+bool Striped64<Op>::tryLock()
+{
+    return !busy_.load(std::memory_order_relaxed) &&
+           !busy_.exchange(true, std::memory_order_acquire);
+}
+
+/*
+ * The fast path: one CAS on the base while there are no cells, or on
+ * the thread's cell once there are.
+ */
+template<typename Op>
+inline void Striped64<Op>::update(std::int64_t x)
+{
+    const int width = width_.load(std::memory_order_acquire);
+    if(width == 0)
+    {
+        std::int64_t b = base_.load(std::memory_order_relaxed);
+        if(base_.compare_exchange_strong(b, op_(b, x), std::memory_order_relaxed))
+            return;
+        updateContended(x, true);
+        return;
+    }
+    Cell *cell = cells_[probe() & (width - 1)].load(std::memory_order_acquire);
+    if(cell != nullptr)
+    {
+        std::int64_t v = cell->value.load(std::memory_order_relaxed);
+        if(cell->value.compare_exchange_strong(v, op_(v, x), std::memory_order_relaxed))
+            return;
+        updateContended(x, false);
+        return;
+    }
+    updateContended(x, true);
+}
+
+/*
+ * The slow path of Java's longAccumulate(): create a missing cell,
+ * rehash after a failed cell CAS, double the table after two
+ * collisions in a row, and fall back to the base while another thread
+ * holds the table lock before the table exists.
+ */
+template<typename Op>
+void Striped64<Op>::updateContended(std::int64_t x, bool wasUncontended)
+{
+    std::uint32_t h = probe();
+    bool collide = false;
+    for(;;)
+    {
+        const int width = width_.load(std::memory_order_acquire);
+        if(width > 0)
+        {
+            std::atomic<Cell*> &slot = cells_[h & (width - 1)];
+            Cell *cell = slot.load(std::memory_order_acquire);
+            if(cell == nullptr)
+            {
+                if(tryLock())
+                {
+                    bool created = false;
+                    if(slot.load(std::memory_order_relaxed) == nullptr)
+                    {
+                        slot.store(new Cell(op_(identity_, x)), std::memory_order_release);
+                        created = true;
+                    }
+                    unlock();
+                    if(created)
+                        break;
+                    continue;
+                }
+                collide = false;
+            }
+            else if(!wasUncontended)
+                wasUncontended = true;
+            else
+            {
+                std::int64_t v = cell->value.load(std::memory_order_relaxed);
+                if(cell->value.compare_exchange_strong(v, op_(v, x), std::memory_order_relaxed))
+                    break;
+                if(width >= maxWidth_)
+                    collide = false;
+                else if(!collide)
+                    collide = true;
+                else if(tryLock())
+                {
+                    if(width_.load(std::memory_order_relaxed) == width)
+                        width_.store(width * 2, std::memory_order_release);
+                    unlock();
+                    collide = false;
+                    continue;
+                }
+            }
+            h = rehash(h);
+        }
+        else if(tryLock())
+        {
+            bool created = false;
+            if(width_.load(std::memory_order_relaxed) == 0)
+            {
+                cells_[h & (std::min(2, maxWidth_) - 1)].store(new Cell(op_(identity_, x)),
+                                                              std::memory_order_release);
+                width_.store(std::min(2, maxWidth_), std::memory_order_release);
+                created = true;
+            }
+            unlock();
+            if(created)
+                break;
+        }
+        else
+        {
+            std::int64_t b = base_.load(std::memory_order_relaxed);
+            if(base_.compare_exchange_strong(b, op_(b, x), std::memory_order_relaxed))
+                break;
+        }
+    }
+    probe() = h;
+}
+
+template<typename Op>
+std::int64_t Striped64<Op>::fold() const
+{
+    std::int64_t result = base_.load(std::memory_order_relaxed);
+    const int width = width_.load(std::memory_order_acquire);
+    for(int i = 0; i < width; ++i)
+    {
+        Cell *cell = cells_[i].load(std::memory_order_acquire);
+        if(cell != nullptr)
+            result = op_(result, cell->value.load(std::memory_order_relaxed));
+    }
+    return result;
+}
+
+template<typename Op>
+void Striped64<Op>::reset()
+{
+    base_.store(identity_, std::memory_order_relaxed);
+    const int width = width_.load(std::memory_order_acquire);
+    for(int i = 0; i < width; ++i)
+    {
+        Cell *cell = cells_[i].load(std::memory_order_acquire);
+        if(cell != nullptr)
+            cell->value.store(identity_, std::memory_order_relaxed);
+    }
+}
+
+template<typename Op>
+std::int64_t Striped64<Op>::foldThenReset()
+{
+    std::int64_t result = base_.exchange(identity_, std::memory_order_relaxed);
+    const int width = width_.load(std::memory_order_acquire);
+    for(int i = 0; i < width; ++i)
+    {
+        Cell *cell = cells_[i].load(std::memory_order_acquire);
+        if(cell != nullptr)
+            result = op_(result, cell->value.exchange(identity_, std::memory_order_relaxed));
+    }
+    return result;
+}
+
+/**
+ * A sum kept as a base and a set of striped cells, after Java's
+ * LongAdder. Under contention increments go to a cell most likely used
+ * by the calling core alone, which makes a much contended counter far
+ * cheaper to update than a single atomic, at the price of a read that
+ * adds up the cells.
+ *
+ * <p>sum() is not an atomic snapshot: updates running concurrently may
+ * or may not be counted, but it is exact once updates are quiescent.
+ * Use it for statistics and the like, not where the count must gate
+ * something, as CountDownLatch's count or a queue's capacity does.
+ */
+class LongAdder : private Striped64<std::plus<std::int64_t>>
+{
+    public:
+        LongAdder(): Striped64(std::plus<std::int64_t>(), 0) {}
+
+        void add(std::int64_t x) { update(x); }
+        void increment() { update(1); }
+        void decrement() { update(-1); }
+
+        /** The current sum; cheap, but approximate while updates run. */
+        std::int64_t sum() const { return fold(); }
+        /** Sets the sum to zero; only exact while no updates run. */
+        void reset() { Striped64::reset(); }
+        /** Returns the sum and resets it, losing no concurrent update. */
+        std::int64_t sumThenReset() { return foldThenReset(); }
+};
+
+/**
+ * A value updated with a function, striped like LongAdder, after Java's
+ * LongAccumulator: {@code LongAccumulator<Max>(Max(), INT64_MIN)} keeps
+ * a running maximum. Op must be associative and commutative, and
+ * identity its neutral element; the order in which updates are
+ * combined is unspecified.
+ */
+template<typename Op>
+class LongAccumulator : private Striped64<Op>
+{
+    public:
+        LongAccumulator(Op op, std::int64_t identity): Striped64<Op>(op, identity) {}
+
+        /** Folds x into the value. */
+        void accumulate(std::int64_t x) { this->update(x); }
+
+        /** The current value; cheap, but approximate while updates run. */
+        std::int64_t get() const { return this->fold(); }
+        /** Sets the value back to identity; only exact while no updates run. */
+        void reset() { Striped64<Op>::reset(); }
+        /** Returns the value and resets it, losing no concurrent update. */
+        std::int64_t getThenReset() { return this->foldThenReset(); }
+};
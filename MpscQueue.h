@@ -0,0 +1,253 @@
+# pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include "ParkingLot.h"
+
+/**
+ * The link a message embeds to be queued in an MpscQueue: message types
+ * derive from it publicly. A message is in at most one queue at a time.
+ * Copying a message does not copy its link, so messages stay copyable.
+ */
+struct MpscNode
+{
+    MpscNode() {}
+    MpscNode(const MpscNode&) {}
+    MpscNode& operator=(const MpscNode&) { return *this; }
+
+    std::atomic<MpscNode*> next{nullptr};
+};
+
+/**
+ * An intrusive unbounded multi-producer single-consumer queue, after
+ * Dmitry Vyukov's node-based MPSC queue, for actor mailboxes.
+ *
+ * <p>The queue links the callers' messages through their MpscNode and
+ * owns none of them, so it never allocates. Producers append with a
+ * single exchange on head_ followed by a store linking the previous
+ * node to the new one, which makes push wait-free. The consumer
+ * unlinks from tail_ without atomic read-modify-writes; a stub node
+ * stays in the queue so that the last message can be handed out while
+ * producers go on appending. Between a producer's exchange and its link
+ * store the queue is momentarily cut: pop() then returns null although
+ * the queue is not empty, until the producer completes.
+ *
+ * <p>The consumer may mark the queue empty by setting the low bit of
+ * head_ (see markEmpty()). The next push takes the mark off with its
+ * exchange and returns true, so exactly one producer learns that the
+ * queue went from empty to non-empty and needs to wake the consumer;
+ * the others never touch the consumer's wait state. Mailbox builds a
+ * parking receiver on this.
+ *
+ * <p>push() may be called from any thread, pop() and markEmpty() only
+ * from one consumer thread at a time.
+ */
+template<typename T>
+class MpscQueue
+{
+    static_assert(std::is_base_of<MpscNode, T>::value, "T must derive from MpscNode");
+
+    public:
+        MpscQueue();
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        /**
+         * Appends message. Returns true if the consumer had marked the
+         * queue empty, i.e. this push is the one that must wake it.
+         */
+        bool push(T *message);
+
+        /**
+         * Unlinks and returns the oldest message, or null if the queue
+         * is empty or a push in progress has not linked its message yet.
+         */
+        T *pop();
+
+        /**
+         * After pop() returned null: marks the queue empty and returns
+         * true if it is, or returns false if a push is in progress.
+         */
+        bool markEmpty();
+
+        /** True while the queue is marked empty and no push has come since. */
+        bool markedEmpty() const { return (head_.load() & kEmptyMark) != 0; }
+
+    private:
+        static constexpr std::uintptr_t kEmptyMark = 1;
+
+        static MpscNode *unmark(std::uintptr_t head)
+        {
+            return reinterpret_cast<MpscNode*>(head & ~kEmptyMark);
+        }
+
+        std::uintptr_t exchangeHead(MpscNode *node);
+
+        /** The node last pushed, with kEmptyMark while marked empty */
+        alignas(64) std::atomic<std::uintptr_t> head_;
+        /** The oldest node still linked, the stub if nothing is queued; consumer only */
+        alignas(64) MpscNode *tail_;
+        MpscNode stub_;
+};
+
+template<typename T>
+MpscQueue<T>::MpscQueue():
+    head_(reinterpret_cast<std::uintptr_t>(&stub_)), tail_(&stub_)
+{
+}
+
+/*
+ * Swaps node in as the new head and links the old head to it. The
+ * exchange is sequentially consistent, as ParkingLot requires of the
+ * word a parked consumer waits on.
+ */
+template<typename T>
+std::uintptr_t MpscQueue<T>::exchangeHead(MpscNode *node)
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    std::uintptr_t prev = head_.exchange(reinterpret_cast<std::uintptr_t>(node));
+    unmark(prev)->next.store(node, std::memory_order_release);
+    return prev;
+}
+
+template<typename T>
+inline bool MpscQueue<T>::push(T *message)
+{
+    return (exchangeHead(message) & kEmptyMark) != 0;
+}
+
+/*
+ * Skips the stub if it is at the tail, and hands out the tail as long
+ * as it has a successor. The last message has none: it is handed out
+ * only after the stub has been pushed behind it, which is what keeps
+ * the queue non-empty for producers.
+ */
+template<typename T>
+T *MpscQueue<T>::pop()
+{
+    MpscNode *tail = tail_;
+    MpscNode *next = tail->next.load(std::memory_order_acquire);
+    if(tail == &stub_)
+    {
+        if(next == nullptr)
+            return nullptr;
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if(next != nullptr)
+    {
+        tail_ = next;
+        return static_cast<T*>(tail);
+    }
+    if(tail != unmark(head_.load(std::memory_order_acquire)))
+        return nullptr;
+    exchangeHead(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if(next == nullptr)
+        return nullptr;
+    tail_ = next;
+    return static_cast<T*>(tail);
+}
+
+/*
+ * The queue is empty when only the stub is left and head_ still points
+ * to it; the CAS fails if a producer has exchanged head_ meanwhile.
+ */
+template<typename T>
+bool MpscQueue<T>::markEmpty()
+{
+    if(tail_ != &stub_)
+        return false;
+    std::uintptr_t expected = reinterpret_cast<std::uintptr_t>(&stub_);
+    return head_.compare_exchange_strong(expected, expected | kEmptyMark) ||
+           expected == (reinterpret_cast<std::uintptr_t>(&stub_) | kEmptyMark);
+}
+
+/**
+ * An actor mailbox: an MpscQueue with a receiver that parks when it
+ * runs out of messages.
+ *
+ * <p>send() is a push and nothing more unless the receiver has marked
+ * the queue empty before parking, in which case the one send that
+ * finds the mark unparks it. A receiver facing a busy mailbox thus
+ * never makes senders touch a lock or a condition variable, and a send
+ * costs one exchange and no allocation.
+ *
+ * <p>The receiver spins and then parks on the ParkingLot, keyed by the
+ * mailbox. send() may be called from any thread; the receive methods
+ * from one thread at a time.
+ */
+template<typename T>
+class Mailbox
+{
+    public:
+        Mailbox() {}
+        Mailbox(const Mailbox&) = delete;
+        Mailbox& operator=(const Mailbox&) = delete;
+
+        /** Queues message, waking the receiver if it waits for one. */
+        void send(T *message)
+        {
+            if(queue_.push(message))
+                ParkingLot::unparkAll(this);
+        }
+
+        /** The next message, or null if there is none right now. */
+        T *tryReceive() { return queue_.pop(); }
+
+        /** The next message, waiting for one if necessary. */
+        T *receive();
+
+        /** As receive(), returning null if none came by the deadline. */
+        T *receiveUntil(std::chrono::steady_clock::time_point deadline);
+
+        template<typename Rep, typename Period>
+        T *receiveFor(const std::chrono::duration<Rep, Period> &timeout)
+        {
+            return receiveUntil(std::chrono::steady_clock::now() + timeout);
+        }
+
+    private:
+        MpscQueue<T> queue_;
+};
+
+/*
+ * A null pop with the mark refused means a sender is between its
+ * exchange and its link store; it finishes in a few instructions
+ * unless preempted, so yield rather than park.
+ */
+template<typename T>
+T *Mailbox<T>::receive()
+{
+    for(;;)
+    {
+        if(T *message = queue_.pop())
+            return message;
+        if(queue_.markEmpty())
+            ParkingLot::parkWhile(this, [this]{ return queue_.markedEmpty(); });
+        else
+            std::this_thread::yield();
+    }
+}
+
+template<typename T>
+T *Mailbox<T>::receiveUntil(std::chrono::steady_clock::time_point deadline)
+{
+    for(;;)
+    {
+        if(T *message = queue_.pop())
+            return message;
+        if(queue_.markEmpty())
+        {
+            if(!ParkingLot::parkUntil(this, [this]{ return queue_.markedEmpty(); }, deadline))
+                return nullptr;
+        }
+        else if(std::chrono::steady_clock::now() >= deadline)
+            return nullptr;
+        else
+            std::this_thread::yield();
+    }
+}
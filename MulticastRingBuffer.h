@@ -0,0 +1,400 @@
+# pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "Locks.h"
+#include "QueueStats.h"
+#include "RawArray.h"
+
+/**
+ * A bounded ring whose every element is delivered to several consumer
+ * groups, in the manner of the LMAX Disruptor.
+ *
+ * <p>Elements are numbered by a 64 bit sequence. There is one write
+ * cursor and one read cursor per group; a group sees every element in
+ * sequence order, and all groups read the same slot of the ring, so an
+ * element is written once and never copied. A group may depend on
+ * other groups, in which case it only sees an element after all of
+ * them have committed it. The producer is gated by the slowest group:
+ * a slot is reused only when every group has moved past it, at which
+ * point its element is destroyed.
+ *
+ * <pre>
+ *   MulticastRingBuffer&lt;Event&gt; ring(1024);
+ *   int journal = ring.addGroup();
+ *   int replicate = ring.addGroup();
+ *   int logic = ring.addGroup({ journal, replicate });
+ *
+ *   // producer
+ *   std::int64_t seq = ring.claim();
+ *   fill(ring.at(seq));
+ *   ring.publish(seq);
+ *
+ *   // consumer of one group
+ *   std::int64_t next = ring.cursor(logic);
+ *   for(;;)
+ *   {
+ *       std::int64_t end = ring.waitFor(logic);
+ *       for(; next &lt; end; ++next)
+ *           handle(ring.get(next));
+ *       ring.commit(logic, end);
+ *   }
+ * </pre>
+ *
+ * <p>Each group is read by a single thread. Producers may be many;
+ * sequences become visible in claim order. Groups must be added before
+ * the first element is claimed. The lock is held only to move the
+ * cursors, never while an element is filled or read.
+ */
+template<typename T, typename Lock = std::mutex>
+class MulticastRingBuffer
+{
+    public:
+        explicit MulticastRingBuffer(int capacity);
+        ~MulticastRingBuffer();
+        MulticastRingBuffer(const MulticastRingBuffer&) = delete;
+        MulticastRingBuffer& operator=(const MulticastRingBuffer&) = delete;
+
+        /**
+         * Adds a consumer group that sees an element once every group
+         * in dependsOn has committed it, or once it is published if
+         * dependsOn is empty. Returns the id of the group.
+         */
+        int addGroup(const std::vector<int> &dependsOn = std::vector<int>());
+
+        void put(const T &value);
+        void put(T &&value);
+        bool offer(const T &value);
+        bool offer(T &&value);
+
+        /** Constructs an element in place, waiting for space like put. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
+        /**
+         * Reserves the next sequence, waiting if necessary for the
+         * slowest group to free its slot. The element is
+         * default-initialized; fill it through at() and publish it.
+         */
+        std::int64_t claim();
+
+        /** The element of a claimed, unpublished sequence. */
+        T& at(std::int64_t sequence);
+
+        /** Makes a claimed sequence visible to the groups. */
+        void publish(std::int64_t sequence);
+
+        /**
+         * Waits until the group has at least one element to read and
+         * returns the end of the readable range, which starts at
+         * cursor(group).
+         */
+        std::int64_t waitFor(int group);
+
+        /** As waitFor(group), returning cursor(group) on timeout. */
+        template<typename Rep, typename Period>
+        std::int64_t waitFor(int group, const std::chrono::duration<Rep, Period> &timeout);
+
+        /** End of the readable range of the group, without waiting. */
+        std::int64_t available(int group) const;
+
+        /** A readable element of a group, valid until it is committed. */
+        const T& get(std::int64_t sequence) const;
+
+        /** Marks every element of the group before upTo as consumed. */
+        void commit(int group, std::int64_t upTo);
+
+        /** The next sequence the group will read. */
+        std::int64_t cursor(int group) const;
+
+        int capacity() const;
+        int groups() const;
+        QueueStatsSnapshot stats() const;
+
+    private:
+        struct Group
+        {
+            /** Sequences before this one are consumed */
+            std::int64_t cursor;
+            std::vector<int> dependsOn;
+            /** Some other group depends on this one */
+            bool hasDependents;
+        };
+
+        int index(std::int64_t sequence) const { return static_cast<int>(sequence % capacity_); }
+        bool hasSpace() const { return next_ - freed_ < capacity_; }
+        std::int64_t availableLocked(int group) const;
+        void publishLocked(std::int64_t sequence);
+        void freeConsumed();
+
+    private:
+        /** Capacity of the ring */
+        const int capacity_;
+
+        /** The next sequence to claim */
+        std::int64_t next_;
+
+        /** Sequences before this one are published */
+        std::int64_t published_;
+
+        /** Sequences before this one are destroyed, their slots free */
+        std::int64_t freed_;
+
+        /** The elements, live from freed_ to next_ */
+        RawArray<T> items_;
+
+        /** The sequence last published into each slot, -1 if none */
+        std::unique_ptr<std::int64_t[]> slotSequences_;
+
+        std::vector<Group> groups_;
+
+        /** Main lock guarding the cursors */
+        mutable Lock mutex_;
+
+        /** Condition for groups waiting for elements */
+        ConditionVariableFor<Lock> advanced_;
+
+        /** Condition for producers waiting for a free slot */
+        ConditionVariableFor<Lock> notFull_;
+
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
+};
+
+template<typename T, typename Lock>
+MulticastRingBuffer<T, Lock>::MulticastRingBuffer(int capacity):
+    capacity_(capacity),
+    next_(0),
+    published_(0),
+    freed_(0),
+    items_(capacity),
+    slotSequences_(new std::int64_t[capacity])
+{
+    std::fill(slotSequences_.get(), slotSequences_.get() + capacity, -1);
+}
+
+template<typename T, typename Lock>
+MulticastRingBuffer<T, Lock>::~MulticastRingBuffer()
+{
+    for(std::int64_t s = freed_; s < next_; ++s)
+        items_.destroy(index(s));
+}
+
+template<typename T, typename Lock>
+int MulticastRingBuffer<T, Lock>::addGroup(const std::vector<int> &dependsOn)
+{
+    std::lock_guard<Lock> lk(mutex_);
+    for(int d : dependsOn)
+        groups_[d].hasDependents = true;
+    groups_.push_back(Group{ next_, dependsOn, false });
+    return static_cast<int>(groups_.size()) - 1;
+}
+
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::put(const T &value)
+{
+    emplace(value);
+}
+
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::put(T &&value)
+{
+    emplace(std::move(value));
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void MulticastRingBuffer<T, Lock>::emplace(Args&&... args)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitPut(notFull_, lk, [this]{ return hasSpace(); });
+    items_.construct(index(next_), std::forward<Args>(args)...);
+    publishLocked(next_++);
+}
+
+template<typename T, typename Lock>
+bool MulticastRingBuffer<T, Lock>::offer(const T &value)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(!hasSpace())
+        return false;
+    items_.construct(index(next_), value);
+    publishLocked(next_++);
+    return true;
+}
+
+/* As above; value is moved from only if it was inserted. */
+template<typename T, typename Lock>
+bool MulticastRingBuffer<T, Lock>::offer(T &&value)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    if(!hasSpace())
+        return false;
+    items_.construct(index(next_), std::move(value));
+    publishLocked(next_++);
+    return true;
+}
+
+template<typename T, typename Lock>
+std::int64_t MulticastRingBuffer<T, Lock>::claim()
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    stats_.awaitPut(notFull_, lk, [this]{ return hasSpace(); });
+    items_.constructDefault(index(next_));
+    return next_++;
+}
+
+template<typename T, typename Lock>
+T& MulticastRingBuffer<T, Lock>::at(std::int64_t sequence)
+{
+    return items_[index(sequence)];
+}
+
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::publish(std::int64_t sequence)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    publishLocked(sequence);
+}
+
+/**
+ * Records a published sequence and advances published_ over every
+ * sequence that is now contiguous. Call only when holding lock.
+ */
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::publishLocked(std::int64_t sequence)
+{
+    slotSequences_[index(sequence)] = sequence;
+    std::int64_t old = published_;
+    while(published_ < next_ && slotSequences_[index(published_)] == published_)
+        stats_.recordPut(++published_ - freed_);
+    if(published_ == old)
+        return;
+    advanced_.notify_all();
+    /* with no group to read them, elements are dropped as published */
+    if(groups_.empty())
+        freeConsumed();
+}
+
+/**
+ * The end of the readable range of a group: the published sequences,
+ * or the least cursor of the groups it depends on. Call only when
+ * holding lock.
+ */
+template<typename T, typename Lock>
+std::int64_t MulticastRingBuffer<T, Lock>::availableLocked(int group) const
+{
+    const Group &g = groups_[group];
+    if(g.dependsOn.empty())
+        return published_;
+    std::int64_t end = published_;
+    for(int d : g.dependsOn)
+        end = std::min(end, groups_[d].cursor);
+    return end;
+}
+
+template<typename T, typename Lock>
+std::int64_t MulticastRingBuffer<T, Lock>::waitFor(int group)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    const std::int64_t cursor = groups_[group].cursor;
+    stats_.awaitTake(advanced_, lk, [&]{ return availableLocked(group) > cursor; });
+    return availableLocked(group);
+}
+
+template<typename T, typename Lock>
+template<typename Rep, typename Period>
+std::int64_t MulticastRingBuffer<T, Lock>::waitFor(int group,
+                                                   const std::chrono::duration<Rep, Period> &timeout)
+{
+    std::unique_lock<Lock> lk(mutex_, std::defer_lock);
+    stats_.lock(lk);
+    const std::int64_t cursor = groups_[group].cursor;
+    advanced_.wait_for(lk, timeout, [&]{ return availableLocked(group) > cursor; });
+    return availableLocked(group);
+}
+
+template<typename T, typename Lock>
+std::int64_t MulticastRingBuffer<T, Lock>::available(int group) const
+{
+    std::lock_guard<Lock> lk(mutex_);
+    return availableLocked(group);
+}
+
+template<typename T, typename Lock>
+const T& MulticastRingBuffer<T, Lock>::get(std::int64_t sequence) const
+{
+    return items_[index(sequence)];
+}
+
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::commit(int group, std::int64_t upTo)
+{
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lk(mutex_, std::adopt_lock);
+    Group &g = groups_[group];
+    for(std::int64_t s = g.cursor; s < upTo; ++s)
+        stats_.recordTake();
+    g.cursor = upTo;
+    if(g.hasDependents)
+        advanced_.notify_all();
+    freeConsumed();
+}
+
+/**
+ * Destroys the elements every group has consumed and signals the
+ * producers. Call only when holding lock.
+ */
+template<typename T, typename Lock>
+void MulticastRingBuffer<T, Lock>::freeConsumed()
+{
+    std::int64_t least = published_;
+    for(const Group &g : groups_)
+        least = std::min(least, g.cursor);
+    if(least == freed_)
+        return;
+    for(; freed_ < least; ++freed_)
+        items_.destroy(index(freed_));
+    notFull_.notify_all();
+}
+
+template<typename T, typename Lock>
+std::int64_t MulticastRingBuffer<T, Lock>::cursor(int group) const
+{
+    std::lock_guard<Lock> lk(mutex_);
+    return groups_[group].cursor;
+}
+
+template<typename T, typename Lock>
+int MulticastRingBuffer<T, Lock>::capacity() const
+{
+    return capacity_;
+}
+
+template<typename T, typename Lock>
+int MulticastRingBuffer<T, Lock>::groups() const
+{
+    std::lock_guard<Lock> lk(mutex_);
+    return static_cast<int>(groups_.size());
+}
+
+/**
+ * Returns a snapshot of the runtime statistics; takes count the
+ * elements committed by all groups together. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot MulticastRingBuffer<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
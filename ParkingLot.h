@@ -0,0 +1,125 @@
+# pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "Locks.h"
+
+/**
+ * Spin-then-park waiting on an address, for the synchronizers whose
+ * state is a plain atomic word (CyclicBarrier, Phaser, the read-write
+ * locks, CompletableFuture, Exchanger).
+ *
+ * <p>A waiter first spins with exponential backoff, which is cheap when
+ * the wait is a few microseconds. After that it parks on a condition
+ * variable from a fixed table of buckets, chosen by hashing the
+ * address, so a synchronizer needs no mutex or condition variable of
+ * its own. A waker that changed the word calls unparkAll(); if nobody
+ * is parked in the bucket that is a single load.
+ *
+ * <p>The waiter count of a bucket is incremented before the parked
+ * thread re-evaluates its predicate, and read by the waker after it
+ * changed the word, both sequentially consistent, so a wake-up is
+ * never lost as long as the word itself is written with seq_cst.
+ */
+class ParkingLot
+{
+    public:
+        /** Pause rounds of the spin phase, doubling from 1 */
+        static const int kDefaultSpinLimit = 1 << 10;
+
+        /**
+         * Waits while stillWaiting() returns true, spinning first and
+         * parking on key afterwards.
+         */
+        template<typename Predicate>
+        static void parkWhile(const void *key, Predicate stillWaiting,
+                              int spinLimit = kDefaultSpinLimit);
+
+        /**
+         * As parkWhile, giving up at the deadline. Returns false if
+         * stillWaiting() was still true then.
+         */
+        template<typename Predicate>
+        static bool parkUntil(const void *key, Predicate stillWaiting,
+                              std::chrono::steady_clock::time_point deadline,
+                              int spinLimit = kDefaultSpinLimit);
+
+        /** Wakes every thread parked on key. */
+        static void unparkAll(const void *key);
+
+    private:
+        static const int kBuckets = 64;
+
+        struct alignas(64) Bucket
+        {
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::atomic<int> waiters{0};
+        };
+
+        static Bucket &bucket(const void *key);
+};
+
+inline ParkingLot::Bucket &ParkingLot::bucket(const void *key)
+{
+    static Bucket buckets[kBuckets];
+    std::uintptr_t h = reinterpret_cast<std::uintptr_t>(key);
+    h ^= h >> 17;
+    h *= 0x9e3779b97f4a7c15ull;
+    return buckets[(h >> 32) % kBuckets];
+}
+
+template<typename Predicate>
+void ParkingLot::parkWhile(const void *key, Predicate stillWaiting, int spinLimit)
+{
+    for(int spins = 1; spins <= spinLimit; spins <<= 1)
+    {
+        if(!stillWaiting())
+            return;
+        for(int i = 0; i < spins; ++i)
+            cpuRelax();
+    }
+    Bucket &b = bucket(key);
+    std::unique_lock<std::mutex> lk(b.mutex);
+    b.waiters.fetch_add(1);
+    while(stillWaiting())
+        b.cond.wait(lk);
+    b.waiters.fetch_sub(1);
+}
+
+template<typename Predicate>
+bool ParkingLot::parkUntil(const void *key, Predicate stillWaiting,
+                           std::chrono::steady_clock::time_point deadline, int spinLimit)
+{
+    for(int spins = 1; spins <= spinLimit; spins <<= 1)
+    {
+        if(!stillWaiting())
+            return true;
+        for(int i = 0; i < spins; ++i)
+            cpuRelax();
+    }
+    Bucket &b = bucket(key);
+    std::unique_lock<std::mutex> lk(b.mutex);
+    b.waiters.fetch_add(1);
+    bool done = true;
+    while(stillWaiting())
+        if(b.cond.wait_until(lk, deadline) == std::cv_status::timeout)
+        {
+            done = !stillWaiting();
+            break;
+        }
+    b.waiters.fetch_sub(1);
+    return done;
+}
+
+inline void ParkingLot::unparkAll(const void *key)
+{
+    Bucket &b = bucket(key);
+    if(b.waiters.load() == 0)
+        return;
+    std::lock_guard<std::mutex> lk(b.mutex);
+    b.cond.notify_all();
+}
@@ -0,0 +1,344 @@
+# pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "ParkingLot.h"
+
+/**
+ * A reusable synchronization barrier, similar in functionality to
+ * CyclicBarrier and CountDownLatch but supporting more flexible usage:
+ * the number of parties may vary over time, and a party may arrive
+ * without waiting and await the advance later.
+ *
+ * <p>All state lives in one 64-bit word, updated by compare-and-swap:
+ * the phase number in the high half (negative once terminated), then
+ * the number of registered parties and the number not yet arrived in
+ * the current phase, 16 bits each. Parties therefore never take a lock
+ * to arrive or register, and waiters spin then park on the phase of the
+ * root (see ParkingLot.h).
+ *
+ * <p>Phasers may be tiered: a phaser built with a parent registers with
+ * it as a single party while it has parties of its own, and arrives at
+ * it when all of them have arrived. A tree of phasers with a handful of
+ * parties each is a combining tree, keeping the contention on any state
+ * word bounded however many parties there are in total. The phase is
+ * advanced only at the root; children catch up with it lazily.
+ *
+ * <p>onAdvance() may be overridden to run an action at each phase
+ * advance of the root and to decide on termination. By default the
+ * phaser terminates when its last party deregisters.
+ */
+class Phaser
+{
+    public:
+        static const int kMaxParties = 0xffff;
+
+        explicit Phaser(int parties = 0);
+        explicit Phaser(Phaser *parent, int parties = 0);
+        virtual ~Phaser() {}
+        Phaser(const Phaser&) = delete;
+        Phaser& operator=(const Phaser&) = delete;
+
+        /** Adds a new unarrived party; returns the arrival phase number. */
+        int registerParty();
+
+        /** Adds the given number of unarrived parties; returns the arrival phase number. */
+        int bulkRegister(int parties);
+
+        /** Arrives without waiting; returns the arrival phase number, negative if terminated. */
+        int arrive();
+
+        /** Arrives and deregisters without waiting; returns the arrival phase number. */
+        int arriveAndDeregister();
+
+        /** Arrives and waits for the others; returns the next phase number. */
+        int arriveAndAwaitAdvance();
+
+        /**
+         * Waits for the phase to advance from the given value; returns
+         * the next phase number, or immediately if the current phase
+         * is different or the phaser terminated.
+         */
+        int awaitAdvance(int phase);
+
+        /** Forces this phaser and its whole tree into termination. */
+        void forceTermination();
+
+        int getPhase() const;
+        int getRegisteredParties();
+        int getArrivedParties();
+        int getUnarrivedParties();
+        bool isTerminated() const;
+        Phaser *getParent() const { return parent_; }
+        Phaser *getRoot() const { return root_; }
+
+    protected:
+        /**
+         * Called by the last party arriving at the root, before waiters
+         * are released. Returns true to terminate the phaser.
+         */
+        virtual bool onAdvance(int phase, int registeredParties);
+
+    private:
+        static const int kPartiesShift = 16;
+        static const int kPhaseShift = 32;
+        static const int kUnarrivedMask = 0xffff;
+        static const std::int64_t kPartiesMask = 0xffff0000ll;
+        static const std::int64_t kCountsMask = 0xffffffffll;
+        static const std::int64_t kTerminationBit = std::int64_t(1) << 63;
+        static const int kOneArrival = 1;
+        static const int kOneParty = 1 << kPartiesShift;
+        static const int kOneDeregister = kOneArrival | kOneParty;
+        /** Counts of a phaser without parties, distinct from all arrived */
+        static const int kEmpty = 1;
+
+        static int phaseOf(std::int64_t s) { return static_cast<int>(s >> kPhaseShift); }
+        static int partiesOf(std::int64_t s) { return static_cast<int>(static_cast<std::uint32_t>(s) >> kPartiesShift); }
+        static int unarrivedOf(std::int64_t s)
+        {
+            int counts = static_cast<int>(s);
+            return counts == kEmpty ? 0 : counts & kUnarrivedMask;
+        }
+
+        int doArrive(int adjust);
+        int doRegister(int registrations);
+        std::int64_t reconcileState();
+        int internalAwaitAdvance(int phase);
+
+        Phaser *const parent_;
+        Phaser *const root_;
+        /** Serializes the first registration of a child with its parent */
+        std::mutex registerMutex_;
+        alignas(64) std::atomic<std::int64_t> state_;
+};
+
+inline Phaser::Phaser(int parties): Phaser(nullptr, parties)
+{
+}
+
+inline Phaser::Phaser(Phaser *parent, int parties):
+    parent_(parent),
+    root_(parent ? parent->root_ : this)
+{
+    int phase = 0;
+    if(parent && parties != 0)
+        phase = parent->doRegister(1);
+    state_.store(parties == 0 ? std::int64_t(kEmpty) :
+                 (std::int64_t(phase) << kPhaseShift) |
+                 (std::int64_t(parties) << kPartiesShift) |
+                 std::int64_t(parties));
+}
+
+/*
+ * Brings the phase of a child up to date with the root, resetting its
+ * unarrived count to its parties, and returns the resulting state.
+ */
+inline std::int64_t Phaser::reconcileState()
+{
+    std::int64_t s = state_.load();
+    if(root_ == this)
+        return s;
+    int phase;
+    while((phase = phaseOf(root_->state_.load())) != phaseOf(s))
+    {
+        int p = partiesOf(s);
+        std::int64_t next = (std::int64_t(phase) << kPhaseShift) |
+            (phase < 0 ? (s & kCountsMask) :
+             p == 0 ? std::int64_t(kEmpty) : ((s & kPartiesMask) | p));
+        if(state_.compare_exchange_weak(s, next))
+        {
+            s = next;
+            break;
+        }
+    }
+    return s;
+}
+
+inline int Phaser::doArrive(int adjust)
+{
+    for(;;)
+    {
+        std::int64_t s = root_ == this ? state_.load() : reconcileState();
+        int phase = phaseOf(s);
+        if(phase < 0)
+            return phase;
+        int unarrived = unarrivedOf(s);
+        std::int64_t next = s - adjust;
+        if(!state_.compare_exchange_weak(s, next))
+            continue;
+        if(unarrived == 1)
+        {
+            std::int64_t n = next & kPartiesMask;
+            int nextUnarrived = static_cast<int>(n >> kPartiesShift);
+            if(root_ == this)
+            {
+                if(onAdvance(phase, nextUnarrived))
+                    n |= kTerminationBit;
+                else if(nextUnarrived == 0)
+                    n |= kEmpty;
+                else
+                    n |= nextUnarrived;
+                int nextPhase = (phase + 1) & 0x7fffffff;
+                n |= std::int64_t(nextPhase) << kPhaseShift;
+                state_.compare_exchange_strong(next, n);
+                ParkingLot::unparkAll(&state_);
+            }
+            else if(nextUnarrived == 0)
+            {
+                /* the last party left, so leave the parent as well */
+                phase = parent_->doArrive(kOneDeregister);
+                state_.compare_exchange_strong(next, next | kEmpty);
+            }
+            else
+                phase = parent_->doArrive(kOneArrival);
+        }
+        return phase;
+    }
+}
+
+inline int Phaser::doRegister(int registrations)
+{
+    const std::int64_t adjust = (std::int64_t(registrations) << kPartiesShift) | registrations;
+    int phase;
+    for(;;)
+    {
+        std::int64_t s = parent_ == nullptr ? state_.load() : reconcileState();
+        int counts = static_cast<int>(s);
+        int unarrived = counts & kUnarrivedMask;
+        phase = phaseOf(s);
+        if(phase < 0)
+            break;
+        if(counts != kEmpty)
+        {
+            if(parent_ == nullptr || reconcileState() == s)
+            {
+                if(unarrived == 0)
+                    /* the phase is advancing; register with the next one */
+                    root_->internalAwaitAdvance(phase);
+                else if(state_.compare_exchange_weak(s, s + adjust))
+                    break;
+            }
+        }
+        else if(parent_ == nullptr)
+        {
+            std::int64_t next = (std::int64_t(phase) << kPhaseShift) | adjust;
+            if(state_.compare_exchange_weak(s, next))
+                break;
+        }
+        else
+        {
+            /* first registration of a child: it becomes a party of its parent */
+            std::lock_guard<std::mutex> lk(registerMutex_);
+            if(state_.load() == s)
+            {
+                phase = parent_->doRegister(1);
+                if(phase < 0)
+                    break;
+                for(;;)
+                {
+                    std::int64_t next = (std::int64_t(phase) << kPhaseShift) | adjust;
+                    if(state_.compare_exchange_weak(s, next))
+                        break;
+                    phase = phaseOf(root_->state_.load());
+                }
+                break;
+            }
+        }
+    }
+    return phase;
+}
+
+inline int Phaser::internalAwaitAdvance(int phase)
+{
+    int p;
+    ParkingLot::parkWhile(&state_, [&]{
+        p = phaseOf(state_.load());
+        return p == phase;
+    });
+    return p;
+}
+
+inline int Phaser::registerParty()
+{
+    return doRegister(1);
+}
+
+inline int Phaser::bulkRegister(int parties)
+{
+    if(parties == 0)
+        return getPhase();
+    return doRegister(parties);
+}
+
+inline int Phaser::arrive()
+{
+    return doArrive(kOneArrival);
+}
+
+inline int Phaser::arriveAndDeregister()
+{
+    return doArrive(kOneDeregister);
+}
+
+inline int Phaser::arriveAndAwaitAdvance()
+{
+    int phase = doArrive(kOneArrival);
+    if(phase < 0)
+        return phase;
+    return root_->internalAwaitAdvance(phase);
+}
+
+inline int Phaser::awaitAdvance(int phase)
+{
+    std::int64_t s = root_ == this ? state_.load() : reconcileState();
+    int p = phaseOf(s);
+    if(phase < 0)
+        return phase;
+    if(p == phase)
+        return root_->internalAwaitAdvance(phase);
+    return p;
+}
+
+inline void Phaser::forceTermination()
+{
+    std::int64_t s = root_->state_.load();
+    while(s >= 0)
+    {
+        if(root_->state_.compare_exchange_weak(s, s | kTerminationBit))
+        {
+            ParkingLot::unparkAll(&root_->state_);
+            return;
+        }
+    }
+}
+
+inline int Phaser::getPhase() const
+{
+    return phaseOf(root_->state_.load());
+}
+
+inline int Phaser::getRegisteredParties()
+{
+    return partiesOf(state_.load());
+}
+
+inline int Phaser::getArrivedParties()
+{
+    std::int64_t s = reconcileState();
+    return partiesOf(s) - unarrivedOf(s);
+}
+
+inline int Phaser::getUnarrivedParties()
+{
+    return unarrivedOf(reconcileState());
+}
+
+inline bool Phaser::isTerminated() const
+{
+    return root_->state_.load() < 0;
+}
+
+inline bool Phaser::onAdvance(int, int registeredParties)
+{
+    return registeredParties == 0;
+}
@@ -1,3 +1,4 @@
+# pragma once
 #include <limits>
 #include <memory>
 #include <mutex>
@@ -5,26 +6,46 @@
 #include <algorithm>
 #include <atomic>
 #include <thread>
-template<typename T>
+#include <utility>
+#include "Locks.h"
+#include "QueueStats.h"
+#include "RawArray.h"
+#include "SelectWaiter.h"
+template<typename T, typename Lock = std::mutex>
 /**
  *  <E> the type of elements held in this queue
+ *  <Lock> the type of the lock used for all public operations
  */
 
 class PriorityBlockingQueue
 {
     public:
         explicit PriorityBlockingQueue(int initialCapacity = 0);
+        ~PriorityBlockingQueue();
         PriorityBlockingQueue(const PriorityBlockingQueue&) = delete;
         PriorityBlockingQueue& operator=(const PriorityBlockingQueue&) = delete;
         void put(const T &x);
+        void put(T &&x);
         bool offer(const T &x);
+        bool offer(T &&x);
+
+        /** Constructs an element in place and inserts it. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
         std::shared_ptr<T> take();
         std::shared_ptr<T> poll();
         void clear();
         const T& peek();
+        QueueStatsSnapshot stats() const;
+
+        /** Select support, see Select.h */
+        void addSelectWaiter(SelectWaiter *waiter);
+        void removeSelectWaiter(SelectWaiter *waiter);
     private:
-        void shifUp(const T &x);
-        void shifDown(int hole);
+        void tryGrow(std::unique_lock<Lock> &lock, int oldCap);
+        void siftUp(int hole);
+        void siftDown(int hole);
         std::shared_ptr<T> dequeue();
         // inline funtion
        // int parent(const int &index) const { return index >> 1; };
@@ -35,7 +56,7 @@ class PriorityBlockingQueue
         /**
         * Default array capacity.
         */
-        static const kDefaultInitialCapacity = 11;
+        static const int kDefaultInitialCapacity = 11;
 
          /**
         * The maximum size of array to allocate.
@@ -43,7 +64,7 @@ class PriorityBlockingQueue
         * Attempts to allocate larger arrays may result in
         * OutOfMemoryError: Requested array size exceeds VM limit
         */
-        static const kMaxArraySize  = std::numeric_limits<int>::max() - 8;
+        static const int kMaxArraySize  = std::numeric_limits<int>::max() - 8;
 
         /**
         * The number of elements in the priority queue.
@@ -58,12 +79,12 @@ class PriorityBlockingQueue
         /**
         * Lock used for all public operations.
         */
-        std::mutex mutex_;
+        Lock mutex_;
         
         /**
          * Condition for blocking when empty
          */
-        std::condition_variable notEmpty_;
+        ConditionVariableFor<Lock> notEmpty_;
 
         /**
         * Priority queue represented as a balanced binary heap: the two
@@ -72,22 +93,39 @@ class PriorityBlockingQueue
         * natural ordering, if comparator is null: For each node n in the
         * heap and each descendant d of n, n <= d.  The element with the
         * lowest value is in queue[0], assuming the queue is nonempty.
+        *
+        * Here the heap is 1-based: the children of array_[n] are
+        * array_[2*n] and array_[2*n+1] and the lowest value is in
+        * array_[1]. Only slots 1..size_ hold constructed elements.
         */
-        T *array_;
+        RawArray<T> array_;
 
         /**
         * Spinlock for allocation
         */
         std::atomic_flag allocationSpinLock;
+
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
+
+        /** Threads selecting on this queue among others */
+        WaiterList selectWaiters_;
 };
 
-template<typename T>
-PriorityBlockingQueue<T>::PriorityBlockingQueue(int initialCapacity = 0):
+template<typename T, typename Lock>
+PriorityBlockingQueue<T, Lock>::PriorityBlockingQueue(int initialCapacity):
     size_(0),
-    capacity_(1 + std::max(initialCapacity, kDefaultInitialCapacity)),
-    allocationSpinLock(ATOMIC_FLAG_INIT)
+    capacity_(1 + std::max(initialCapacity, static_cast<int>(kDefaultInitialCapacity))),
+    array_(capacity_)
+{
+    allocationSpinLock.clear();
+}
+
+template<typename T, typename Lock>
+PriorityBlockingQueue<T, Lock>::~PriorityBlockingQueue()
 {
-    array_ = new T[initialCapacity];
+    for(int k = 1; k <= size_; ++k)
+        array_.destroy(k);
 }
 
 
@@ -95,110 +133,140 @@ PriorityBlockingQueue<T>::PriorityBlockingQueue(int initialCapacity = 0):
  * Inserts the specified element into this priority queue.
  * As the queue is unbounded, this method will never block.
  * */
-template<typename T>
-void PriorityBlockingQueue<T>::put(const T& x)
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::put(const T& x)
 {
-    offer(x);
+    emplace(x);
+}
+
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::put(T&& x)
+{
+    emplace(std::move(x));
 }
 
 /**
  * Inserts the specified element into this priority queue.
  * As the queue is unbounded, this method will never return {@code false}.
  */
-template<typename T>
-bool PriorityBlockingQueue<T>::offer(const T& x)
+template<typename T, typename Lock>
+bool PriorityBlockingQueue<T, Lock>::offer(const T& x)
+{
+    emplace(x);
+    return true;
+}
+
+template<typename T, typename Lock>
+bool PriorityBlockingQueue<T, Lock>::offer(T&& x)
 {
-    std::unique_lock<std::mutex> lock(mutex_);
+    emplace(std::move(x));
+    return true;
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void PriorityBlockingQueue<T, Lock>::emplace(Args&&... args)
+{
+    std::unique_lock<Lock> lock(mutex_, std::defer_lock);
+    stats_.lock(lock);
     while(size_  >= capacity_ - 1)
+        tryGrow(lock, capacity_);
+    array_.construct(size_ + 1, std::forward<Args>(args)...);
+    siftUp(++size_);
+    stats_.recordPut(size_);
+    notEmpty_.notify_one();
+    selectWaiters_.signalAll();
+    lock.unlock();
+
+}
+
+/**
+ * Tries to grow array to accommodate at least one more element
+ * (but normally expand by about 50%), giving up (allowing retry)
+ * on contention (which we expect to be rare). Call only while
+ * holding lock.
+ */
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::tryGrow(std::unique_lock<Lock> &lock, int oldCap)
+{
+    lock.unlock();  // must release and then re-acquire main lock
+    RawArray<T> newQueue;
+    int newCap = 0;
+
+    if(!allocationSpinLock.test_and_set(std::memory_order_acquire))
     {
-        /**
-        * Tries to grow array to accommodate at least one more element
-        * (but normally expand by about 50%), giving up (allowing retry)
-        * on contention (which we expect to be rare). Call only while
-        * holding lock.
-        */
-        
-        lock.unlock();  // must release and then re-acquire main lock
-        T *newQueue = nullptr;
-        int newCap = 0;
+        newCap = oldCap + ((oldCap < 64) ?
+                            (oldCap + 2) :  // grow faster if small
+                            (oldCap >> 1));
+         //FIXME: possible memory overflow
+        RawArray<T>(newCap).swap(newQueue);
 
-        if(allocationSpinLock.test_and_set(std::memory_order_acquire))
-        {
-            int oldCap = capacity_;
-            int newCap = oldCap + ((oldCap < 64) ?
-                                    (oldCap + 2) :  // grow faster if small
-                                    (oldCap >> 1));
-             //FIXME: possible memory overflow
-            T *newQueue = new T[newCap];
-            
-            allocationSpinLock.clear();
-        }
+        allocationSpinLock.clear(std::memory_order_release);
+    }
+
+    if(newQueue.size() == 0) // back off if another thread is allocating
+        std::this_thread::yield();
 
-        if(newQueue == nullptr) // back off if another thread is allocating
-            std::this_thread::yield();
-          
-         lock.lock();
-        if(newQueue != nullptr)
+    lock.lock();
+    if(newQueue.size() != 0 && capacity_ == oldCap)
+    {
+        for(int k = 1; k <= size_; ++k)
         {
-            for(int k = 0; k < size_; ++k) // TODO: find faster copy method
-                newQueue[k] = std::move(array_[k]);
-            std::swap(array_, newQueue);
-            delete [] newQueue;
-            capacity_ = newCap;
+            newQueue.construct(k, std::move(array_[k]));
+            array_.destroy(k);
         }
+        array_.swap(newQueue);
+        capacity_ = newCap;
     }
-    siftUp(x);
-    notEmpty_.notify_one();
-    lock.unlock();
-    return true;
-
 }
 
 /**
- * Inserts item x at position size_+1, maintaining heap invariant by
- * promoting x up the tree until it is greater than or equal to
+ * Shifts item array[hole] up, maintaining heap invariant by
+ * promoting it up the tree until it is greater than or equal to
  * its parent, or is the root
  */
-template<typename T>
-void PriorityBlockingQueue<T>::shifUp(const T& x)
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::siftUp(int hole)
 {
-    int hole = ++size_;
-    T copy = x; // copy not move;
-    array_[0] = std::move(copy); 
-    for(; x < array_[hole>>1]; hole >>= 1)
-    {
+    T tmp = std::move(array_[hole]);
+    for(; hole > 1 && tmp < array_[hole >> 1]; hole >>= 1)
         array_[hole] = std::move(array_[hole >> 1]);
-    }
-    array_[hole] = std::move(array_[0]);
+    array_[hole] = std::move(tmp);
 }
 
-template<typename T>
- std::shared_ptr<T> PriorityBlockingQueue<T>::take()
+template<typename T, typename Lock>
+ std::shared_ptr<T> PriorityBlockingQueue<T, Lock>::take()
  {
-    std::unique_lock<std::mutex> takeLock;
+    std::unique_lock<Lock> takeLock(mutex_, std::defer_lock);
+    stats_.lock(takeLock);
     std::shared_ptr<T> res;
-    notEmpty_.wait(takeLock, [this]{ res = dequeue();
-                                     return res != nullptr; })
+    stats_.awaitTake(notEmpty_, takeLock, [&]{ res = dequeue();
+                                  return res != nullptr; });
     return res;
  }
 
-template<typename T>
-std::shared_ptr<T> PriorityBlockingQueue<T>::poll()
+template<typename T, typename Lock>
+std::shared_ptr<T> PriorityBlockingQueue<T, Lock>::poll()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.lock(mutex_);
+    std::lock_guard<Lock> lock(mutex_, std::adopt_lock);
     return dequeue();
 }
 
-template<typename T>
-std::shared_ptr<T> PriorityBlockingQueue<T>::dequeue()
+template<typename T, typename Lock>
+std::shared_ptr<T> PriorityBlockingQueue<T, Lock>::dequeue()
 {
     if(size_ == 0)
         return std::shared_ptr<T>();
     else
     {
         std::shared_ptr<T> const res(std::make_shared<T>(std::move(array_[1])));
-        array_[1] = std::move(array_[size_--]);
-        shifDown(1);
+        if(size_ > 1)
+            array_[1] = std::move(array_[size_]);
+        array_.destroy(size_--);
+        if(size_ > 1)
+            siftDown(1);
+        stats_.recordTake();
         return res;
     }
 }
@@ -209,13 +277,13 @@ std::shared_ptr<T> PriorityBlockingQueue<T>::dequeue()
  *  equal to its children or is a leaf.
  */
 
-template<typename T>
-void  PriorityBlockingQueue<T>::shifDown(int hole)
+template<typename T, typename Lock>
+void  PriorityBlockingQueue<T, Lock>::siftDown(int hole)
 {   
     T tmp = std::move(array_[hole]);
     for(int child = hole << 1; child <= size_; hole = child, child =  hole << 1)
     {
-        if(child == size_ && array_[child + 1] < array_[child])
+        if(child != size_ && array_[child + 1] < array_[child])
             ++child;
 
         if(array_[child] < tmp)
@@ -231,19 +299,41 @@ void  PriorityBlockingQueue<T>::shifDown(int hole)
  * Atomically removes all of the elements from this queue.
  * The queue will be empty after this call returns.
  */
-template<typename T>
-void  PriorityBlockingQueue<T>::clear()
+template<typename T, typename Lock>
+void  PriorityBlockingQueue<T, Lock>::clear()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    capacity_ = 0;
+    std::lock_guard<Lock> lock(mutex_);
+    for(int k = 1; k <= size_; ++k)
+        array_.destroy(k);
     size_ = 0;
-    delete [] array_;
-    
+
 }
-template<typename T>
-const T& PriorityBlockingQueue<T>::peek()
+template<typename T, typename Lock>
+const T& PriorityBlockingQueue<T, Lock>::peek()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Lock> lock(mutex_);
     // FIXME: deal with array_ is empty() case 
     return array_[1];
-}
\ No newline at end of file
+}
+
+/**
+ * Returns a snapshot of the runtime statistics. All counters are zero
+ * unless built with JAVATHREAD_ENABLE_STATS.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot PriorityBlockingQueue<T, Lock>::stats() const
+{
+    return stats_.snapshot();
+}
+
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::addSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.add(waiter);
+}
+
+template<typename T, typename Lock>
+void PriorityBlockingQueue<T, Lock>::removeSelectWaiter(SelectWaiter *waiter)
+{
+    selectWaiters_.remove(waiter);
+}
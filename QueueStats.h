@@ -0,0 +1,275 @@
+# pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Runtime statistics for the blocking queues and CountDownLatch.
+ *
+ * <p>Statistics are opt-in: they are compiled in only when
+ * {@code JAVATHREAD_ENABLE_STATS} is defined (the CMake option of the
+ * same name does this for the {@code javathread} target). Otherwise
+ * {@code QueueStats} is an empty class whose members are inline no-ops,
+ * so the instrumented code paths compile to exactly what they were
+ * before. The macro must be set consistently for every translation
+ * unit of a program.
+ *
+ * <p>Counters are striped over cache-line sized cells. Each thread is
+ * assigned a home cell the first time it records anything, so threads
+ * do not share a counter line in the common case and recording never
+ * takes a lock. {@code snapshot()} sums the cells; the result is not an
+ * atomic view of all counters, but every field is exact once the
+ * recording threads are quiescent.
+ */
+
+/**
+ * A point-in-time copy of the counters. For CountDownLatch
+ * {@code puts} counts countDown() calls and {@code takes} counts
+ * await() calls.
+ */
+struct QueueStatsSnapshot
+{
+    /** Successful insertions */
+    std::uint64_t puts = 0;
+
+    /** Successful removals */
+    std::uint64_t takes = 0;
+
+    /** Insertions that had to wait for space */
+    std::uint64_t putsBlocked = 0;
+
+    /** Removals that had to wait for an element */
+    std::uint64_t takesBlocked = 0;
+
+    /** Cumulative time insertions spent waiting, in nanoseconds */
+    std::uint64_t putWaitNanos = 0;
+
+    /** Cumulative time removals spent waiting, in nanoseconds */
+    std::uint64_t takeWaitNanos = 0;
+
+    /** High-water mark of the number of queued elements */
+    std::uint64_t maxDepth = 0;
+
+    /** Lock acquisitions that found the lock already held */
+    std::uint64_t contended = 0;
+};
+
+#ifdef JAVATHREAD_ENABLE_STATS
+
+class QueueStats
+{
+    public:
+        QueueStats() = default;
+        QueueStats(const QueueStats&) = delete;
+        QueueStats& operator=(const QueueStats&) = delete;
+
+        void recordPut(std::uint64_t depth);
+        void recordTake();
+        void recordPutWait(std::chrono::steady_clock::duration waited);
+        void recordTakeWait(std::chrono::steady_clock::duration waited);
+
+        /**
+         * Acquires a lockable (a mutex or a deferred unique_lock),
+         * counting the acquisition as contended if it cannot be taken
+         * immediately.
+         */
+        template<typename Lockable>
+        void lock(Lockable &lockable);
+
+        /**
+         * cond.wait(lk, pred), recording whether and how long a put or a
+         * take had to block.
+         */
+        template<typename Condition, typename Lock, typename Predicate>
+        void awaitPut(Condition &cond, Lock &lk, Predicate pred);
+        template<typename Condition, typename Lock, typename Predicate>
+        void awaitTake(Condition &cond, Lock &lk, Predicate pred);
+
+        QueueStatsSnapshot snapshot() const;
+
+        /**
+         * Measures one put or take that may block several times, as in
+         * the DelayQueue leader loop. Call blocked() before every wait;
+         * the time since the first call is recorded on destruction.
+         */
+        class WaitScope
+        {
+            public:
+                WaitScope(QueueStats &stats, bool put): stats_(stats), put_(put), waiting_(false) {}
+                WaitScope(const WaitScope&) = delete;
+                WaitScope& operator=(const WaitScope&) = delete;
+                ~WaitScope();
+                void blocked();
+            private:
+                QueueStats &stats_;
+                const bool put_;
+                bool waiting_;
+                std::chrono::steady_clock::time_point start_;
+        };
+
+    private:
+        static const int kStripes = 16;
+
+        struct alignas(64) Cell
+        {
+            std::atomic<std::uint64_t> puts{0};
+            std::atomic<std::uint64_t> takes{0};
+            std::atomic<std::uint64_t> putsBlocked{0};
+            std::atomic<std::uint64_t> takesBlocked{0};
+            std::atomic<std::uint64_t> putWaitNanos{0};
+            std::atomic<std::uint64_t> takeWaitNanos{0};
+            std::atomic<std::uint64_t> maxDepth{0};
+            std::atomic<std::uint64_t> contended{0};
+        };
+
+        Cell &cell();
+        static void add(std::atomic<std::uint64_t> &counter, std::uint64_t n);
+
+        Cell cells_[kStripes];
+};
+
+/**
+ * Home cell of the calling thread. Threads are numbered round-robin on
+ * first use, which spreads them evenly over the stripes.
+ */
+inline QueueStats::Cell &QueueStats::cell()
+{
+    static std::atomic<unsigned> nextStripe(0);
+    thread_local unsigned stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % kStripes;
+    return cells_[stripe];
+}
+
+/* Threads sharing a stripe may race, so the increment is still atomic;
+ * relaxed ordering suffices because the counters guard nothing. */
+inline void QueueStats::add(std::atomic<std::uint64_t> &counter, std::uint64_t n)
+{
+    counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void QueueStats::recordPut(std::uint64_t depth)
+{
+    Cell &c = cell();
+    add(c.puts, 1);
+    std::uint64_t max = c.maxDepth.load(std::memory_order_relaxed);
+    while(depth > max && !c.maxDepth.compare_exchange_weak(max, depth, std::memory_order_relaxed))
+        ;
+}
+
+inline void QueueStats::recordTake()
+{
+    add(cell().takes, 1);
+}
+
+inline void QueueStats::recordPutWait(std::chrono::steady_clock::duration waited)
+{
+    Cell &c = cell();
+    add(c.putsBlocked, 1);
+    add(c.putWaitNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+}
+
+inline void QueueStats::recordTakeWait(std::chrono::steady_clock::duration waited)
+{
+    Cell &c = cell();
+    add(c.takesBlocked, 1);
+    add(c.takeWaitNanos, std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+}
+
+template<typename Lockable>
+void QueueStats::lock(Lockable &lockable)
+{
+    if(lockable.try_lock())
+        return;
+    add(cell().contended, 1);
+    lockable.lock();
+}
+
+template<typename Condition, typename Lock, typename Predicate>
+void QueueStats::awaitPut(Condition &cond, Lock &lk, Predicate pred)
+{
+    if(pred())
+        return;
+    WaitScope wait(*this, true);
+    wait.blocked();
+    cond.wait(lk, pred);
+}
+
+template<typename Condition, typename Lock, typename Predicate>
+void QueueStats::awaitTake(Condition &cond, Lock &lk, Predicate pred)
+{
+    if(pred())
+        return;
+    WaitScope wait(*this, false);
+    wait.blocked();
+    cond.wait(lk, pred);
+}
+
+inline QueueStatsSnapshot QueueStats::snapshot() const
+{
+    QueueStatsSnapshot s;
+    for(const Cell &c : cells_)
+    {
+        s.puts += c.puts.load(std::memory_order_relaxed);
+        s.takes += c.takes.load(std::memory_order_relaxed);
+        s.putsBlocked += c.putsBlocked.load(std::memory_order_relaxed);
+        s.takesBlocked += c.takesBlocked.load(std::memory_order_relaxed);
+        s.putWaitNanos += c.putWaitNanos.load(std::memory_order_relaxed);
+        s.takeWaitNanos += c.takeWaitNanos.load(std::memory_order_relaxed);
+        s.contended += c.contended.load(std::memory_order_relaxed);
+        std::uint64_t depth = c.maxDepth.load(std::memory_order_relaxed);
+        if(depth > s.maxDepth)
+            s.maxDepth = depth;
+    }
+    return s;
+}
+
+inline QueueStats::WaitScope::~WaitScope()
+{
+    if(!waiting_)
+        return;
+    auto waited = std::chrono::steady_clock::now() - start_;
+    if(put_)
+        stats_.recordPutWait(waited);
+    else
+        stats_.recordTakeWait(waited);
+}
+
+inline void QueueStats::WaitScope::blocked()
+{
+    if(waiting_)
+        return;
+    waiting_ = true;
+    start_ = std::chrono::steady_clock::now();
+}
+
+#else
+
+/*
+ * Statistics disabled: same interface, nothing recorded.
+ */
+class QueueStats
+{
+    public:
+        void recordPut(std::uint64_t) {}
+        void recordTake() {}
+        void recordPutWait(std::chrono::steady_clock::duration) {}
+        void recordTakeWait(std::chrono::steady_clock::duration) {}
+
+        template<typename Lockable>
+        void lock(Lockable &lockable) { lockable.lock(); }
+
+        template<typename Condition, typename Lock, typename Predicate>
+        void awaitPut(Condition &cond, Lock &lk, Predicate pred) { cond.wait(lk, pred); }
+        template<typename Condition, typename Lock, typename Predicate>
+        void awaitTake(Condition &cond, Lock &lk, Predicate pred) { cond.wait(lk, pred); }
+
+        QueueStatsSnapshot snapshot() const { return QueueStatsSnapshot(); }
+
+        class WaitScope
+        {
+            public:
+                WaitScope(QueueStats&, bool) {}
+                void blocked() {}
+        };
+};
+
+#endif
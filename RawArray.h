@@ -0,0 +1,87 @@
+# pragma once
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+/**
+ * A fixed-size array of uninitialized, suitably aligned slots for T.
+ *
+ * <p>Slots are constructed and destroyed one at a time by the owner, so
+ * T need not be default constructible and an empty slot holds no
+ * object. RawArray does not know which slots are live: the owning queue
+ * must destroy them before the array goes away, since the destructor
+ * only releases the memory.
+ */
+template<typename T>
+class RawArray
+{
+    public:
+        explicit RawArray(std::size_t size = 0);
+        ~RawArray();
+        RawArray(const RawArray&) = delete;
+        RawArray& operator=(const RawArray&) = delete;
+
+        /** Constructs the element of slot i in place. */
+        template<typename... Args>
+        T& construct(std::size_t i, Args&&... args);
+
+        /**
+         * Default-initializes the element of slot i: unlike construct
+         * with no arguments, a trivial T is left uninitialized.
+         */
+        T& constructDefault(std::size_t i);
+
+        /** Destroys the element of slot i, which must be live. */
+        void destroy(std::size_t i);
+
+        T& operator[](std::size_t i) { return data_[i]; }
+        const T& operator[](std::size_t i) const { return data_[i]; }
+        std::size_t size() const { return size_; }
+        void swap(RawArray &other) noexcept;
+
+    private:
+        T *data_;
+        std::size_t size_;
+};
+
+/* std::allocator honours over-aligned types since C++17 */
+template<typename T>
+RawArray<T>::RawArray(std::size_t size):
+    data_(size > 0 ? std::allocator<T>().allocate(size) : nullptr),
+    size_(size)
+{
+}
+
+template<typename T>
+RawArray<T>::~RawArray()
+{
+    if(data_ != nullptr)
+        std::allocator<T>().deallocate(data_, size_);
+}
+
+template<typename T>
+template<typename... Args>
+T& RawArray<T>::construct(std::size_t i, Args&&... args)
+{
+    return *::new(static_cast<void*>(data_ + i)) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+T& RawArray<T>::constructDefault(std::size_t i)
+{
+    return *::new(static_cast<void*>(data_ + i)) T;
+}
+
+template<typename T>
+void RawArray<T>::destroy(std::size_t i)
+{
+    data_[i].~T();
+}
+
+template<typename T>
+void RawArray<T>::swap(RawArray &other) noexcept
+{
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+}
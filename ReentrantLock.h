@@ -0,0 +1,100 @@
+# pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+/**
+ * A reentrant mutual exclusion lock: the thread that owns it may lock
+ * it again, and it is released when unlock() has been called as many
+ * times as lock().
+ *
+ * <p>The exclusion itself comes from {@code Lock}, any of the policies
+ * in Locks.h; the owner and hold count are only touched by the owning
+ * thread, apart from the owner check of a would-be reentrant caller,
+ * so a first acquisition costs one extra relaxed load. The class is
+ * Lockable and can be used with std::lock_guard, std::unique_lock and
+ * condition_variable_any, but waiting on a condition releases one hold
+ * only, so wait with a hold count of one.
+ */
+template<typename Lock = std::mutex>
+class ReentrantLock
+{
+    public:
+        ReentrantLock() = default;
+        ReentrantLock(const ReentrantLock&) = delete;
+        ReentrantLock& operator=(const ReentrantLock&) = delete;
+
+        void lock();
+        bool try_lock();
+        void unlock();
+
+        /** Whether the calling thread owns the lock */
+        bool isHeldByCurrentThread() const;
+
+        /** Number of holds on the lock by the calling thread */
+        int getHoldCount() const;
+
+        bool isLocked() const;
+
+    private:
+        Lock lock_;
+        std::atomic<std::thread::id> owner_{std::thread::id()};
+        int holds_ = 0;
+};
+
+template<typename Lock>
+void ReentrantLock<Lock>::lock()
+{
+    const std::thread::id self = std::this_thread::get_id();
+    if(owner_.load(std::memory_order_relaxed) == self)
+    {
+        ++holds_;
+        return;
+    }
+    lock_.lock();
+    owner_.store(self, std::memory_order_relaxed);
+    holds_ = 1;
+}
+
+template<typename Lock>
+bool ReentrantLock<Lock>::try_lock()
+{
+    const std::thread::id self = std::this_thread::get_id();
+    if(owner_.load(std::memory_order_relaxed) == self)
+    {
+        ++holds_;
+        return true;
+    }
+    if(!lock_.try_lock())
+        return false;
+    owner_.store(self, std::memory_order_relaxed);
+    holds_ = 1;
+    return true;
+}
+
+template<typename Lock>
+void ReentrantLock<Lock>::unlock()
+{
+    if(--holds_ > 0)
+        return;
+    owner_.store(std::thread::id(), std::memory_order_relaxed);
+    lock_.unlock();
+}
+
+template<typename Lock>
+bool ReentrantLock<Lock>::isHeldByCurrentThread() const
+{
+    return owner_.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+template<typename Lock>
+int ReentrantLock<Lock>::getHoldCount() const
+{
+    return isHeldByCurrentThread() ? holds_ : 0;
+}
+
+template<typename Lock>
+bool ReentrantLock<Lock>::isLocked() const
+{
+    return owner_.load(std::memory_order_relaxed) != std::thread::id();
+}
@@ -0,0 +1,286 @@
+# pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "ParkingLot.h"
+
+/**
+ * A reentrant read-write lock whose read side scales with the number of
+ * cores.
+ *
+ * <p>Readers do not share a counter: each thread announces itself in
+ * one of a set of reader stripes, one cache line each, and then checks
+ * that no writer is active. A read acquisition therefore writes only
+ * to its own stripe and reads the writer flag, a line that stays
+ * shared in every cache while there is no writer. A writer first takes
+ * the writer mutex, raises the flag, which turns new readers away, and
+ * waits for every stripe to drain. This makes writes expensive, in
+ * proportion to the number of stripes, and the lock is meant for
+ * read-mostly data.
+ *
+ * <p>Both sides are reentrant. A thread already holding a read lock
+ * gets another one even while a writer waits, and the writer may also
+ * take read locks (downgrading by unlocking the write lock last), but
+ * a reader may not upgrade to a write lock: it would wait for itself.
+ *
+ * <p>Threads wait by spinning and then parking (see ParkingLot.h).
+ * lock/try_lock/unlock act on the write lock and lock_shared,
+ * try_lock_shared and unlock_shared on the read lock, so the class
+ * works with std::unique_lock and std::shared_lock; readLock() and
+ * writeLock() give the two halves as separate Lockable views.
+ */
+class ReentrantReadWriteLock
+{
+    public:
+        /** One half of the lock, Lockable on its own. */
+        class ReadLock
+        {
+            public:
+                void lock() { rw_.lock_shared(); }
+                bool try_lock() { return rw_.try_lock_shared(); }
+                void unlock() { rw_.unlock_shared(); }
+            private:
+                friend class ReentrantReadWriteLock;
+                explicit ReadLock(ReentrantReadWriteLock &rw): rw_(rw) {}
+                ReentrantReadWriteLock &rw_;
+        };
+
+        class WriteLock
+        {
+            public:
+                void lock() { rw_.lock(); }
+                bool try_lock() { return rw_.try_lock(); }
+                void unlock() { rw_.unlock(); }
+            private:
+                friend class ReentrantReadWriteLock;
+                explicit WriteLock(ReentrantReadWriteLock &rw): rw_(rw) {}
+                ReentrantReadWriteLock &rw_;
+        };
+
+        /** The number of reader stripes defaults to twice the hardware threads, at most 64. */
+        explicit ReentrantReadWriteLock(int stripes = 0);
+        ReentrantReadWriteLock(const ReentrantReadWriteLock&) = delete;
+        ReentrantReadWriteLock& operator=(const ReentrantReadWriteLock&) = delete;
+
+        void lock();
+        bool try_lock();
+        void unlock();
+
+        void lock_shared();
+        bool try_lock_shared();
+        void unlock_shared();
+
+        ReadLock &readLock() { return readLock_; }
+        WriteLock &writeLock() { return writeLock_; }
+
+        bool isWriteLocked() const;
+        bool isWriteLockedByCurrentThread() const;
+        int getWriteHoldCount() const;
+
+        /** Number of read holds of the calling thread */
+        int getReadHoldCount() const;
+
+        /** Number of read holds of all threads, a snapshot */
+        int getReadLockCount() const;
+
+    private:
+        struct alignas(64) Stripe
+        {
+            std::atomic<int> readers{0};
+        };
+
+        Stripe &stripe();
+        int &readHolds() const;
+        bool readersDrained() const;
+        bool tryAcquireShared(Stripe &s);
+
+        std::unique_ptr<Stripe[]> stripes_;
+        const int stripeCount_;
+        /** Identifies this lock in the thread-local read hold tables */
+        const std::uint64_t id_;
+
+        /** Serializes writers */
+        std::mutex writerMutex_;
+        std::atomic<std::thread::id> owner_{std::thread::id()};
+        int writeHolds_ = 0;
+
+        /** Raised while a writer holds or waits for the lock */
+        alignas(64) std::atomic<bool> writing_{false};
+
+        ReadLock readLock_;
+        WriteLock writeLock_;
+};
+
+inline ReentrantReadWriteLock::ReentrantReadWriteLock(int stripes):
+    stripeCount_(stripes > 0 ? stripes :
+                 std::min(64, std::max(1, 2 * static_cast<int>(std::thread::hardware_concurrency())))),
+    id_([]{ static std::atomic<std::uint64_t> next(1); return next.fetch_add(1); }()),
+    readLock_(*this),
+    writeLock_(*this)
+{
+    stripes_.reset(new Stripe[stripeCount_]);
+}
+
+inline ReentrantReadWriteLock::Stripe &ReentrantReadWriteLock::stripe()
+{
+    static std::atomic<unsigned> nextThread(0);
+    thread_local unsigned index = nextThread.fetch_add(1, std::memory_order_relaxed);
+    return stripes_[index % stripeCount_];
+}
+
+/*
+ * The read holds of the calling thread on this lock. An entry whose
+ * count dropped to zero is reused for the next lock, so the table stays
+ * as small as the number of locks the thread holds at once.
+ */
+inline int &ReentrantReadWriteLock::readHolds() const
+{
+    thread_local std::vector<std::pair<std::uint64_t, int>> holds;
+    for(auto &h : holds)
+        if(h.first == id_)
+            return h.second;
+    for(auto &h : holds)
+        if(h.second == 0)
+        {
+            h.first = id_;
+            return h.second;
+        }
+    holds.emplace_back(id_, 0);
+    return holds.back().second;
+}
+
+inline bool ReentrantReadWriteLock::readersDrained() const
+{
+    for(int i = 0; i < stripeCount_; ++i)
+        if(stripes_[i].readers.load() != 0)
+            return false;
+    return true;
+}
+
+/*
+ * Announces a reader in its stripe and then checks the writer flag.
+ * Both seq_cst: a writer raises the flag before it scans the stripes,
+ * so either the reader sees the flag or the writer sees the reader.
+ */
+inline bool ReentrantReadWriteLock::tryAcquireShared(Stripe &s)
+{
+    s.readers.fetch_add(1);
+    if(!writing_.load())
+        return true;
+    s.readers.fetch_sub(1);
+    ParkingLot::unparkAll(&stripes_);
+    return false;
+}
+
+inline void ReentrantReadWriteLock::lock_shared()
+{
+    int &holds = readHolds();
+    Stripe &s = stripe();
+    if(holds > 0 || isWriteLockedByCurrentThread())
+        s.readers.fetch_add(1);
+    else
+        while(!tryAcquireShared(s))
+            ParkingLot::parkWhile(&writing_, [this]{ return writing_.load(); });
+    ++holds;
+}
+
+inline bool ReentrantReadWriteLock::try_lock_shared()
+{
+    int &holds = readHolds();
+    Stripe &s = stripe();
+    if(holds > 0 || isWriteLockedByCurrentThread())
+        s.readers.fetch_add(1);
+    else if(!tryAcquireShared(s))
+        return false;
+    ++holds;
+    return true;
+}
+
+inline void ReentrantReadWriteLock::unlock_shared()
+{
+    --readHolds();
+    stripe().readers.fetch_sub(1);
+    if(writing_.load())
+        ParkingLot::unparkAll(&stripes_);
+}
+
+inline void ReentrantReadWriteLock::lock()
+{
+    const std::thread::id self = std::this_thread::get_id();
+    if(owner_.load(std::memory_order_relaxed) == self)
+    {
+        ++writeHolds_;
+        return;
+    }
+    writerMutex_.lock();
+    writing_.store(true);
+    ParkingLot::parkWhile(&stripes_, [this]{ return !readersDrained(); });
+    owner_.store(self, std::memory_order_relaxed);
+    writeHolds_ = 1;
+}
+
+inline bool ReentrantReadWriteLock::try_lock()
+{
+    const std::thread::id self = std::this_thread::get_id();
+    if(owner_.load(std::memory_order_relaxed) == self)
+    {
+        ++writeHolds_;
+        return true;
+    }
+    if(!writerMutex_.try_lock())
+        return false;
+    writing_.store(true);
+    if(!readersDrained())
+    {
+        writing_.store(false);
+        ParkingLot::unparkAll(&writing_);
+        writerMutex_.unlock();
+        return false;
+    }
+    owner_.store(self, std::memory_order_relaxed);
+    writeHolds_ = 1;
+    return true;
+}
+
+inline void ReentrantReadWriteLock::unlock()
+{
+    if(--writeHolds_ > 0)
+        return;
+    owner_.store(std::thread::id(), std::memory_order_relaxed);
+    writing_.store(false);
+    ParkingLot::unparkAll(&writing_);
+    writerMutex_.unlock();
+}
+
+inline bool ReentrantReadWriteLock::isWriteLocked() const
+{
+    return owner_.load(std::memory_order_relaxed) != std::thread::id();
+}
+
+inline bool ReentrantReadWriteLock::isWriteLockedByCurrentThread() const
+{
+    return owner_.load(std::memory_order_relaxed) == std::this_thread::get_id();
+}
+
+inline int ReentrantReadWriteLock::getWriteHoldCount() const
+{
+    return isWriteLockedByCurrentThread() ? writeHolds_ : 0;
+}
+
+inline int ReentrantReadWriteLock::getReadHoldCount() const
+{
+    return readHolds();
+}
+
+inline int ReentrantReadWriteLock::getReadLockCount() const
+{
+    int count = 0;
+    for(int i = 0; i < stripeCount_; ++i)
+        count += stripes_[i].readers.load(std::memory_order_relaxed);
+    return count;
+}
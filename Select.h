@@ -0,0 +1,234 @@
+# pragma once
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "SelectWaiter.h"
+
+/**
+ * Waiting on several blocking queues at once, in the manner of Go's
+ * select statement.
+ *
+ * <p>Any queue with a non-blocking {@code poll()} and the
+ * {@code addSelectWaiter}/{@code removeSelectWaiter} hooks can take
+ * part: ArrayBlockingQueue, LinkedBlockingQueue, LinkedBlockingDeque
+ * (taking from the head) and PriorityBlockingQueue. DelayQueue is not
+ * supported, since its elements become available by the passage of
+ * time rather than by an insertion.
+ *
+ * <p>A select first polls every queue. Only if all are empty does it
+ * register a SelectWaiter with each of them and sleep until one signals
+ * an insertion, so no thread spins while the queues are idle.
+ *
+ * <pre>
+ *   std::shared_ptr&lt;Msg&gt; msg;
+ *   int i = pollAny(msg, std::chrono::milliseconds(10), high, low);
+ *
+ *   Selector select;
+ *   select.onTake(high, [](std::shared_ptr&lt;Msg&gt; m){ route(*m); });
+ *   select.onTake(control, [](std::shared_ptr&lt;Ctrl&gt; c){ apply(*c); });
+ *   for(;;) select.select();
+ * </pre>
+ */
+
+enum class SelectOrder
+{
+    /** Cases are tried in the order they were given */
+    Priority,
+    /** The first case tried rotates, so no ready queue is starved */
+    RoundRobin
+};
+
+namespace select_detail
+{
+
+/**
+ * The common select loop. tryCases polls the queues and returns the
+ * index of the one that produced an element, or -1.
+ */
+template<typename TryCases, typename Register, typename Unregister>
+int selectUntil(SelectWaiter &waiter, TryCases tryCases, Register add, Unregister remove,
+                const std::chrono::steady_clock::time_point *deadline)
+{
+    int index = tryCases();
+    if(index >= 0 || (deadline != nullptr && std::chrono::steady_clock::now() >= *deadline))
+        return index;
+
+    add(&waiter);
+    for(;;)
+    {
+        waiter.reset();
+        index = tryCases();
+        if(index >= 0)
+            break;
+        if(!waiter.await(deadline))
+        {
+            index = tryCases();
+            break;
+        }
+    }
+    remove(&waiter);
+    return index;
+}
+
+template<typename T, typename Queue>
+bool pollInto(std::shared_ptr<T> &out, Queue &queue)
+{
+    out = queue.poll();
+    return out != nullptr;
+}
+
+template<typename T, typename... Queues>
+int tryPollAny(std::shared_ptr<T> &out, Queues&... queues)
+{
+    int index = 0;
+    bool found = ((pollInto(out, queues) || (++index, false)) || ...);
+    return found ? index : -1;
+}
+
+template<typename T, typename... Queues>
+int pollAnyUntil(std::shared_ptr<T> &out, const std::chrono::steady_clock::time_point *deadline,
+                 Queues&... queues)
+{
+    SelectWaiter waiter;
+    return selectUntil(waiter,
+        [&]{ return tryPollAny(out, queues...); },
+        [&](SelectWaiter *w){ (queues.addSelectWaiter(w), ...); },
+        [&](SelectWaiter *w){ (queues.removeSelectWaiter(w), ...); },
+        deadline);
+}
+
+} // namespace select_detail
+
+/**
+ * Retrieves and removes the head of the first non-empty queue, in
+ * argument order, waiting up to timeout for an element to arrive on
+ * any of them. Returns the index of the queue, or -1 on timeout. All
+ * queues must hold the same element type.
+ */
+template<typename T, typename Rep, typename Period, typename... Queues>
+int pollAny(std::shared_ptr<T> &out, const std::chrono::duration<Rep, Period> &timeout,
+            Queues&... queues)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    return select_detail::pollAnyUntil(out, &deadline, queues...);
+}
+
+/**
+ * Retrieves and removes the head of the first non-empty queue, in
+ * argument order, waiting if necessary until one has an element.
+ * Returns the index of the queue.
+ */
+template<typename T, typename... Queues>
+int takeAny(std::shared_ptr<T> &out, Queues&... queues)
+{
+    return select_detail::pollAnyUntil(out, nullptr, queues...);
+}
+
+/**
+ * A reusable select over queues of different element types. Each case
+ * pairs a queue with a handler that receives the taken element. Set up
+ * the cases once and call select() in the consumer loop. A Selector
+ * belongs to one thread.
+ */
+class Selector
+{
+    public:
+        explicit Selector(SelectOrder order = SelectOrder::Priority): order_(order), next_(0) {}
+        Selector(const Selector&) = delete;
+        Selector& operator=(const Selector&) = delete;
+
+        /** Adds a case; returns its index. */
+        template<typename Queue, typename Handler>
+        int onTake(Queue &queue, Handler handler);
+
+        /** Runs the handler of a ready case without waiting; -1 if none. */
+        int trySelect();
+
+        /** Waits until a case is ready and runs its handler. */
+        int select();
+
+        /** As select(), giving up with -1 after timeout. */
+        template<typename Rep, typename Period>
+        int select(const std::chrono::duration<Rep, Period> &timeout);
+
+    private:
+        struct Case
+        {
+            /** polls the queue and runs the handler on success */
+            std::function<bool()> fire;
+            std::function<void(SelectWaiter*)> add;
+            std::function<void(SelectWaiter*)> remove;
+        };
+
+        int tryCases();
+        int selectUntil(const std::chrono::steady_clock::time_point *deadline);
+
+        std::vector<Case> cases_;
+        const SelectOrder order_;
+        std::size_t next_;
+        SelectWaiter waiter_;
+};
+
+template<typename Queue, typename Handler>
+int Selector::onTake(Queue &queue, Handler handler)
+{
+    Case c;
+    c.fire = [&queue, handler]() mutable {
+        auto item = queue.poll();
+        if(item == nullptr)
+            return false;
+        handler(std::move(item));
+        return true;
+    };
+    c.add = [&queue](SelectWaiter *w){ queue.addSelectWaiter(w); };
+    c.remove = [&queue](SelectWaiter *w){ queue.removeSelectWaiter(w); };
+    cases_.push_back(std::move(c));
+    return static_cast<int>(cases_.size()) - 1;
+}
+
+inline int Selector::tryCases()
+{
+    const std::size_t n = cases_.size();
+    const std::size_t start = order_ == SelectOrder::RoundRobin ? next_ : 0;
+    for(std::size_t k = 0; k < n; ++k)
+    {
+        std::size_t i = (start + k) % n;
+        if(cases_[i].fire())
+        {
+            if(order_ == SelectOrder::RoundRobin)
+                next_ = (i + 1) % n;
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+inline int Selector::selectUntil(const std::chrono::steady_clock::time_point *deadline)
+{
+    return select_detail::selectUntil(waiter_,
+        [this]{ return tryCases(); },
+        [this](SelectWaiter *w){ for(auto &c : cases_) c.add(w); },
+        [this](SelectWaiter *w){ for(auto &c : cases_) c.remove(w); },
+        deadline);
+}
+
+inline int Selector::trySelect()
+{
+    return tryCases();
+}
+
+inline int Selector::select()
+{
+    return selectUntil(nullptr);
+}
+
+template<typename Rep, typename Period>
+int Selector::select(const std::chrono::duration<Rep, Period> &timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+    return selectUntil(&deadline);
+}
@@ -0,0 +1,113 @@
+# pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/**
+ * A thread blocked in a select over several queues (see Select.h).
+ *
+ * <p>The selecting thread registers one waiter with every queue it
+ * selects on. A queue signals all registered waiters after each
+ * insertion; the selecting thread then polls its queues again. The
+ * signal is latched, so an insertion between the poll and the wait is
+ * never lost.
+ */
+class SelectWaiter
+{
+    public:
+        SelectWaiter(): signalled_(false) {}
+        SelectWaiter(const SelectWaiter&) = delete;
+        SelectWaiter& operator=(const SelectWaiter&) = delete;
+
+        void signal();
+        void reset();
+
+        /** Waits for a signal; returns false if the deadline passed first. */
+        bool await(const std::chrono::steady_clock::time_point *deadline);
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool signalled_;
+};
+
+inline void SelectWaiter::signal()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    signalled_ = true;
+    cond_.notify_one();
+}
+
+inline void SelectWaiter::reset()
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    signalled_ = false;
+}
+
+inline bool SelectWaiter::await(const std::chrono::steady_clock::time_point *deadline)
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    if(deadline == nullptr)
+    {
+        cond_.wait(lk, [this]{ return signalled_; });
+        return true;
+    }
+    return cond_.wait_until(lk, *deadline, [this]{ return signalled_; });
+}
+
+/**
+ * The select waiters registered with one queue.
+ *
+ * <p>signalAll() is called on every insertion, so its fast path is a
+ * single load of the waiter count. That load and the increment in
+ * add() are sequentially consistent: a selecting thread registers and
+ * then reads the queue, a producer writes the queue and then reads the
+ * count, so at least one of them sees the other even when the queue
+ * uses separate put and take locks.
+ */
+class WaiterList
+{
+    public:
+        WaiterList(): size_(0) {}
+        WaiterList(const WaiterList&) = delete;
+        WaiterList& operator=(const WaiterList&) = delete;
+
+        void add(SelectWaiter *waiter);
+        void remove(SelectWaiter *waiter);
+        void signalAll();
+
+    private:
+        std::mutex mutex_;
+        std::vector<SelectWaiter*> waiters_;
+        std::atomic<int> size_;
+};
+
+inline void WaiterList::add(SelectWaiter *waiter)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    waiters_.push_back(waiter);
+    size_.fetch_add(1);
+}
+
+inline void WaiterList::remove(SelectWaiter *waiter)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto it = std::find(waiters_.begin(), waiters_.end(), waiter);
+    if(it != waiters_.end())
+    {
+        waiters_.erase(it);
+        size_.fetch_sub(1);
+    }
+}
+
+inline void WaiterList::signalAll()
+{
+    if(size_.load() == 0)
+        return;
+    std::lock_guard<std::mutex> lk(mutex_);
+    for(SelectWaiter *waiter : waiters_)
+        waiter->signal();
+}
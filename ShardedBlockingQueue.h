@@ -0,0 +1,352 @@
+# pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#include "ArrayBlockingQueue.h"
+
+/**
+ * How a thread picks its home shard.
+ */
+enum class ShardAffinity
+{
+    /** Threads are numbered round-robin on first use */
+    Thread,
+    /** The CPU the thread is running on (Linux), else as Thread */
+    Cpu
+};
+
+/**
+ * A bounded blocking queue made of N independent ArrayBlockingQueue
+ * shards, for many producers and consumers that do not need a global
+ * FIFO order.
+ *
+ * <p>Every thread has a home shard. Puts go to the home shard and
+ * spill over to the next shards only if it is full; takes drain the
+ * home shard and steal from the other shards once it is empty. Each
+ * shard has its own lock, count and indices on separate cache lines,
+ * so threads working on different shards do not contend. Order is FIFO
+ * per shard only.
+ *
+ * <p>A put blocks only when every shard is full, a take only when every
+ * shard is empty. Blocked threads park on one shared condition; the
+ * counts of parked threads are read after every operation, which is a
+ * load of a rarely written cache line unless someone is actually
+ * parked.
+ */
+template<typename T, typename Lock = std::mutex>
+class ShardedBlockingQueue
+{
+    public:
+        explicit ShardedBlockingQueue(int shards, int shardCapacity,
+                                      ShardAffinity affinity = ShardAffinity::Thread);
+        ShardedBlockingQueue(const ShardedBlockingQueue&) = delete;
+        ShardedBlockingQueue& operator=(const ShardedBlockingQueue&) = delete;
+
+        void put(const T &value);
+        void put(T &&value);
+        bool offer(const T &value);
+        bool offer(T &&value);
+
+        /** Constructs an element and puts it. */
+        template<typename... Args>
+        void emplace(Args&&... args);
+
+        std::shared_ptr<T> take();
+        std::shared_ptr<T> poll();
+
+        bool empty() const;
+        int size() const;
+        int capacity() const;
+        int shards() const;
+        QueueStatsSnapshot stats() const;
+
+    private:
+        /** One shard per allocation, aligned so shards share no line */
+        struct alignas(64) Shard
+        {
+            explicit Shard(int capacity): queue(capacity) {}
+            ArrayBlockingQueue<T, Lock> queue;
+        };
+
+        int homeShard() const;
+        template<typename U>
+        void putValue(U &&value);
+        template<typename U>
+        bool tryPut(U &&value);
+        std::shared_ptr<T> tryTake();
+        void signalNotEmpty();
+        void signalNotFull();
+
+    private:
+        std::vector<std::unique_ptr<Shard>> shards_;
+
+        const ShardAffinity affinity_;
+
+        /** Lock for parking, held only around blocking waits and signals */
+        std::mutex parkMutex_;
+
+        /** Condition for takes waiting for any shard to be non-empty */
+        std::condition_variable notEmpty_;
+
+        /** Condition for puts waiting for any shard to be non-full */
+        std::condition_variable notFull_;
+
+        /** Number of parked takes, written only under parkMutex_ */
+        alignas(64) std::atomic<int> waitingTakes_;
+
+        /** Number of parked puts, written only under parkMutex_ */
+        alignas(64) std::atomic<int> waitingPuts_;
+};
+
+template<typename T, typename Lock>
+ShardedBlockingQueue<T, Lock>::ShardedBlockingQueue(int shards, int shardCapacity,
+                                                    ShardAffinity affinity):
+    affinity_(affinity),
+    waitingTakes_(0),
+    waitingPuts_(0)
+{
+    for(int i = 0; i < shards; ++i)
+        shards_.emplace_back(new Shard(shardCapacity));
+}
+
+template<typename T, typename Lock>
+int ShardedBlockingQueue<T, Lock>::homeShard() const
+{
+#if defined(__linux__)
+    if(affinity_ == ShardAffinity::Cpu)
+    {
+        int cpu = sched_getcpu();
+        if(cpu >= 0)
+            return cpu % static_cast<int>(shards_.size());
+    }
+#endif
+    static std::atomic<unsigned> nextThread(0);
+    thread_local unsigned thread = nextThread.fetch_add(1, std::memory_order_relaxed);
+    return static_cast<int>(thread % shards_.size());
+}
+
+/**
+ * Offers to the home shard first, then to the others in turn. A shard
+ * moves from an rvalue only when it accepts it, so the same value can
+ * be offered to each shard.
+ */
+template<typename T, typename Lock>
+template<typename U>
+bool ShardedBlockingQueue<T, Lock>::tryPut(U &&value)
+{
+    const int n = static_cast<int>(shards_.size());
+    const int home = homeShard();
+    for(int k = 0; k < n; ++k)
+    {
+        int i = home + k < n ? home + k : home + k - n;
+        if(shards_[i]->queue.offer(std::forward<U>(value)))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Polls the home shard first, then steals from the others in turn.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> ShardedBlockingQueue<T, Lock>::tryTake()
+{
+    const int n = static_cast<int>(shards_.size());
+    const int home = homeShard();
+    for(int k = 0; k < n; ++k)
+    {
+        int i = home + k < n ? home + k : home + k - n;
+        std::shared_ptr<T> res = shards_[i]->queue.poll();
+        if(res != nullptr)
+            return res;
+    }
+    return std::shared_ptr<T>();
+}
+
+/*
+ * A parking thread increments its waiting count and then scans the
+ * shards; a signalling thread updates a shard and then reads the count.
+ * Both are sequentially consistent, so either the scan finds the
+ * element or the signaller sees the parked thread. The signal itself
+ * is sent under parkMutex_, after the parked thread has started to
+ * wait.
+ */
+
+template<typename T, typename Lock>
+void ShardedBlockingQueue<T, Lock>::signalNotEmpty()
+{
+    if(waitingTakes_.load() == 0)
+        return;
+    std::lock_guard<std::mutex> lk(parkMutex_);
+    notEmpty_.notify_one();
+}
+
+template<typename T, typename Lock>
+void ShardedBlockingQueue<T, Lock>::signalNotFull()
+{
+    if(waitingPuts_.load() == 0)
+        return;
+    std::lock_guard<std::mutex> lk(parkMutex_);
+    notFull_.notify_one();
+}
+
+/* Inserts the specified element into this queue,
+ * waiting if necessary for space to become available in any shard.
+ */
+template<typename T, typename Lock>
+void ShardedBlockingQueue<T, Lock>::put(const T &value)
+{
+    putValue(value);
+}
+
+template<typename T, typename Lock>
+void ShardedBlockingQueue<T, Lock>::put(T &&value)
+{
+    putValue(std::move(value));
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void ShardedBlockingQueue<T, Lock>::emplace(Args&&... args)
+{
+    putValue(T(std::forward<Args>(args)...));
+}
+
+template<typename T, typename Lock>
+template<typename U>
+void ShardedBlockingQueue<T, Lock>::putValue(U &&value)
+{
+    while(!tryPut(std::forward<U>(value)))
+    {
+        std::unique_lock<std::mutex> lk(parkMutex_);
+        waitingPuts_.fetch_add(1);
+        bool done = tryPut(std::forward<U>(value));
+        if(!done)
+            notFull_.wait(lk);
+        waitingPuts_.fetch_sub(1);
+        if(done)
+            break;
+    }
+    signalNotEmpty();
+}
+
+template<typename T, typename Lock>
+bool ShardedBlockingQueue<T, Lock>::offer(const T &value)
+{
+    if(!tryPut(value))
+        return false;
+    signalNotEmpty();
+    return true;
+}
+
+template<typename T, typename Lock>
+bool ShardedBlockingQueue<T, Lock>::offer(T &&value)
+{
+    if(!tryPut(std::move(value)))
+        return false;
+    signalNotEmpty();
+    return true;
+}
+
+/* Retrieves and removes an element, preferring the home shard,
+ * waiting if necessary until any shard has one.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> ShardedBlockingQueue<T, Lock>::take()
+{
+    std::shared_ptr<T> res = tryTake();
+    while(res == nullptr)
+    {
+        std::unique_lock<std::mutex> lk(parkMutex_);
+        waitingTakes_.fetch_add(1);
+        res = tryTake();
+        if(res == nullptr)
+        {
+            notEmpty_.wait(lk);
+            waitingTakes_.fetch_sub(1);
+            lk.unlock();
+            res = tryTake();
+        }
+        else
+            waitingTakes_.fetch_sub(1);
+    }
+    signalNotFull();
+    return res;
+}
+
+template<typename T, typename Lock>
+std::shared_ptr<T> ShardedBlockingQueue<T, Lock>::poll()
+{
+    std::shared_ptr<T> res = tryTake();
+    if(res != nullptr)
+        signalNotFull();
+    return res;
+}
+
+template<typename T, typename Lock>
+bool ShardedBlockingQueue<T, Lock>::empty() const
+{
+    for(const auto &shard : shards_)
+        if(!shard->queue.empty())
+            return false;
+    return true;
+}
+
+/**
+ * Sum of the shard sizes. Shards are read one after another, so the
+ * result is only a snapshot while other threads are active.
+ */
+template<typename T, typename Lock>
+int ShardedBlockingQueue<T, Lock>::size() const
+{
+    int n = 0;
+    for(const auto &shard : shards_)
+        n += shard->queue.size();
+    return n;
+}
+
+template<typename T, typename Lock>
+int ShardedBlockingQueue<T, Lock>::capacity() const
+{
+    int n = 0;
+    for(const auto &shard : shards_)
+        n += shard->queue.capacity();
+    return n;
+}
+
+template<typename T, typename Lock>
+int ShardedBlockingQueue<T, Lock>::shards() const
+{
+    return static_cast<int>(shards_.size());
+}
+
+/**
+ * Returns the statistics of all shards combined; maxDepth is the
+ * largest high-water mark of any single shard.
+ */
+template<typename T, typename Lock>
+QueueStatsSnapshot ShardedBlockingQueue<T, Lock>::stats() const
+{
+    QueueStatsSnapshot total;
+    for(const auto &shard : shards_)
+    {
+        QueueStatsSnapshot s = shard->queue.stats();
+        total.puts += s.puts;
+        total.takes += s.takes;
+        total.putsBlocked += s.putsBlocked;
+        total.takesBlocked += s.takesBlocked;
+        total.putWaitNanos += s.putWaitNanos;
+        total.takeWaitNanos += s.takeWaitNanos;
+        total.contended += s.contended;
+        if(s.maxDepth > total.maxDepth)
+            total.maxDepth = s.maxDepth;
+    }
+    return total;
+}
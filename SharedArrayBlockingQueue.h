@@ -0,0 +1,420 @@
+# pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "QueueStats.h"
+
+/**
+ * A bounded blocking queue between processes on one host, backed by a
+ * POSIX shared memory object.
+ *
+ * <p>The header, the indices and the slots all live in the mapped
+ * region, so an element is copied exactly once on each side and a
+ * handoff costs no system call unless a thread has to block. Blocking
+ * uses a {@code PTHREAD_PROCESS_SHARED} mutex and condition variables
+ * kept in the header. T must be trivially copyable, since the slots
+ * are plain bytes to every process that maps them.
+ *
+ * <pre>
+ *   // server
+ *   auto q = SharedArrayBlockingQueue&lt;Tick&gt;::create("/ticks", 4096);
+ *   // client, in another process
+ *   auto q = SharedArrayBlockingQueue&lt;Tick&gt;::attach("/ticks");
+ * </pre>
+ *
+ * <p>Crash safety. The mutex is robust: if a process dies while holding
+ * it, the next locker is told so and repairs the queue. The queue keeps
+ * two monotonic 64 bit counters, putSeq and takeSeq, and every
+ * operation copies its element first and bumps its counter last, so
+ * the indices are consistent at any point a process may die. An
+ * element being written by a dying producer is lost, an element being
+ * read by a dying consumer is delivered again. After a repair all
+ * waiters are woken, in case the dead process was due to signal them.
+ *
+ * <p>The shared object outlives the processes that map it; call
+ * remove() once it is no longer needed.
+ */
+template<typename T>
+class SharedArrayBlockingQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SharedArrayBlockingQueue requires a trivially copyable T");
+
+    public:
+        /**
+         * Creates and maps a new shared object of the given name,
+         * which must not exist yet. Returns nullptr on failure.
+         */
+        static std::unique_ptr<SharedArrayBlockingQueue> create(const std::string &name, int capacity);
+
+        /**
+         * Maps an existing queue created with the same T. Returns
+         * nullptr if it does not exist or does not match.
+         */
+        static std::unique_ptr<SharedArrayBlockingQueue> attach(const std::string &name);
+
+        /** Removes the name of the shared object; mappings stay valid. */
+        static bool remove(const std::string &name);
+
+        ~SharedArrayBlockingQueue();
+        SharedArrayBlockingQueue(const SharedArrayBlockingQueue&) = delete;
+        SharedArrayBlockingQueue& operator=(const SharedArrayBlockingQueue&) = delete;
+
+        void put(const T &value);
+        bool offer(const T &value);
+        std::shared_ptr<T> take();
+        std::shared_ptr<T> poll();
+
+        bool empty() const;
+        bool full() const;
+        int size() const;
+        int capacity() const;
+
+        /** Statistics of the operations of this process only. */
+        QueueStatsSnapshot stats() const;
+
+    private:
+        static const std::uint32_t kMagic = 0x4a544251; // "JTBQ"
+        static const std::uint32_t kVersion = 1;
+
+        /** The start of the shared region */
+        struct Header
+        {
+            /** kMagic once the creator has initialized the header */
+            std::atomic<std::uint32_t> magic;
+            std::uint32_t version;
+            std::uint32_t elementSize;
+            std::uint32_t capacity;
+
+            pthread_mutex_t mutex;
+            pthread_cond_t notEmpty;
+            pthread_cond_t notFull;
+
+            /** Number of elements ever put; the next put index is putSeq % capacity */
+            std::uint64_t putSeq;
+
+            /** Number of elements ever taken */
+            std::uint64_t takeSeq;
+        };
+
+        static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+                      "the header flag must be address free");
+
+        /** Holds the shared mutex, repairing the queue if its owner died. */
+        class Guard
+        {
+            public:
+                explicit Guard(const SharedArrayBlockingQueue &queue);
+                ~Guard();
+                Guard(const Guard&) = delete;
+                Guard& operator=(const Guard&) = delete;
+                void wait(pthread_cond_t *cond);
+            private:
+                Header *header_;
+        };
+
+        SharedArrayBlockingQueue(int fd, void *region, std::size_t length);
+
+        static std::size_t slotsOffset();
+        static std::size_t regionLength(int capacity);
+        static void recover(Header *header);
+
+        T *slot(std::uint64_t seq) const;
+        void enqueue(const T &value);
+        std::shared_ptr<T> dequeue();
+
+    private:
+        const int fd_;
+        void *const region_;
+        const std::size_t length_;
+        Header *const header_;
+        T *const slots_;
+
+        /** Runtime statistics, empty unless JAVATHREAD_ENABLE_STATS */
+        QueueStats stats_;
+};
+
+template<typename T>
+SharedArrayBlockingQueue<T>::SharedArrayBlockingQueue(int fd, void *region, std::size_t length):
+    fd_(fd),
+    region_(region),
+    length_(length),
+    header_(static_cast<Header*>(region)),
+    slots_(reinterpret_cast<T*>(static_cast<char*>(region) + slotsOffset()))
+{
+}
+
+template<typename T>
+SharedArrayBlockingQueue<T>::~SharedArrayBlockingQueue()
+{
+    munmap(region_, length_);
+    close(fd_);
+}
+
+/* Slots start on a cache line of their own, after the header. */
+template<typename T>
+std::size_t SharedArrayBlockingQueue<T>::slotsOffset()
+{
+    const std::size_t align = alignof(T) > 64 ? alignof(T) : 64;
+    return (sizeof(Header) + align - 1) / align * align;
+}
+
+template<typename T>
+std::size_t SharedArrayBlockingQueue<T>::regionLength(int capacity)
+{
+    return slotsOffset() + sizeof(T) * static_cast<std::size_t>(capacity);
+}
+
+template<typename T>
+std::unique_ptr<SharedArrayBlockingQueue<T>>
+SharedArrayBlockingQueue<T>::create(const std::string &name, int capacity)
+{
+    if(capacity <= 0)
+        return nullptr;
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0)
+        return nullptr;
+    const std::size_t length = regionLength(capacity);
+    void *region = MAP_FAILED;
+    if(ftruncate(fd, static_cast<off_t>(length)) == 0)
+        region = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(region == MAP_FAILED)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    /* ftruncate zero-fills, so magic reads 0 until the header is ready */
+    Header *header = static_cast<Header*>(region);
+    header->version = kVersion;
+    header->elementSize = sizeof(T);
+    header->capacity = static_cast<std::uint32_t>(capacity);
+    header->putSeq = 0;
+    header->takeSeq = 0;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&header->notEmpty, &cattr);
+    pthread_cond_init(&header->notFull, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    header->magic.store(kMagic, std::memory_order_release);
+    return std::unique_ptr<SharedArrayBlockingQueue>(new SharedArrayBlockingQueue(fd, region, length));
+}
+
+template<typename T>
+std::unique_ptr<SharedArrayBlockingQueue<T>>
+SharedArrayBlockingQueue<T>::attach(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if(fd < 0)
+        return nullptr;
+    struct stat st;
+    void *region = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) >= sizeof(Header))
+        region = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    if(region == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+    const std::size_t length = static_cast<std::size_t>(st.st_size);
+
+    /* the creator may still be initializing the header */
+    Header *header = static_cast<Header*>(region);
+    for(int i = 0; i < 1000 && header->magic.load(std::memory_order_acquire) != kMagic; ++i)
+        std::this_thread::yield();
+    if(header->magic.load(std::memory_order_acquire) != kMagic ||
+       header->version != kVersion ||
+       header->elementSize != sizeof(T) ||
+       regionLength(static_cast<int>(header->capacity)) > length)
+    {
+        munmap(region, length);
+        close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<SharedArrayBlockingQueue>(new SharedArrayBlockingQueue(fd, region, length));
+}
+
+template<typename T>
+bool SharedArrayBlockingQueue<T>::remove(const std::string &name)
+{
+    return shm_unlink(name.c_str()) == 0;
+}
+
+/**
+ * Repairs the queue after the owner of the mutex died. Call only when
+ * holding the mutex returned with EOWNERDEAD.
+ */
+template<typename T>
+void SharedArrayBlockingQueue<T>::recover(Header *header)
+{
+    /* the counters are only ever bumped after a complete copy, so they
+     * cannot be torn; clamp them anyway against a corrupted region */
+    if(header->takeSeq > header->putSeq)
+        header->takeSeq = header->putSeq;
+    if(header->putSeq - header->takeSeq > header->capacity)
+        header->takeSeq = header->putSeq - header->capacity;
+    pthread_mutex_consistent(&header->mutex);
+    pthread_cond_broadcast(&header->notEmpty);
+    pthread_cond_broadcast(&header->notFull);
+}
+
+template<typename T>
+SharedArrayBlockingQueue<T>::Guard::Guard(const SharedArrayBlockingQueue &queue):
+    header_(queue.header_)
+{
+    if(pthread_mutex_lock(&header_->mutex) == EOWNERDEAD)
+        recover(header_);
+}
+
+template<typename T>
+SharedArrayBlockingQueue<T>::Guard::~Guard()
+{
+    pthread_mutex_unlock(&header_->mutex);
+}
+
+template<typename T>
+void SharedArrayBlockingQueue<T>::Guard::wait(pthread_cond_t *cond)
+{
+    if(pthread_cond_wait(cond, &header_->mutex) == EOWNERDEAD)
+        recover(header_);
+}
+
+template<typename T>
+T *SharedArrayBlockingQueue<T>::slot(std::uint64_t seq) const
+{
+    return slots_ + seq % header_->capacity;
+}
+
+/**
+ * Copies the element into the slot at putSeq, then publishes it by
+ * bumping putSeq. Call only when holding the mutex and not full.
+ */
+template<typename T>
+void SharedArrayBlockingQueue<T>::enqueue(const T &value)
+{
+    std::memcpy(static_cast<void*>(slot(header_->putSeq)), &value, sizeof(T));
+    std::uint64_t count = ++header_->putSeq - header_->takeSeq;
+    stats_.recordPut(count);
+    pthread_cond_signal(&header_->notEmpty);
+}
+
+/**
+ * Copies the element out of the slot at takeSeq, then frees it by
+ * bumping takeSeq. Call only when holding the mutex and not empty.
+ */
+template<typename T>
+std::shared_ptr<T> SharedArrayBlockingQueue<T>::dequeue()
+{
+    std::shared_ptr<T> const res(std::make_shared<T>(*slot(header_->takeSeq)));
+    ++header_->takeSeq;
+    stats_.recordTake();
+    pthread_cond_signal(&header_->notFull);
+    return res;
+}
+
+/* Inserts the specified element into this queue,
+ * waiting if necessary for space to become available.
+ */
+template<typename T>
+void SharedArrayBlockingQueue<T>::put(const T &value)
+{
+    Guard lk(*this);
+    QueueStats::WaitScope wait(stats_, true);
+    while(header_->putSeq - header_->takeSeq >= header_->capacity)
+    {
+        wait.blocked();
+        lk.wait(&header_->notFull);
+    }
+    enqueue(value);
+}
+
+template<typename T>
+bool SharedArrayBlockingQueue<T>::offer(const T &value)
+{
+    Guard lk(*this);
+    if(header_->putSeq - header_->takeSeq >= header_->capacity)
+        return false;
+    enqueue(value);
+    return true;
+}
+
+/* Retrieves and removes the head of this queue,
+ * waiting if necessary until an element becomes available.
+ */
+template<typename T>
+std::shared_ptr<T> SharedArrayBlockingQueue<T>::take()
+{
+    Guard lk(*this);
+    QueueStats::WaitScope wait(stats_, false);
+    while(header_->putSeq == header_->takeSeq)
+    {
+        wait.blocked();
+        lk.wait(&header_->notEmpty);
+    }
+    return dequeue();
+}
+
+template<typename T>
+std::shared_ptr<T> SharedArrayBlockingQueue<T>::poll()
+{
+    Guard lk(*this);
+    if(header_->putSeq == header_->takeSeq)
+        return std::shared_ptr<T>();
+    return dequeue();
+}
+
+template<typename T>
+bool SharedArrayBlockingQueue<T>::empty() const
+{
+    Guard lk(*this);
+    return header_->putSeq == header_->takeSeq;
+}
+
+template<typename T>
+bool SharedArrayBlockingQueue<T>::full() const
+{
+    Guard lk(*this);
+    return header_->putSeq - header_->takeSeq >= header_->capacity;
+}
+
+template<typename T>
+int SharedArrayBlockingQueue<T>::size() const
+{
+    Guard lk(*this);
+    return static_cast<int>(header_->putSeq - header_->takeSeq);
+}
+
+template<typename T>
+int SharedArrayBlockingQueue<T>::capacity() const
+{
+    return static_cast<int>(header_->capacity);
+}
+
+template<typename T>
+QueueStatsSnapshot SharedArrayBlockingQueue<T>::stats() const
+{
+    return stats_.snapshot();
+}
@@ -0,0 +1,248 @@
+# pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Configuration of the overflow mode of LinkedBlockingQueue.
+ *
+ * <p>While the queue holds fewer than {@code memoryElements} elements,
+ * and fewer than {@code memoryBytes} bytes if that is not zero, new
+ * elements are kept in memory. Past that budget they are encoded and
+ * appended to a SpillStore in {@code directory}, and read back once the
+ * in-memory elements have been taken.
+ *
+ * <p>For a trivially copyable T the codec and sizeOf may be left empty:
+ * elements are then stored as their object representation and count
+ * sizeof(T) bytes. Any other T needs encode and decode.
+ */
+template<typename T>
+struct SpillOptions
+{
+    /** Directory of the segment files */
+    std::string directory = "/tmp";
+
+    /** Maximum number of elements kept in memory */
+    int memoryElements = 1 << 16;
+
+    /** Maximum number of bytes kept in memory, by sizeOf; 0 for no limit */
+    std::size_t memoryBytes = 0;
+
+    /** Size of one segment file */
+    std::size_t segmentBytes = std::size_t(64) << 20;
+
+    /** Accounted size of an element */
+    std::function<std::size_t(const T&)> sizeOf;
+
+    /** Serializes an element, replacing the contents of the buffer */
+    std::function<void(const T&, std::string&)> encode;
+
+    /** Rebuilds an element from the bytes written by encode */
+    std::function<T(const char*, std::size_t)> decode;
+};
+
+/**
+ * Fills in the codec and sizeOf left empty for a trivially copyable T.
+ * Throws std::invalid_argument if encode or decode is still missing.
+ */
+template<typename T>
+void completeSpillOptions(SpillOptions<T> &options)
+{
+    if(!options.sizeOf)
+        options.sizeOf = [](const T&){ return sizeof(T); };
+    if constexpr(std::is_trivially_copyable<T>::value)
+    {
+        if(!options.encode)
+            options.encode = [](const T &value, std::string &out){
+                out.assign(reinterpret_cast<const char*>(&value), sizeof(T));
+            };
+        if(!options.decode)
+            options.decode = [](const char *data, std::size_t){
+                T value;
+                std::memcpy(static_cast<void*>(&value), data, sizeof(T));
+                return value;
+            };
+    }
+    if(!options.encode || !options.decode)
+        throw std::invalid_argument("SpillOptions: encode and decode are required for this T");
+}
+
+/**
+ * An append-only FIFO of byte records kept in memory-mapped segment
+ * files.
+ *
+ * <p>Records are written length-prefixed at the end of the newest
+ * segment and read back from the oldest one. A segment is unmapped and
+ * its file released as soon as its last record has been read. Files are
+ * unlinked right after creation, so nothing is left behind if the
+ * process dies, and their space is reserved up front so a full disk
+ * shows up as an error from append() instead of a SIGBUS.
+ *
+ * <p>Pages are dropped from the mapping once written and once read, in
+ * steps of kReleaseBytes; the data stays in the page cache and the file,
+ * so the resident size of the process stays small however much is
+ * spilled.
+ *
+ * <p>Not thread-safe; the owning queue serializes access.
+ */
+class SpillStore
+{
+    public:
+        explicit SpillStore(const std::string &directory,
+                            std::size_t segmentBytes = std::size_t(64) << 20);
+        ~SpillStore();
+        SpillStore(const SpillStore&) = delete;
+        SpillStore& operator=(const SpillStore&) = delete;
+
+        /**
+         * Appends a record; throws std::system_error on I/O failure and
+         * std::length_error for a record of 4 GiB or more.
+         */
+        void append(const char *data, std::size_t length);
+
+        /** Reads and removes the oldest record; false if there is none. */
+        bool readNext(std::string &record);
+
+        /** Removes every record and releases every segment. */
+        void clear();
+
+        bool empty() const { return records_ == 0; }
+        std::size_t records() const { return records_; }
+        std::size_t segments() const { return segments_.size(); }
+
+    private:
+        static const std::size_t kReleaseBytes = std::size_t(1) << 20;
+        typedef std::uint32_t Length;
+
+        struct Segment
+        {
+            int fd;
+            char *map;
+            std::size_t size;
+            std::size_t writeOffset;
+            std::size_t readOffset;
+            /** Bytes below this offset are dropped from the mapping */
+            std::size_t writeReleased;
+            std::size_t readReleased;
+        };
+
+        void openSegment(std::size_t minBytes);
+        static void closeSegment(Segment &segment);
+        static void release(Segment &segment, std::size_t &released, std::size_t upTo);
+
+        const std::string directory_;
+        const std::size_t segmentBytes_;
+        std::deque<Segment> segments_;
+        std::size_t records_;
+};
+
+inline SpillStore::SpillStore(const std::string &directory, std::size_t segmentBytes):
+    directory_(directory),
+    segmentBytes_(segmentBytes),
+    records_(0)
+{
+}
+
+inline SpillStore::~SpillStore()
+{
+    clear();
+}
+
+inline void SpillStore::openSegment(std::size_t minBytes)
+{
+    std::string path = directory_ + "/javathread-spill-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if(fd < 0)
+        throw std::system_error(errno, std::generic_category(), "spill segment " + path);
+    unlink(path.c_str());
+
+    const std::size_t size = minBytes > segmentBytes_ ? minBytes : segmentBytes_;
+    int err = posix_fallocate(fd, 0, static_cast<off_t>(size));
+    void *map = MAP_FAILED;
+    if(err == 0)
+    {
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(map == MAP_FAILED)
+            err = errno;
+    }
+    if(err != 0)
+    {
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "spill segment " + path);
+    }
+    segments_.push_back(Segment{ fd, static_cast<char*>(map), size, 0, 0, 0, 0 });
+}
+
+inline void SpillStore::closeSegment(Segment &segment)
+{
+    munmap(segment.map, segment.size);
+    close(segment.fd);
+}
+
+/* Drops whole kReleaseBytes steps below upTo from the mapping. The
+ * mapping is shared, so written data survives in the file. */
+inline void SpillStore::release(Segment &segment, std::size_t &released, std::size_t upTo)
+{
+    if(upTo - released < kReleaseBytes)
+        return;
+    std::size_t end = upTo / kReleaseBytes * kReleaseBytes;
+    madvise(segment.map + released, end - released, MADV_DONTNEED);
+    released = end;
+}
+
+inline void SpillStore::append(const char *data, std::size_t length)
+{
+    if(length > std::numeric_limits<Length>::max())
+        throw std::length_error("SpillStore: record too long for its length prefix");
+    const std::size_t needed = sizeof(Length) + length;
+    if(segments_.empty() || segments_.back().size - segments_.back().writeOffset < needed)
+        openSegment(needed);
+    Segment &segment = segments_.back();
+    Length prefix = static_cast<Length>(length);
+    std::memcpy(segment.map + segment.writeOffset, &prefix, sizeof(Length));
+    std::memcpy(segment.map + segment.writeOffset + sizeof(Length), data, length);
+    segment.writeOffset += needed;
+    ++records_;
+    release(segment, segment.writeReleased, segment.writeOffset);
+}
+
+inline bool SpillStore::readNext(std::string &record)
+{
+    if(records_ == 0)
+        return false;
+    Segment &segment = segments_.front();
+    Length length;
+    std::memcpy(&length, segment.map + segment.readOffset, sizeof(Length));
+    record.assign(segment.map + segment.readOffset + sizeof(Length), length);
+    segment.readOffset += sizeof(Length) + length;
+    --records_;
+    release(segment, segment.readReleased, segment.readOffset);
+    if(records_ == 0)
+        clear();
+    else if(segment.readOffset == segment.writeOffset)
+    {
+        closeSegment(segment);
+        segments_.pop_front();
+    }
+    return true;
+}
+
+inline void SpillStore::clear()
+{
+    for(Segment &segment : segments_)
+        closeSegment(segment);
+    segments_.clear();
+    records_ = 0;
+}
@@ -0,0 +1,212 @@
+# pragma once
+#include <atomic>
+#include <cstdint>
+#include "ParkingLot.h"
+
+/**
+ * A capability-based lock with three modes for controlling read/write
+ * access. Acquiring the lock returns a stamp that represents and
+ * controls access with respect to a lock state; the stamp is passed
+ * back to release or validate it.
+ *
+ * <ul>
+ * <li>writeLock() blocks for exclusive access and returns a stamp for
+ * unlockWrite().
+ * <li>readLock() blocks for shared access and returns a stamp for
+ * unlockRead().
+ * <li>tryOptimisticRead() returns a non-zero stamp unless the lock is
+ * held or being acquired for writing. The caller then reads the
+ * protected data and checks validate(stamp): if no writer came in
+ * between, the values read are consistent. The read writes nothing to
+ * shared memory, so any number of threads can read at once without
+ * the lock's cache line ever leaving the shared state.
+ * </ul>
+ *
+ * <p>The whole state is one 64-bit word: the count of pessimistic
+ * readers in the low bits, then the write bit, then a version that
+ * every write release increments. Write and optimistic stamps are
+ * values of that word with the reader count masked off, and validation
+ * compares only the write bit and version, so optimistic reading is a
+ * seqlock.
+ *
+ * <p>As with any seqlock, data read optimistically may be torn while a
+ * writer runs, and must not be acted upon before validate() succeeds.
+ * In C++ the protected fields should be atomics accessed with
+ * memory_order_relaxed (or copied out with std::atomic_ref style
+ * accessors), since a plain racing read is undefined behaviour even
+ * when its result is discarded.
+ *
+ * <p>A writer sets the write bit as soon as no other writer holds it
+ * and then waits for the readers to drain, so new readers and
+ * optimistic readers fail from that point on and writers are not
+ * starved. The lock is not reentrant. Waiting threads spin and then
+ * park (see ParkingLot.h).
+ */
+class StampedLock
+{
+    public:
+        StampedLock() = default;
+        StampedLock(const StampedLock&) = delete;
+        StampedLock& operator=(const StampedLock&) = delete;
+
+        std::uint64_t writeLock();
+        /** Returns 0 if the lock is not immediately available */
+        std::uint64_t tryWriteLock();
+        void unlockWrite(std::uint64_t stamp);
+
+        std::uint64_t readLock();
+        /** Returns 0 if the lock is not immediately available */
+        std::uint64_t tryReadLock();
+        void unlockRead(std::uint64_t stamp);
+
+        /** Returns 0 if the lock is write-locked */
+        std::uint64_t tryOptimisticRead() const;
+
+        /**
+         * Returns true if the lock has not been write-locked since the
+         * stamp was issued. Always false for a stamp of 0.
+         */
+        bool validate(std::uint64_t stamp) const;
+
+        /**
+         * Upgrades a stamp to a write stamp if the lock can be taken
+         * without waiting: from a write stamp, from a read stamp whose
+         * holder is the only reader, or from a valid optimistic stamp.
+         * Returns 0 otherwise; the caller keeps the mode it had.
+         */
+        std::uint64_t tryConvertToWriteLock(std::uint64_t stamp);
+
+        bool isWriteLocked() const;
+        bool isReadLocked() const;
+        int getReadLockCount() const;
+
+    private:
+        static const std::uint64_t kReaderMask = 0x7fffffffull;
+        static const std::uint64_t kWriteBit = kReaderMask + 1;
+        /** Write bit and version: what a stamp is compared on */
+        static const std::uint64_t kStampMask = ~kReaderMask;
+
+        bool readersDrained() const { return (state_.load() & kReaderMask) == 0; }
+
+        alignas(64) std::atomic<std::uint64_t> state_{kWriteBit << 1};
+};
+
+inline std::uint64_t StampedLock::writeLock()
+{
+    std::uint64_t s = state_.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        if((s & kWriteBit) == 0)
+        {
+            if(state_.compare_exchange_weak(s, s | kWriteBit))
+                break;
+            continue;
+        }
+        ParkingLot::parkWhile(&state_, [this]{ return (state_.load() & kWriteBit) != 0; });
+        s = state_.load(std::memory_order_relaxed);
+    }
+    ParkingLot::parkWhile(&state_, [this]{ return !readersDrained(); });
+    /* keep the writes to the data after the write bit for optimistic readers */
+    std::atomic_thread_fence(std::memory_order_release);
+    return (s | kWriteBit) & kStampMask;
+}
+
+inline std::uint64_t StampedLock::tryWriteLock()
+{
+    std::uint64_t s = state_.load(std::memory_order_relaxed);
+    if((s & (kWriteBit | kReaderMask)) != 0 ||
+       !state_.compare_exchange_strong(s, s | kWriteBit))
+        return 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    return (s | kWriteBit) & kStampMask;
+}
+
+inline void StampedLock::unlockWrite(std::uint64_t stamp)
+{
+    /* clearing the write bit by adding it carries into the version */
+    state_.store(stamp + kWriteBit);
+    ParkingLot::unparkAll(&state_);
+}
+
+inline std::uint64_t StampedLock::readLock()
+{
+    std::uint64_t s = state_.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        if((s & kWriteBit) == 0)
+        {
+            if(state_.compare_exchange_weak(s, s + 1))
+                return s + 1;
+            continue;
+        }
+        ParkingLot::parkWhile(&state_, [this]{ return (state_.load() & kWriteBit) != 0; });
+        s = state_.load(std::memory_order_relaxed);
+    }
+}
+
+inline std::uint64_t StampedLock::tryReadLock()
+{
+    std::uint64_t s = state_.load(std::memory_order_relaxed);
+    while((s & kWriteBit) == 0)
+        if(state_.compare_exchange_weak(s, s + 1))
+            return s + 1;
+    return 0;
+}
+
+inline void StampedLock::unlockRead(std::uint64_t)
+{
+    std::uint64_t s = state_.fetch_sub(1) - 1;
+    if((s & kReaderMask) == 0 && (s & kWriteBit) != 0)
+        ParkingLot::unparkAll(&state_);
+}
+
+inline std::uint64_t StampedLock::tryOptimisticRead() const
+{
+    std::uint64_t s = state_.load(std::memory_order_acquire);
+    return (s & kWriteBit) == 0 ? s & kStampMask : 0;
+}
+
+inline bool StampedLock::validate(std::uint64_t stamp) const
+{
+    /* order the data reads before the second look at the state */
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return stamp != 0 &&
+           (state_.load(std::memory_order_relaxed) & kStampMask) == (stamp & kStampMask);
+}
+
+inline std::uint64_t StampedLock::tryConvertToWriteLock(std::uint64_t stamp)
+{
+    if(stamp == 0)
+        return 0;
+    if((stamp & kWriteBit) != 0)
+        return stamp;
+    /* read stamps carry the reader count, optimistic ones do not */
+    const std::uint64_t ownReaders = (stamp & kReaderMask) != 0 ? 1 : 0;
+    std::uint64_t s = state_.load(std::memory_order_relaxed);
+    while((s & kStampMask) == (stamp & kStampMask))
+    {
+        if((s & kReaderMask) != ownReaders)
+            return 0;
+        if(state_.compare_exchange_weak(s, (s - ownReaders) | kWriteBit))
+        {
+            std::atomic_thread_fence(std::memory_order_release);
+            return (s | kWriteBit) & kStampMask;
+        }
+    }
+    return 0;
+}
+
+inline bool StampedLock::isWriteLocked() const
+{
+    return (state_.load(std::memory_order_relaxed) & kWriteBit) != 0;
+}
+
+inline bool StampedLock::isReadLocked() const
+{
+    return (state_.load(std::memory_order_relaxed) & kReaderMask) != 0;
+}
+
+inline int StampedLock::getReadLockCount() const
+{
+    return static_cast<int>(state_.load(std::memory_order_relaxed) & kReaderMask);
+}
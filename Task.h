@@ -0,0 +1,172 @@
+# pragma once
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A move-only, type-erased {@code void()} callable for work queues.
+ *
+ * <p>Unlike std::function, whose inline buffer holds little more than a
+ * pointer or two, BasicTask keeps any closure of up to Size bytes
+ * inside itself, and it never copies, so closures may capture
+ * move-only state such as a std::unique_ptr or a std::promise. Only
+ * closures that are larger, over-aligned or whose move constructor may
+ * throw are put on the heap, which {@link fitsInline} tells at compile
+ * time.
+ *
+ * <p>The default {@code Task} holds 48 bytes, six pointers' worth of
+ * captures, and is itself one cache line. Queued in an
+ * ArrayBlockingQueue, a task lives in the queue's slot:
+ *
+ * <pre>
+ *   ArrayBlockingQueue<Task> tasks(1024);
+ *   tasks.emplace([req = std::move(req)]() mutable { handle(req); });
+ *
+ *   Task task;
+ *   tasks.take(task);         // moved out of the slot
+ *   task();
+ * </pre>
+ *
+ * so neither submitting nor dispatching it allocates.
+ *
+ * <p>A moved-from or default-constructed task is empty; calling it is
+ * undefined.
+ */
+template<std::size_t Size>
+class BasicTask
+{
+    public:
+        BasicTask() noexcept: ops_(nullptr) {}
+        BasicTask(std::nullptr_t) noexcept: ops_(nullptr) {}
+
+        template<typename F, typename = std::enable_if_t<
+            !std::is_same<std::decay_t<F>, BasicTask>::value &&
+            !std::is_same<std::decay_t<F>, std::nullptr_t>::value>>
+        BasicTask(F &&f);
+
+        BasicTask(BasicTask &&other) noexcept;
+        BasicTask& operator=(BasicTask &&other) noexcept;
+        BasicTask& operator=(std::nullptr_t) noexcept;
+        BasicTask(const BasicTask&) = delete;
+        BasicTask& operator=(const BasicTask&) = delete;
+        ~BasicTask() { reset(); }
+
+        /** Runs the callable; the task stays callable afterwards. */
+        void operator()() { ops_->invoke(storage_); }
+
+        explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+        /** True if a closure of type F is stored without allocating */
+        template<typename F>
+        static constexpr bool fitsInline()
+        {
+            return sizeof(F) <= Size && alignof(F) <= alignof(std::max_align_t) &&
+                   std::is_nothrow_move_constructible<F>::value;
+        }
+
+    private:
+        /** What a task does with its stored closure, one table per closure type */
+        struct Ops
+        {
+            void (*invoke)(void *storage);
+            /** Move-constructs the closure into to and destroys it in from */
+            void (*relocate)(void *from, void *to);
+            void (*destroy)(void *storage);
+        };
+
+        /* The closure lives in the buffer */
+        template<typename F>
+        struct InlineOps
+        {
+            static void invoke(void *p) { (*static_cast<F*>(p))(); }
+            static void relocate(void *from, void *to)
+            {
+                ::new(to) F(std::move(*static_cast<F*>(from)));
+                static_cast<F*>(from)->~F();
+            }
+            static void destroy(void *p) { static_cast<F*>(p)->~F(); }
+            static constexpr Ops ops = { invoke, relocate, destroy };
+        };
+
+        /* The buffer holds a pointer to the closure */
+        template<typename F>
+        struct HeapOps
+        {
+            static F *&get(void *p) { return *static_cast<F**>(p); }
+            static void invoke(void *p) { (*get(p))(); }
+            static void relocate(void *from, void *to) { ::new(to) F*(get(from)); }
+            static void destroy(void *p) { delete get(p); }
+            static constexpr Ops ops = { invoke, relocate, destroy };
+        };
+
+        void reset() noexcept;
+
+        static_assert(Size >= sizeof(void*), "BasicTask must have room for a pointer");
+
+        alignas(std::max_align_t) unsigned char storage_[Size];
+        const Ops *ops_;
+};
+
+/** A task with 48 bytes of inline storage, 64 bytes in all */
+typedef BasicTask<48> Task;
+
+template<std::size_t Size>
+template<typename F, typename>
+BasicTask<Size>::BasicTask(F &&f)
+{
+    typedef std::decay_t<F> Fn;
+    if constexpr(fitsInline<Fn>())
+    {
+        ::new(static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+        ops_ = &InlineOps<Fn>::ops;
+    }
+    else
+    {
+        ::new(static_cast<void*>(storage_)) Fn*(new Fn(std::forward<F>(f)));
+        ops_ = &HeapOps<Fn>::ops;
+    }
+}
+
+template<std::size_t Size>
+BasicTask<Size>::BasicTask(BasicTask &&other) noexcept: ops_(other.ops_)
+{
+    if(ops_ != nullptr)
+    {
+        ops_->relocate(other.storage_, storage_);
+        other.ops_ = nullptr;
+    }
+}
+
+template<std::size_t Size>
+BasicTask<Size>& BasicTask<Size>::operator=(BasicTask &&other) noexcept
+{
+    if(this != &other)
+    {
+        reset();
+        if(other.ops_ != nullptr)
+        {
+            other.ops_->relocate(other.storage_, storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+    return *this;
+}
+
+template<std::size_t Size>
+BasicTask<Size>& BasicTask<Size>::operator=(std::nullptr_t) noexcept
+{
+    reset();
+    return *this;
+}
+
+template<std::size_t Size>
+void BasicTask<Size>::reset() noexcept
+{
+    if(ops_ != nullptr)
+    {
+        ops_->destroy(storage_);
+        ops_ = nullptr;
+    }
+}
@@ -0,0 +1,386 @@
+# pragma once
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "Locks.h"
+#include "QueueStats.h"
+
+/**
+ * An optionally-bounded blocking deque whose two ends are synchronized
+ * independently: operations at the head take the head lock and
+ * operations at the tail the tail lock, so a producer at one end and a
+ * consumer at the other do not contend as they do on the single lock of
+ * LinkedBlockingDeque. The API is that of LinkedBlockingDeque, without
+ * select support.
+ *
+ * <p>The nodes form a doubly-linked list between two dummy nodes, one
+ * owned by each end. Two counts are kept atomically, as in
+ * LinkedBlockingQueue: slots_, the capacity reserved by puts, and
+ * items_, the elements linked and not yet claimed by a take. A put
+ * reserves its slot first and publishes its element in items_ once it
+ * is linked; a take claims its element in items_ first and gives the
+ * slot back once it is unlinked. Neither count ever overstates what the
+ * other end may rely on.
+ *
+ * <p>An end works under its own lock alone while the deque is long
+ * enough for the two ends not to touch the same node: a put needs two
+ * elements besides its own, a take three including its own, so that
+ * whatever the other end does meanwhile, the nodes either end writes
+ * are distinct. Near empty, an operation takes both locks, head lock
+ * first; an operation at the tail drops its lock to take them in that
+ * order.
+ *
+ * <p>Each end has its own conditions. The put that brings the deque out
+ * of empty wakes a take at both ends, the take that brings it out of
+ * full a put at both ends, and, as in LinkedBlockingQueue, a waiter that
+ * finds more elements (or room) behind its own wakes the next waiter at
+ * its end.
+ *
+ * <p>{@code Lock} is the type of both locks, std::mutex by default (see
+ * Locks.h).
+ */
+template<typename T, typename Lock = std::mutex>
+class TwoLockLinkedBlockingDeque
+{
+    public:
+        explicit TwoLockLinkedBlockingDeque(int capacity = std::numeric_limits<int>::max());
+        TwoLockLinkedBlockingDeque(const TwoLockLinkedBlockingDeque&) = delete;
+        TwoLockLinkedBlockingDeque& operator=(const TwoLockLinkedBlockingDeque&) = delete;
+        ~TwoLockLinkedBlockingDeque();
+
+        void putFirst(T value) { emplaceFirst(std::move(value)); }
+        bool offerFirst(T value);
+        template<typename... Args>
+        void emplaceFirst(Args&&... args);
+        std::shared_ptr<T> takeFirst() { return remove(kFirst, true); }
+        std::shared_ptr<T> pollFirst() { return remove(kFirst, false); }
+
+        void putLast(T value) { emplaceLast(std::move(value)); }
+        bool offerLast(T value);
+        template<typename... Args>
+        void emplaceLast(Args&&... args);
+        std::shared_ptr<T> takeLast() { return remove(kLast, true); }
+        std::shared_ptr<T> pollLast() { return remove(kLast, false); }
+
+        /** Equivalent to pollFirst() */
+        std::shared_ptr<T> poll() { return pollFirst(); }
+
+        bool empty() const { return size() == 0; }
+        int capacity() const { return capacity_; }
+        int size() const { return items_.load(); }
+        void clear();
+        QueueStatsSnapshot stats() const { return stats_.snapshot(); }
+
+    private:
+        enum End { kFirst, kLast };
+
+        struct Node
+        {
+            std::shared_ptr<T> item;
+            Node *prev = nullptr;
+            Node *next = nullptr;
+        };
+
+        /** The lock, conditions and dummy node of one end */
+        struct alignas(64) Side
+        {
+            Lock mutex;
+            ConditionVariableFor<Lock> notEmpty;
+            ConditionVariableFor<Lock> notFull;
+            Node dummy;
+        };
+
+        /** Elements, besides its own, a put needs to run under one lock */
+        static constexpr int kSoloPut = 2;
+        /** Elements, its own included, a take needs to run under one lock */
+        static constexpr int kSoloTake = 3;
+
+        Side &side(End end) { return end == kFirst ? first_ : last_; }
+
+        bool insert(End end, std::unique_ptr<Node> node, bool wait);
+        std::shared_ptr<T> remove(End end, bool wait);
+        bool reserveSlot(int &c);
+        bool claimItem(int min, int &c);
+        std::unique_lock<Lock> lockOther(End end, std::unique_lock<Lock> &lk);
+        void link(End end, Node *node);
+        std::shared_ptr<T> unlink(End end);
+        void signalNotEmpty();
+        void signalNotFull();
+
+        const int capacity_;
+        /** Elements linked and not claimed by a take */
+        alignas(64) std::atomic<int> items_;
+        /** Slots reserved by puts and not yet given back by takes */
+        std::atomic<int> slots_;
+        Side first_;
+        Side last_;
+        QueueStats stats_;
+};
+
+template<typename T, typename Lock>
+TwoLockLinkedBlockingDeque<T, Lock>::TwoLockLinkedBlockingDeque(int capacity):
+    capacity_(capacity), items_(0), slots_(0)
+{
+    first_.dummy.next = &last_.dummy;
+    last_.dummy.prev = &first_.dummy;
+}
+
+template<typename T, typename Lock>
+TwoLockLinkedBlockingDeque<T, Lock>::~TwoLockLinkedBlockingDeque()
+{
+    for(Node *p = first_.dummy.next; p != &last_.dummy; )
+    {
+        Node *next = p->next;
+        delete p;
+        p = next;
+    }
+}
+
+template<typename T, typename Lock>
+bool TwoLockLinkedBlockingDeque<T, Lock>::offerFirst(T value)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->item = std::make_shared<T>(std::move(value));
+    return insert(kFirst, std::move(node), false);
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void TwoLockLinkedBlockingDeque<T, Lock>::emplaceFirst(Args&&... args)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->item = std::make_shared<T>(std::forward<Args>(args)...);
+    insert(kFirst, std::move(node), true);
+}
+
+template<typename T, typename Lock>
+bool TwoLockLinkedBlockingDeque<T, Lock>::offerLast(T value)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->item = std::make_shared<T>(std::move(value));
+    return insert(kLast, std::move(node), false);
+}
+
+template<typename T, typename Lock>
+template<typename... Args>
+void TwoLockLinkedBlockingDeque<T, Lock>::emplaceLast(Args&&... args)
+{
+    std::unique_ptr<Node> node(new Node);
+    node->item = std::make_shared<T>(std::forward<Args>(args)...);
+    insert(kLast, std::move(node), true);
+}
+
+/**
+ * Links node at end, waiting for a slot if wait is set; returns false
+ * if there was none and wait is not set.
+ */
+template<typename T, typename Lock>
+bool TwoLockLinkedBlockingDeque<T, Lock>::insert(End end, std::unique_ptr<Node> node, bool wait)
+{
+    Side &s = side(end);
+    std::unique_lock<Lock> lk(s.mutex, std::defer_lock);
+    stats_.lock(lk);
+    int c;
+    if(wait)
+        stats_.awaitPut(s.notFull, lk, [this, &c]{ return reserveSlot(c); });
+    else if(!reserveSlot(c))
+        return false;
+    if(c + 1 < capacity_)
+        s.notFull.notify_one();
+
+    if(items_.load() >= kSoloPut)
+        link(end, node.release());
+    else
+    {
+        std::unique_lock<Lock> other = lockOther(end, lk);
+        link(end, node.release());
+    }
+    int n = items_.fetch_add(1);
+    stats_.recordPut(n + 1);
+    lk.unlock();
+    if(n == 0)
+        signalNotEmpty();
+    return true;
+}
+
+/**
+ * Unlinks and returns the element at end, waiting for one if wait is
+ * set; returns null if there was none and wait is not set.
+ */
+template<typename T, typename Lock>
+std::shared_ptr<T> TwoLockLinkedBlockingDeque<T, Lock>::remove(End end, bool wait)
+{
+    Side &s = side(end);
+    std::unique_lock<Lock> lk(s.mutex, std::defer_lock);
+    stats_.lock(lk);
+    std::shared_ptr<T> res;
+    int c;
+    for(;;)
+    {
+        if(wait)
+            stats_.awaitTake(s.notEmpty, lk, [this]{ return items_.load() > 0; });
+        else if(items_.load() == 0)
+            return res;
+        if(claimItem(kSoloTake - 1, c))
+        {
+            res = unlink(end);
+            break;
+        }
+        /* near empty; the other end may have taken the last element meanwhile */
+        std::unique_lock<Lock> other = lockOther(end, lk);
+        if(claimItem(0, c))
+        {
+            res = unlink(end);
+            break;
+        }
+    }
+    if(c > 1)
+        s.notEmpty.notify_one();
+    stats_.recordTake();
+    lk.unlock();
+    if(slots_.fetch_sub(1) == capacity_)
+        signalNotFull();
+    return res;
+}
+
+/* Reserves one of the capacity_ slots; c receives the count before. */
+template<typename T, typename Lock>
+bool TwoLockLinkedBlockingDeque<T, Lock>::reserveSlot(int &c)
+{
+    c = slots_.load();
+    while(c < capacity_)
+        if(slots_.compare_exchange_weak(c, c + 1))
+            return true;
+    return false;
+}
+
+/* Claims an element if more than min are unclaimed; c receives the count before. */
+template<typename T, typename Lock>
+bool TwoLockLinkedBlockingDeque<T, Lock>::claimItem(int min, int &c)
+{
+    c = items_.load();
+    while(c > min)
+        if(items_.compare_exchange_weak(c, c - 1))
+            return true;
+    return false;
+}
+
+/**
+ * With the lock of end held in lk, acquires the lock of the other end
+ * as well. The tail lock is always taken second, so at the tail lk is
+ * released and taken again after the head lock.
+ */
+template<typename T, typename Lock>
+std::unique_lock<Lock> TwoLockLinkedBlockingDeque<T, Lock>::lockOther(End end, std::unique_lock<Lock> &lk)
+{
+    if(end == kFirst)
+        return std::unique_lock<Lock>(last_.mutex);
+    lk.unlock();
+    std::unique_lock<Lock> other(first_.mutex);
+    lk.lock();
+    return other;
+}
+
+/* Called only when holding the lock of end, and the other one if near empty. */
+template<typename T, typename Lock>
+void TwoLockLinkedBlockingDeque<T, Lock>::link(End end, Node *node)
+{
+    if(end == kFirst)
+    {
+        Node *f = first_.dummy.next;
+        node->prev = &first_.dummy;
+        node->next = f;
+        f->prev = node;
+        first_.dummy.next = node;
+    }
+    else
+    {
+        Node *l = last_.dummy.prev;
+        node->next = &last_.dummy;
+        node->prev = l;
+        l->next = node;
+        last_.dummy.prev = node;
+    }
+}
+
+/* As link; the caller has claimed the element. */
+template<typename T, typename Lock>
+std::shared_ptr<T> TwoLockLinkedBlockingDeque<T, Lock>::unlink(End end)
+{
+    Node *x;
+    if(end == kFirst)
+    {
+        x = first_.dummy.next;
+        first_.dummy.next = x->next;
+        x->next->prev = &first_.dummy;
+    }
+    else
+    {
+        x = last_.dummy.prev;
+        last_.dummy.prev = x->prev;
+        x->prev->next = &last_.dummy;
+    }
+    std::shared_ptr<T> res(std::move(x->item));
+    delete x;
+    return res;
+}
+
+/**
+ * Wakes a take at each end. Called only from puts that found the deque
+ * empty, holding no lock.
+ */
+template<typename T, typename Lock>
+void TwoLockLinkedBlockingDeque<T, Lock>::signalNotEmpty()
+{
+    {
+        std::lock_guard<Lock> lk(first_.mutex);
+        first_.notEmpty.notify_one();
+    }
+    std::lock_guard<Lock> lk(last_.mutex);
+    last_.notEmpty.notify_one();
+}
+
+/**
+ * Wakes a put at each end. Called only from takes that found the deque
+ * full, holding no lock.
+ */
+template<typename T, typename Lock>
+void TwoLockLinkedBlockingDeque<T, Lock>::signalNotFull()
+{
+    {
+        std::lock_guard<Lock> lk(first_.mutex);
+        first_.notFull.notify_one();
+    }
+    std::lock_guard<Lock> lk(last_.mutex);
+    last_.notFull.notify_one();
+}
+
+/**
+ * Atomically removes all of the elements from this deque.
+ * The deque will be empty after this call returns.
+ */
+template<typename T, typename Lock>
+void TwoLockLinkedBlockingDeque<T, Lock>::clear()
+{
+    std::lock_guard<Lock> headLock(first_.mutex);
+    std::lock_guard<Lock> tailLock(last_.mutex);
+    int n = 0;
+    for(Node *p = first_.dummy.next; p != &last_.dummy; ++n)
+    {
+        Node *next = p->next;
+        delete p;
+        p = next;
+    }
+    first_.dummy.next = &last_.dummy;
+    last_.dummy.prev = &first_.dummy;
+    if(n == 0)
+        return;
+    /* with both locks held no take holds a claim, so items_ is n */
+    items_.fetch_sub(n);
+    slots_.fetch_sub(n);
+    first_.notFull.notify_all();
+    last_.notFull.notify_all();
+}
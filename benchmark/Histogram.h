@@ -0,0 +1,122 @@
+# pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+/**
+ * A log-linear latency histogram in the spirit of HdrHistogram.
+ *
+ * <p>Values below {@code 2^kSubBucketBits} are recorded exactly; larger
+ * values share a bucket with neighbours that have the same most
+ * significant bits, so the relative error of any reported percentile
+ * is bounded by {@code 2^-(kSubBucketBits-1)} (about 3%). Recording is
+ * a couple of shifts and an increment, cheap enough to run inside the
+ * consumer loop of the benchmark. Not thread safe: every thread owns
+ * its histogram and the results are merged afterwards.
+ */
+class LatencyHistogram
+{
+    public:
+        LatencyHistogram();
+        void record(std::uint64_t value);
+        void merge(const LatencyHistogram &other);
+        std::uint64_t count() const { return count_; }
+        std::uint64_t min() const { return count_ == 0 ? 0 : min_; }
+        std::uint64_t max() const { return max_; }
+        double mean() const;
+        std::uint64_t percentile(double q) const;
+
+    private:
+        static int bucketIndex(std::uint64_t value);
+        static std::uint64_t highestEquivalentValue(int index);
+
+    private:
+        static const int kSubBucketBits = 6;
+        static const int kSubBucketCount = 1 << kSubBucketBits;
+        static const int kSubBucketHalf = kSubBucketCount >> 1;
+        static const int kBucketCount = (64 - kSubBucketBits + 1) * kSubBucketHalf + kSubBucketHalf;
+
+        std::vector<std::uint64_t> buckets_;
+        std::uint64_t count_;
+        std::uint64_t min_;
+        std::uint64_t max_;
+        long double sum_;
+};
+
+inline LatencyHistogram::LatencyHistogram():
+    buckets_(kBucketCount, 0),
+    count_(0),
+    min_(std::numeric_limits<std::uint64_t>::max()),
+    max_(0),
+    sum_(0)
+{
+
+}
+
+/**
+ * Values in [2^m, 2^(m+1)) are shifted right until only the top
+ * kSubBucketBits bits remain; the shift selects the bucket group and
+ * the remaining bits the sub bucket inside it.
+ */
+inline int LatencyHistogram::bucketIndex(std::uint64_t value)
+{
+    if(value < static_cast<std::uint64_t>(kSubBucketCount))
+        return static_cast<int>(value);
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - (kSubBucketBits - 1);
+    return shift * kSubBucketHalf + static_cast<int>(value >> shift);
+}
+
+inline std::uint64_t LatencyHistogram::highestEquivalentValue(int index)
+{
+    if(index < kSubBucketCount)
+        return static_cast<std::uint64_t>(index);
+    int shift = index / kSubBucketHalf - 1;
+    std::uint64_t lower = static_cast<std::uint64_t>(index - shift * kSubBucketHalf) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+inline void LatencyHistogram::record(std::uint64_t value)
+{
+    ++buckets_[bucketIndex(value)];
+    ++count_;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+}
+
+inline void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for(int i = 0; i < kBucketCount; ++i)
+        buckets_[i] += other.buckets_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+}
+
+inline double LatencyHistogram::mean() const
+{
+    return count_ == 0 ? 0.0 : static_cast<double>(sum_ / count_);
+}
+
+/**
+ * Returns the value at quantile q (0 < q <= 1), reported as the
+ * highest value equivalent to the bucket the quantile falls into.
+ */
+inline std::uint64_t LatencyHistogram::percentile(double q) const
+{
+    if(count_ == 0)
+        return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(q * count_ + 0.5);
+    rank = std::max<std::uint64_t>(1, std::min(rank, count_));
+    std::uint64_t seen = 0;
+    for(int i = 0; i < kBucketCount; ++i)
+    {
+        seen += buckets_[i];
+        if(seen >= rank)
+            return std::min(highestEquivalentValue(i), max_);
+    }
+    return max_;
+}
@@ -0,0 +1,638 @@
+/*
+ * Throughput and latency benchmark for the blocking queues.
+ *
+ * Every run starts P producer and C consumer threads on one queue.
+ * Producers stamp each element with the enqueue time, consumers record
+ * the enqueue-to-dequeue latency in a per-thread histogram. When all
+ * producers are done one stop marker per consumer is queued, ordered
+ * after every data element even for the priority based queues.
+ *
+ * The abq-* and lbd-* entries run the same queues with the spin, ticket
+ * and MCS lock policies instead of std::mutex. sbq is a
+ * ShardedBlockingQueue with one shard per hardware thread, sharing the
+ * capacity between them. The bq-* entries are policy-built
+ * BlockingQueues: a ring under one lock, a ring under two locks and
+ * linked nodes under two locks, to set against abq and lbq. lbd2 is a
+ * TwoLockLinkedBlockingDeque, to set against lbd. cld is the lock-free
+ * ConcurrentLinkedDeque, whose consumers poll and yield since it cannot
+ * block. The *-mixed entries make every thread pick one of the two ends
+ * of the deque at random for each put and take.
+ *
+ * Usage:
+ *   queue_benchmark [--queues=abq,sbq,lbq,lbd,cld,pbq,dq] [--producers=1,2,4]
+ *                   [--consumers=1,2,4] [--sizes=16,256,1024]
+ *                   [--capacities=128,4096] [--ops=100000]
+ *                   [--format=table|csv|json] [--output=FILE] [--quick]
+ */
+#include "ArrayBlockingQueue.h"
+#include "BlockingQueue.h"
+#include "LinkedBlockingQueue.h"
+#include "LinkedBlockingDeque.h"
+#include "TwoLockLinkedBlockingDeque.h"
+#include "ConcurrentLinkedDeque.h"
+#include "PriorityBlockingQueue.h"
+#include "DelayQueue.h"
+#include "ShardedBlockingQueue.h"
+#include "CountDownLatch.h"
+#include "Locks.h"
+#include "Histogram.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::int64_t nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * The element moved through the queues. N is the total size in bytes,
+ * the stamp and the sequence number are part of it.
+ */
+template<std::size_t N>
+struct Payload
+{
+    static_assert(N >= 2 * sizeof(std::int64_t), "payload too small");
+
+    std::int64_t stamp = 0;
+    /** producer local sequence number, or -1 for the stop marker */
+    std::int64_t seq = 0;
+    std::array<char, N - 2 * sizeof(std::int64_t)> pad{};
+
+    bool stop() const { return seq < 0; }
+
+    /** Stop markers order after every data element, data by stamp. */
+    bool before(const Payload &rhs) const
+    {
+        if(stop() != rhs.stop())
+            return !stop();
+        return stamp < rhs.stamp;
+    }
+};
+
+/** Element type for PriorityBlockingQueue: the smallest is taken first. */
+template<std::size_t N>
+struct PriorityPayload : Payload<N>
+{
+    bool operator<(const PriorityPayload &rhs) const { return this->before(rhs); }
+};
+
+/**
+ * Element type for DelayQueue. std::priority_queue keeps the largest
+ * element on top, so the comparison is inverted like the Delayed class
+ * in the README. All elements are already expired when queued.
+ */
+template<std::size_t N>
+struct DelayedPayload : Payload<N>
+{
+    std::chrono::steady_clock::time_point due;
+    std::chrono::steady_clock::time_point getDelay() const { return due; }
+    bool operator<(const DelayedPayload &rhs) const { return rhs.before(*this); }
+};
+
+/*
+ * Adapters give every queue the same create/put/take surface.
+ */
+
+template<std::size_t N, typename Lock = std::mutex>
+struct ArrayQueueAdapter
+{
+    using Element = Payload<N>;
+    using Queue = ArrayBlockingQueue<Element, Lock>;
+    static std::unique_ptr<Queue> create(int capacity) { return std::unique_ptr<Queue>(new Queue(capacity)); }
+    static void put(Queue &q, Element e) { q.put(std::move(e)); }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+template<std::size_t N>
+struct ShardedQueueAdapter
+{
+    using Element = Payload<N>;
+    using Queue = ShardedBlockingQueue<Element>;
+    static std::unique_ptr<Queue> create(int capacity)
+    {
+        int shards = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        return std::unique_ptr<Queue>(new Queue(shards, std::max(1, capacity / shards)));
+    }
+    static void put(Queue &q, Element e) { q.put(std::move(e)); }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+template<std::size_t N>
+struct LinkedQueueAdapter
+{
+    using Element = Payload<N>;
+    using Queue = LinkedBlockingQueue<Element>;
+    static std::unique_ptr<Queue> create(int capacity) { return std::unique_ptr<Queue>(new Queue(capacity)); }
+    static void put(Queue &q, Element e) { q.put(std::move(e)); }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+/**
+ * Picks one of the two ends at random. Strict alternation could
+ * livelock: a consumer requeueing a stop marker would keep taking it
+ * from the end it just put it to.
+ */
+bool randomEnd()
+{
+    thread_local std::uint32_t seed = static_cast<std::uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed & 1) != 0;
+}
+
+template<std::size_t N, typename Lock = std::mutex, bool Mixed = false,
+         template<typename, typename> class Deque = LinkedBlockingDeque>
+struct LinkedDequeAdapter
+{
+    using Element = Payload<N>;
+    using Queue = Deque<Element, Lock>;
+    static std::unique_ptr<Queue> create(int capacity) { return std::unique_ptr<Queue>(new Queue(capacity)); }
+    static void put(Queue &q, Element e)
+    {
+        if(Mixed && randomEnd())
+            q.putFirst(std::move(e));
+        else
+            q.putLast(std::move(e));
+    }
+    static std::shared_ptr<Element> take(Queue &q)
+    {
+        return Mixed && randomEnd() ? q.takeLast() : q.takeFirst();
+    }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+template<std::size_t N, bool Mixed = false>
+struct ConcurrentDequeAdapter
+{
+    using Element = Payload<N>;
+    using Queue = ConcurrentLinkedDeque<Element>;
+    static std::unique_ptr<Queue> create(int) { return std::unique_ptr<Queue>(new Queue()); }
+    static void put(Queue &q, Element e)
+    {
+        if(Mixed && randomEnd())
+            q.offerFirst(std::move(e));
+        else
+            q.offerLast(std::move(e));
+    }
+    static std::shared_ptr<Element> take(Queue &q)
+    {
+        for(;;)
+        {
+            std::optional<Element> e = Mixed && randomEnd() ? q.pollLast() : q.pollFirst();
+            if(e)
+                return std::make_shared<Element>(std::move(*e));
+            std::this_thread::yield();
+        }
+    }
+    static QueueStatsSnapshot stats(const Queue &) { return QueueStatsSnapshot(); }
+};
+
+template<std::size_t N> using MixedLinkedDequeAdapter = LinkedDequeAdapter<N, std::mutex, true>;
+template<std::size_t N> using TwoLockDequeAdapter = LinkedDequeAdapter<N, std::mutex, false, TwoLockLinkedBlockingDeque>;
+template<std::size_t N> using MixedTwoLockDequeAdapter = LinkedDequeAdapter<N, std::mutex, true, TwoLockLinkedBlockingDeque>;
+template<std::size_t N> using MixedConcurrentDequeAdapter = ConcurrentDequeAdapter<N, true>;
+
+template<std::size_t N>
+struct PriorityQueueAdapter
+{
+    using Element = PriorityPayload<N>;
+    using Queue = PriorityBlockingQueue<Element>;
+    static std::unique_ptr<Queue> create(int) { return std::unique_ptr<Queue>(new Queue()); }
+    static void put(Queue &q, Element e) { q.put(std::move(e)); }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+template<std::size_t N>
+struct DelayQueueAdapter
+{
+    using Element = DelayedPayload<N>;
+    using Queue = DelayQueue<Element>;
+    static std::unique_ptr<Queue> create(int) { return std::unique_ptr<Queue>(new Queue()); }
+    static void put(Queue &q, Element e)
+    {
+        e.due = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(e.stamp));
+        q.put(std::move(e));
+    }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+/** Binds a lock policy so the adapters fit runSized below. */
+template<typename Lock>
+struct WithLock
+{
+    template<std::size_t N> using ArrayQueue = ArrayQueueAdapter<N, Lock>;
+    template<std::size_t N> using LinkedDeque = LinkedDequeAdapter<N, Lock>;
+};
+
+template<std::size_t N, typename Storage, typename Sync>
+struct PolicyQueueAdapter
+{
+    using Element = Payload<N>;
+    using Queue = BlockingQueue<Element, Storage, Sync, Bounded>;
+    static std::unique_ptr<Queue> create(int capacity) { return std::unique_ptr<Queue>(new Queue(capacity)); }
+    static void put(Queue &q, Element e) { q.put(std::move(e)); }
+    static std::shared_ptr<Element> take(Queue &q) { return q.take(); }
+    static QueueStatsSnapshot stats(const Queue &q) { return q.stats(); }
+};
+
+/** Binds the policies of a BlockingQueue so the adapter fits runSized. */
+template<typename Storage, typename Sync>
+struct WithPolicies
+{
+    template<std::size_t N> using Queue = PolicyQueueAdapter<N, Storage, Sync>;
+};
+
+struct RunSpec
+{
+    int producers;
+    int consumers;
+    int elementSize;
+    /** capacity bound, 0 for the unbounded queues */
+    int capacity;
+    long ops;
+};
+
+struct Result
+{
+    std::string queue;
+    RunSpec spec;
+    long ops;
+    double seconds;
+    LatencyHistogram latency;
+    QueueStatsSnapshot stats;
+
+    double throughput() const { return seconds > 0 ? ops / seconds : 0.0; }
+};
+
+/** Elements taken by one consumer, on a line of its own. */
+struct alignas(64) ConsumedCount
+{
+    std::atomic<long> n{0};
+};
+
+template<typename Adapter>
+Result runBenchmark(const std::string &name, const RunSpec &spec)
+{
+    using Element = typename Adapter::Element;
+    auto queue = Adapter::create(spec.capacity);
+    const long perProducer = spec.ops / spec.producers;
+    const long total = perProducer * spec.producers;
+
+    std::vector<LatencyHistogram> histograms(spec.consumers);
+    std::vector<ConsumedCount> consumed(spec.consumers);
+    CountDownLatch ready(spec.producers + spec.consumers);
+    CountDownLatch start(1);
+    std::vector<std::thread> producers;
+    std::vector<std::thread> consumers;
+
+    for(int p = 0; p < spec.producers; ++p)
+        producers.emplace_back([&]{
+            ready.countDown();
+            start.await();
+            for(long i = 0; i < perProducer; ++i)
+            {
+                Element e;
+                e.seq = i;
+                e.stamp = nowNanos();
+                Adapter::put(*queue, std::move(e));
+            }
+        });
+
+    for(int c = 0; c < spec.consumers; ++c)
+        consumers.emplace_back([&, c]{
+            LatencyHistogram &histogram = histograms[c];
+            ready.countDown();
+            start.await();
+            for(;;)
+            {
+                std::shared_ptr<Element> e = Adapter::take(*queue);
+                if(e->stop())
+                {
+                    long done = 0;
+                    for(const auto &count : consumed)
+                        done += count.n.load(std::memory_order_relaxed);
+                    if(done >= total)
+                        break;
+                    /* the queue is only FIFO per shard and the marker
+                     * overtook data still queued elsewhere */
+                    Adapter::put(*queue, std::move(*e));
+                    std::this_thread::yield();
+                    continue;
+                }
+                histogram.record(static_cast<std::uint64_t>(nowNanos() - e->stamp));
+                consumed[c].n.store(consumed[c].n.load(std::memory_order_relaxed) + 1,
+                                    std::memory_order_relaxed);
+            }
+        });
+
+    ready.await();
+    auto begin = std::chrono::steady_clock::now();
+    start.countDown();
+    for(auto &t : producers)
+        t.join();
+    for(int c = 0; c < spec.consumers; ++c)
+    {
+        Element stop;
+        stop.seq = -1;
+        stop.stamp = nowNanos();
+        Adapter::put(*queue, std::move(stop));
+    }
+    for(auto &t : consumers)
+        t.join();
+    auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.queue = name;
+    result.spec = spec;
+    result.ops = total;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    for(auto &h : histograms)
+        result.latency.merge(h);
+    result.stats = Adapter::stats(*queue);
+    return result;
+}
+
+/** Maps the runtime element size onto the compiled payload sizes. */
+template<template<std::size_t> class Adapter>
+bool runSized(const std::string &name, const RunSpec &spec, Result &result)
+{
+    switch(spec.elementSize)
+    {
+        case 16:   result = runBenchmark<Adapter<16>>(name, spec);   return true;
+        case 64:   result = runBenchmark<Adapter<64>>(name, spec);   return true;
+        case 256:  result = runBenchmark<Adapter<256>>(name, spec);  return true;
+        case 1024: result = runBenchmark<Adapter<1024>>(name, spec); return true;
+        case 4096: result = runBenchmark<Adapter<4096>>(name, spec); return true;
+        default:   return false;
+    }
+}
+
+struct QueueEntry
+{
+    std::string name;
+    bool bounded;
+    std::function<bool(const std::string&, const RunSpec&, Result&)> run;
+};
+
+std::vector<QueueEntry> registry()
+{
+    return {
+        { "abq",        true,  runSized<WithLock<std::mutex>::ArrayQueue> },
+        { "abq-spin",   true,  runSized<WithLock<SpinLock>::ArrayQueue> },
+        { "abq-ticket", true,  runSized<WithLock<TicketLock>::ArrayQueue> },
+        { "abq-mcs",    true,  runSized<WithLock<MCSLock>::ArrayQueue> },
+        { "sbq",        true,  runSized<ShardedQueueAdapter> },
+        { "lbq",        true,  runSized<LinkedQueueAdapter> },
+        { "bq-ring",    true,  runSized<WithPolicies<RingStorage, SingleLock<>>::Queue> },
+        { "bq-ring2",   true,  runSized<WithPolicies<RingStorage, TwoLock<>>::Queue> },
+        { "bq-linked2", true,  runSized<WithPolicies<LinkedStorage, TwoLock<>>::Queue> },
+        { "lbd",        true,  runSized<WithLock<std::mutex>::LinkedDeque> },
+        { "lbd-spin",   true,  runSized<WithLock<SpinLock>::LinkedDeque> },
+        { "lbd-ticket", true,  runSized<WithLock<TicketLock>::LinkedDeque> },
+        { "lbd-mcs",    true,  runSized<WithLock<MCSLock>::LinkedDeque> },
+        { "lbd-mixed",  true,  runSized<MixedLinkedDequeAdapter> },
+        { "lbd2",       true,  runSized<TwoLockDequeAdapter> },
+        { "lbd2-mixed", true,  runSized<MixedTwoLockDequeAdapter> },
+        { "cld",        false, runSized<ConcurrentDequeAdapter> },
+        { "cld-mixed",  false, runSized<MixedConcurrentDequeAdapter> },
+        { "pbq",        false, runSized<PriorityQueueAdapter> },
+        { "dq",         false, runSized<DelayQueueAdapter> },
+    };
+}
+
+enum class Format { Table, Csv, Json };
+
+struct Options
+{
+    std::vector<std::string> queues;
+    std::vector<int> producers = { 1, 2, 4 };
+    std::vector<int> consumers = { 1, 2, 4 };
+    std::vector<int> sizes = { 16, 256, 1024 };
+    std::vector<int> capacities = { 128, 4096 };
+    long ops = 100000;
+    Format format = Format::Table;
+    std::string output;
+};
+
+std::vector<std::string> splitList(const std::string &value)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(value);
+    std::string item;
+    while(std::getline(ss, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+std::vector<int> intList(const std::string &value)
+{
+    std::vector<int> items;
+    for(const auto &item : splitList(value))
+        items.push_back(std::atoi(item.c_str()));
+    return items;
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        std::string::size_type eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? std::string() : arg.substr(eq + 1);
+        if(key == "--queues")
+            options.queues = splitList(value);
+        else if(key == "--producers")
+            options.producers = intList(value);
+        else if(key == "--consumers")
+            options.consumers = intList(value);
+        else if(key == "--sizes")
+            options.sizes = intList(value);
+        else if(key == "--capacities")
+            options.capacities = intList(value);
+        else if(key == "--ops")
+            options.ops = std::atol(value.c_str());
+        else if(key == "--output")
+            options.output = value;
+        else if(key == "--format" && value == "table")
+            options.format = Format::Table;
+        else if(key == "--format" && value == "csv")
+            options.format = Format::Csv;
+        else if(key == "--format" && value == "json")
+            options.format = Format::Json;
+        else if(key == "--quick")
+        {
+            options.producers = { 1, 2 };
+            options.consumers = { 1, 2 };
+            options.sizes = { 64 };
+            options.capacities = { 1024 };
+            options.ops = 20000;
+        }
+        else
+        {
+            std::cerr << "unknown option: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void writeTable(std::ostream &os, const std::vector<Result> &results)
+{
+    os << std::left << std::setw(11) << "queue" << std::right
+       << std::setw(4) << "P" << std::setw(4) << "C"
+       << std::setw(7) << "size" << std::setw(8) << "cap"
+       << std::setw(10) << "ops" << std::setw(12) << "Mops/s"
+       << std::setw(11) << "p50(ns)" << std::setw(11) << "p99(ns)"
+       << std::setw(12) << "p99.9(ns)" << std::setw(12) << "max(ns)" << "\n";
+    for(const auto &r : results)
+    {
+        os << std::left << std::setw(11) << r.queue << std::right
+           << std::setw(4) << r.spec.producers << std::setw(4) << r.spec.consumers
+           << std::setw(7) << r.spec.elementSize
+           << std::setw(8) << (r.spec.capacity > 0 ? std::to_string(r.spec.capacity) : "-")
+           << std::setw(10) << r.ops
+           << std::setw(12) << std::fixed << std::setprecision(3) << r.throughput() / 1e6
+           << std::setw(11) << r.latency.percentile(0.50)
+           << std::setw(11) << r.latency.percentile(0.99)
+           << std::setw(12) << r.latency.percentile(0.999)
+           << std::setw(12) << r.latency.max() << "\n";
+    }
+}
+
+void writeCsv(std::ostream &os, const std::vector<Result> &results)
+{
+    os << "queue,producers,consumers,element_size,capacity,ops,seconds,"
+          "throughput_ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,mean_ns"
+#ifdef JAVATHREAD_ENABLE_STATS
+          ",puts_blocked,takes_blocked,put_wait_ns,take_wait_ns,max_depth,contended"
+#endif
+          "\n";
+    for(const auto &r : results)
+    {
+        os << r.queue << ',' << r.spec.producers << ',' << r.spec.consumers << ','
+           << r.spec.elementSize << ',' << r.spec.capacity << ',' << r.ops << ','
+           << r.seconds << ',' << r.throughput() << ','
+           << r.latency.percentile(0.50) << ',' << r.latency.percentile(0.99) << ','
+           << r.latency.percentile(0.999) << ',' << r.latency.max() << ','
+           << r.latency.mean();
+#ifdef JAVATHREAD_ENABLE_STATS
+        os << ',' << r.stats.putsBlocked << ',' << r.stats.takesBlocked << ','
+           << r.stats.putWaitNanos << ',' << r.stats.takeWaitNanos << ','
+           << r.stats.maxDepth << ',' << r.stats.contended;
+#endif
+        os << "\n";
+    }
+}
+
+void writeJson(std::ostream &os, const std::vector<Result> &results)
+{
+    os << "[\n";
+    for(std::size_t i = 0; i < results.size(); ++i)
+    {
+        const Result &r = results[i];
+        os << "  {\"queue\": \"" << r.queue << "\""
+           << ", \"producers\": " << r.spec.producers
+           << ", \"consumers\": " << r.spec.consumers
+           << ", \"element_size\": " << r.spec.elementSize
+           << ", \"capacity\": " << r.spec.capacity
+           << ", \"ops\": " << r.ops
+           << ", \"seconds\": " << r.seconds
+           << ", \"throughput_ops_per_sec\": " << r.throughput()
+           << ", \"latency_ns\": {\"p50\": " << r.latency.percentile(0.50)
+           << ", \"p99\": " << r.latency.percentile(0.99)
+           << ", \"p999\": " << r.latency.percentile(0.999)
+           << ", \"max\": " << r.latency.max()
+           << ", \"mean\": " << r.latency.mean() << "}";
+#ifdef JAVATHREAD_ENABLE_STATS
+        os << ", \"stats\": {\"puts\": " << r.stats.puts
+           << ", \"takes\": " << r.stats.takes
+           << ", \"puts_blocked\": " << r.stats.putsBlocked
+           << ", \"takes_blocked\": " << r.stats.takesBlocked
+           << ", \"put_wait_ns\": " << r.stats.putWaitNanos
+           << ", \"take_wait_ns\": " << r.stats.takeWaitNanos
+           << ", \"max_depth\": " << r.stats.maxDepth
+           << ", \"contended\": " << r.stats.contended << "}";
+#endif
+        os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if(!parseOptions(argc, argv, options))
+        return 1;
+
+    std::vector<QueueEntry> entries;
+    for(auto &entry : registry())
+    {
+        bool selected = options.queues.empty();
+        for(const auto &name : options.queues)
+            selected = selected || name == entry.name;
+        if(selected)
+            entries.push_back(entry);
+    }
+
+    std::vector<Result> results;
+    for(const auto &entry : entries)
+    {
+        std::vector<int> capacities = entry.bounded ? options.capacities : std::vector<int>{ 0 };
+        for(int producers : options.producers)
+            for(int consumers : options.consumers)
+                for(int size : options.sizes)
+                    for(int capacity : capacities)
+                    {
+                        RunSpec spec = { producers, consumers, size, capacity, options.ops };
+                        Result result;
+                        if(!entry.run(entry.name, spec, result))
+                        {
+                            std::cerr << "unsupported element size: " << size << "\n";
+                            return 1;
+                        }
+                        results.push_back(std::move(result));
+                    }
+    }
+
+    std::ofstream file;
+    if(!options.output.empty())
+        file.open(options.output);
+    std::ostream &os = options.output.empty() ? std::cout : file;
+    switch(options.format)
+    {
+        case Format::Table: writeTable(os, results); break;
+        case Format::Csv:   writeCsv(os, results);   break;
+        case Format::Json:  writeJson(os, results);  break;
+    }
+    return 0;
+}